@@ -1248,6 +1248,13 @@ LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
   if (level == CACHE_EXIST) {
     return luaL_loadfilex_(L, filename, mode);
   }
+  if (filename) {
+    /* don't create a state for a missing file, let luaL_loadfilex_ report it */
+    FILE *f = fopen(filename, "r");
+    if (f == NULL)
+      return luaL_loadfilex_(L, filename, mode);
+    fclose(f);
+  }
   eL = luaL_newstate();
   if (eL == NULL) {
     lua_pushliteral(L, "New state failed");
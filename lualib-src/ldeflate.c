@@ -0,0 +1,272 @@
+#define LUA_LIB
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <zlib.h>
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+	permessage-deflate (RFC 7692)
+
+	The payload is raw deflate data (no zlib header) flushed by Z_SYNC_FLUSH,
+	without the tail 0x00 0x00 0xff 0xff .
+	Without context takeover, the stream is reset before each message, so one stream
+	can be shared by all the connections of a service.
+ */
+
+#define CHUNK_SIZE 4096
+#define DICTIONARY_INDEX 1
+
+static const uint8_t TAIL[4] = { 0x00, 0x00, 0xff, 0xff };
+
+struct deflate_stream {
+	z_stream z;
+	int inflate;
+	int init;
+	int window_bits;
+	const uint8_t * dict;
+	size_t dict_sz;
+};
+
+static void
+set_dictionary(lua_State *L, struct deflate_stream *s) {
+	if (s->dict == NULL)
+		return;
+	int r = s->inflate ?
+		inflateSetDictionary(&s->z, s->dict, s->dict_sz) :
+		deflateSetDictionary(&s->z, s->dict, s->dict_sz);
+	if (r != Z_OK) {
+		luaL_error(L, "Set dictionary failed : %d", r);
+	}
+}
+
+static void
+reset_stream(lua_State *L, struct deflate_stream *s) {
+	int r = s->inflate ? inflateReset(&s->z) : deflateReset(&s->z);
+	if (r != Z_OK) {
+		luaL_error(L, "Reset stream failed : %d", r);
+	}
+	set_dictionary(L, s);
+}
+
+static struct deflate_stream *
+check_stream(lua_State *L, int inflate) {
+	struct deflate_stream * s = (struct deflate_stream *)luaL_checkudata(L, 1, "WS_DEFLATE_STREAM");
+	if (!s->init) {
+		luaL_error(L, "The stream is closed");
+	}
+	if (s->inflate != inflate) {
+		luaL_error(L, "Not a %s stream", inflate ? "inflate" : "deflate");
+	}
+	return s;
+}
+
+/*
+	userdata stream
+	string data
+	boolean reset (optional) : no context takeover, reset the stream before compress
+
+	return the compressed payload
+ */
+static int
+ldeflate(lua_State *L) {
+	struct deflate_stream * s = check_stream(L, 0);
+	size_t sz;
+	const char * data = luaL_checklstring(L, 2, &sz);
+	if (lua_toboolean(L, 3)) {
+		reset_stream(L, s);
+	}
+	luaL_Buffer b;
+	luaL_buffinit(L, &b);
+	s->z.next_in = (Bytef *)data;
+	s->z.avail_in = (uInt)sz;
+	do {
+		char * out = luaL_prepbuffsize(&b, CHUNK_SIZE);
+		s->z.next_out = (Bytef *)out;
+		s->z.avail_out = CHUNK_SIZE;
+		int r = deflate(&s->z, Z_SYNC_FLUSH);
+		if (r != Z_OK && r != Z_BUF_ERROR) {
+			return luaL_error(L, "Deflate failed : %d", r);
+		}
+		luaL_addsize(&b, CHUNK_SIZE - s->z.avail_out);
+	} while (s->z.avail_out == 0);
+	// Z_SYNC_FLUSH always ends with an empty stored block : 0x00 0x00 0xff 0xff
+	if (luaL_bufflen(&b) >= 4 && memcmp(luaL_buffaddr(&b) + luaL_bufflen(&b) - 4, TAIL, 4) == 0) {
+		luaL_buffsub(&b, 4);
+	}
+	luaL_pushresult(&b);
+	return 1;
+}
+
+static int
+inflate_input(lua_State *L, struct deflate_stream *s, luaL_Buffer *b, const void *data, size_t sz, size_t max) {
+	s->z.next_in = (Bytef *)data;
+	s->z.avail_in = (uInt)sz;
+	do {
+		char * out = luaL_prepbuffsize(b, CHUNK_SIZE);
+		s->z.next_out = (Bytef *)out;
+		s->z.avail_out = CHUNK_SIZE;
+		int r = inflate(&s->z, Z_SYNC_FLUSH);
+		luaL_addsize(b, CHUNK_SIZE - s->z.avail_out);
+		if (r == Z_STREAM_END) {
+			// the peer set BFINAL, the rest (the tail) belongs to a new stream
+			reset_stream(L, s);
+			return 1;
+		}
+		if ((r != Z_OK && r != Z_BUF_ERROR) || luaL_bufflen(b) > max) {
+			reset_stream(L, s);
+			return luaL_error(L, r == Z_OK || r == Z_BUF_ERROR ? "Inflated message is too large" : "Inflate failed : %d", r);
+		}
+	} while (s->z.avail_out == 0);
+	return 0;
+}
+
+/*
+	userdata stream
+	string data
+	integer max : max size of the inflated message
+	boolean reset (optional) : no context takeover, reset the stream before decompress
+
+	return the decompressed message
+ */
+static int
+linflate(lua_State *L) {
+	struct deflate_stream * s = check_stream(L, 1);
+	size_t sz;
+	const char * data = luaL_checklstring(L, 2, &sz);
+	size_t max = (size_t)luaL_checkinteger(L, 3);
+	if (lua_toboolean(L, 4)) {
+		reset_stream(L, s);
+	}
+	luaL_Buffer b;
+	luaL_buffinit(L, &b);
+	if (inflate_input(L, s, &b, data, sz, max) == 0) {
+		inflate_input(L, s, &b, TAIL, sizeof(TAIL), max);
+	}
+	luaL_pushresult(&b);
+	return 1;
+}
+
+static int
+lreset(lua_State *L) {
+	struct deflate_stream * s = (struct deflate_stream *)luaL_checkudata(L, 1, "WS_DEFLATE_STREAM");
+	if (s->init) {
+		reset_stream(L, s);
+	}
+	return 0;
+}
+
+static int
+lclose(lua_State *L) {
+	struct deflate_stream * s = (struct deflate_stream *)luaL_checkudata(L, 1, "WS_DEFLATE_STREAM");
+	if (s->init) {
+		if (s->inflate) {
+			inflateEnd(&s->z);
+		} else {
+			deflateEnd(&s->z);
+		}
+		s->init = 0;
+	}
+	return 0;
+}
+
+/*
+	string mode : "deflate" or "inflate"
+	integer window_bits (optional, 9 - 15, default 15)
+	integer level (optional, deflate only, default Z_DEFAULT_COMPRESSION)
+	integer mem_level (optional, deflate only, 1 - 9, default 8)
+	string dictionary (optional) : the preset dictionary, applied after each reset
+
+	return the stream
+ */
+static int
+lnew(lua_State *L) {
+	const char * mode = luaL_checkstring(L, 1);
+	int window_bits = (int)luaL_optinteger(L, 2, 15);
+	int level = (int)luaL_optinteger(L, 3, Z_DEFAULT_COMPRESSION);
+	int mem_level = (int)luaL_optinteger(L, 4, 8);
+	size_t dict_sz = 0;
+	const char * dict = luaL_optlstring(L, 5, NULL, &dict_sz);
+	int inflate;
+	if (strcmp(mode, "deflate") == 0) {
+		inflate = 0;
+	} else if (strcmp(mode, "inflate") == 0) {
+		inflate = 1;
+	} else {
+		return luaL_error(L, "Invalid mode %s (deflate/inflate)", mode);
+	}
+	// zlib doesn't support raw deflate with 256 bytes window
+	if (window_bits < 9 || window_bits > 15) {
+		return luaL_error(L, "Invalid window bits %d", window_bits);
+	}
+	struct deflate_stream * s = (struct deflate_stream *)lua_newuserdatauv(L, sizeof(*s), 1);
+	memset(s, 0, sizeof(*s));
+	s->inflate = inflate;
+	s->window_bits = window_bits;
+	if (dict) {
+		// keep the dictionary string alive with the stream, the streams share the same string
+		lua_pushvalue(L, 5);
+		lua_setiuservalue(L, -2, DICTIONARY_INDEX);
+		s->dict = (const uint8_t *)dict;
+		s->dict_sz = dict_sz;
+	}
+	int r = inflate ?
+		inflateInit2(&s->z, -window_bits) :
+		deflateInit2(&s->z, level, Z_DEFLATED, -window_bits, mem_level, Z_DEFAULT_STRATEGY);
+	if (r != Z_OK) {
+		return luaL_error(L, "Init %s stream failed : %d", mode, r);
+	}
+	s->init = 1;
+	if (luaL_newmetatable(L, "WS_DEFLATE_STREAM")) {
+		luaL_Reg l[] = {
+			{ "deflate", ldeflate },
+			{ "inflate", linflate },
+			{ "reset", lreset },
+			{ "close", lclose },
+			{ NULL, NULL },
+		};
+		luaL_newlib(L, l);
+		lua_setfield(L, -2, "__index");
+		lua_pushcfunction(L, lclose);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+	set_dictionary(L, s);
+	return 1;
+}
+
+/*
+	string mode
+	integer window_bits
+	integer mem_level (optional)
+
+	return the approximate memory usage of a stream (see zconf.h)
+ */
+static int
+lmemory(lua_State *L) {
+	const char * mode = luaL_checkstring(L, 1);
+	int window_bits = (int)luaL_optinteger(L, 2, 15);
+	int mem_level = (int)luaL_optinteger(L, 3, 8);
+	lua_Integer sz;
+	if (strcmp(mode, "inflate") == 0) {
+		sz = (1 << window_bits) + 7 * 1024;
+	} else {
+		sz = (1 << (window_bits + 2)) + (1 << (mem_level + 9));
+	}
+	lua_pushinteger(L, sz);
+	return 1;
+}
+
+LUAMOD_API int
+luaopen_ldeflate(lua_State *L) {
+	luaL_checkversion(L);
+	luaL_Reg l[] = {
+		{ "new", lnew },
+		{ "memory", lmemory },
+		{ NULL, NULL },
+	};
+	luaL_newlib(L, l);
+	return 1;
+}
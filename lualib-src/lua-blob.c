@@ -0,0 +1,215 @@
+#define LUA_LIB
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "skynet_malloc.h"
+#include "atomic.h"
+#include "lua-blob.h"
+#include "lua-seri.h"
+
+/*
+	An immutable byte buffer shared by the services in one process.
+	skynet.pack packs a reference of the blob (see lua-seri.c), and the receiver
+	grabs a reference when it unpacks the message, so the bytes are never copied.
+	The message owns its references until a lua service frees it (see luaseri_release):
+	after the dispatch of a protocol packed by skynet.pack, by skynet.trash with the
+	type, by the last mc.close of a multicast, or by cluster.packrequest.
+	The core never reads the messages, so a message it drops (to a dead service, the
+	late response of a deadline, a failed send) keeps them and the blobs are leaked.
+ */
+
+#define BLOB_META "SKYNET_BLOB"
+
+struct blob {
+	ATOM_INT reference;
+	size_t sz;
+	void * data;	// inline after the struct, or a buffer alloc by skynet_malloc
+};
+
+struct boxblob {
+	struct blob * b;
+};
+
+// the blobs alive in the process
+static ATOM_INT live = 0;
+
+struct blob *
+luablob_get(lua_State *L, int index) {
+	struct boxblob * box = (struct boxblob *)luaL_testudata(L, index, BLOB_META);
+	if (box == NULL || box->b == NULL)
+		return NULL;
+	return box->b;
+}
+
+void
+luablob_grab(struct blob *b) {
+	ATOM_FINC(&b->reference);
+}
+
+void
+luablob_release(struct blob *b) {
+	if (ATOM_FDEC(&b->reference) > 1)
+		return;
+	if (b->data != (void *)(b + 1)) {
+		skynet_free(b->data);
+	}
+	skynet_free(b);
+	ATOM_FDEC(&live);
+}
+
+const void *
+luablob_data(struct blob *b, size_t *sz) {
+	*sz = b->sz;
+	return b->data;
+}
+
+static struct blob *
+check_blob(lua_State *L, int index) {
+	struct boxblob * box = (struct boxblob *)luaL_checkudata(L, index, BLOB_META);
+	if (box->b == NULL) {
+		luaL_error(L, "The blob is released");
+	}
+	return box->b;
+}
+
+static int
+lrelease(lua_State *L) {
+	struct boxblob * box = (struct boxblob *)luaL_checkudata(L, 1, BLOB_META);
+	if (box->b) {
+		luablob_release(box->b);
+		box->b = NULL;
+	}
+	return 0;
+}
+
+static int
+llen(lua_State *L) {
+	struct blob * b = check_blob(L, 1);
+	lua_pushinteger(L, b->sz);
+	return 1;
+}
+
+/*
+	userdata blob
+	integer i (optional, default 1)
+	integer j (optional, default -1)
+
+	return the bytes from i to j as a string (like string.sub)
+ */
+static int
+ltostring(lua_State *L) {
+	struct blob * b = check_blob(L, 1);
+	lua_Integer sz = (lua_Integer)b->sz;
+	lua_Integer i = luaL_optinteger(L, 2, 1);
+	lua_Integer j = luaL_optinteger(L, 3, -1);
+	if (i < 0)
+		i = (-i > sz) ? 1 : sz + i + 1;
+	else if (i == 0)
+		i = 1;
+	if (j < 0)
+		j = sz + j + 1;
+	else if (j > sz)
+		j = sz;
+	if (i > j) {
+		lua_pushliteral(L, "");
+	} else {
+		lua_pushlstring(L, (const char *)b->data + i - 1, (size_t)(j - i + 1));
+	}
+	return 1;
+}
+
+static int
+lname(lua_State *L) {
+	struct boxblob * box = (struct boxblob *)luaL_checkudata(L, 1, BLOB_META);
+	if (box->b) {
+		lua_pushfstring(L, "blob: %p (%d bytes)", box->b, (int)box->b->sz);
+	} else {
+		lua_pushliteral(L, "blob: released");
+	}
+	return 1;
+}
+
+static void
+set_metatable(lua_State *L) {
+	if (luaL_newmetatable(L, BLOB_META)) {
+		luaL_Reg l[] = {
+			{ "tostring", ltostring },
+			{ "release", lrelease },
+			{ NULL, NULL },
+		};
+		luaL_newlib(L, l);
+		lua_setfield(L, -2, "__index");
+		lua_pushcfunction(L, lrelease);
+		lua_setfield(L, -2, "__gc");
+		lua_pushcfunction(L, llen);
+		lua_setfield(L, -2, "__len");
+		lua_pushcfunction(L, lname);
+		lua_setfield(L, -2, "__tostring");
+	}
+	lua_setmetatable(L, -2);
+}
+
+void
+luablob_push(lua_State *L, struct blob *b) {
+	struct boxblob * box = (struct boxblob *)lua_newuserdatauv(L, sizeof(*box), 0);
+	box->b = b;
+	set_metatable(L);
+}
+
+/*
+	string data
+	or
+	lightuserdata msg (alloc by skynet_malloc, the blob takes it)
+	integer sz
+
+	return a blob
+ */
+static int
+lnew(lua_State *L) {
+	struct blob * b;
+	if (lua_type(L, 1) == LUA_TLIGHTUSERDATA) {
+		void * msg = lua_touserdata(L, 1);
+		size_t sz = (size_t)luaL_checkinteger(L, 2);
+		// keep the bytes only, a packed message gives up the blobs in it
+		luaseri_release(msg, sz);
+		b = skynet_malloc(sizeof(*b));
+		b->data = msg;
+		b->sz = sz;
+	} else {
+		size_t sz;
+		const char * str = luaL_checklstring(L, 1, &sz);
+		b = skynet_malloc(sizeof(*b) + sz);
+		b->data = (void *)(b + 1);
+		b->sz = sz;
+		memcpy(b->data, str, sz);
+	}
+	ATOM_INIT(&b->reference, 1);
+	ATOM_FINC(&live);
+	luablob_push(L, b);
+	return 1;
+}
+
+// the number of blobs alive in the process, for debug
+static int
+lcount(lua_State *L) {
+	lua_pushinteger(L, ATOM_LOAD(&live));
+	return 1;
+}
+
+LUAMOD_API int
+luaopen_skynet_blob(lua_State *L) {
+	luaL_checkversion(L);
+	luaL_Reg l[] = {
+		{ "new", lnew },
+		{ "tostring", ltostring },
+		{ "release", lrelease },
+		{ "count", lcount },
+		{ NULL, NULL },
+	};
+	luaL_newlib(L, l);
+	return 1;
+}
@@ -0,0 +1,17 @@
+#ifndef LUA_BLOB_H
+#define LUA_BLOB_H
+
+#include <lua.h>
+#include <stddef.h>
+
+struct blob;
+
+// return NULL if the value at index is not a blob
+struct blob * luablob_get(lua_State *L, int index);
+void luablob_grab(struct blob *b);
+void luablob_release(struct blob *b);
+// push a blob userdata, it takes the reference of b
+void luablob_push(lua_State *L, struct blob *b);
+const void * luablob_data(struct blob *b, size_t *sz);
+
+#endif
@@ -7,6 +7,7 @@
 #include <unistd.h>
 
 #include "skynet.h"
+#include "lua-seri.h"
 
 /*
 	uint32_t/string addr 
@@ -105,12 +106,19 @@ packreq_number(lua_State *L, int session, void * msg, uint32_t sz, int is_push)
 	}
 }
 
+// the blob references are valid only in this process, the request gives them up
+static void
+free_request(void * msg, uint32_t sz) {
+	luaseri_release(msg, sz);
+	skynet_free(msg);
+}
+
 static int
 packreq_string(lua_State *L, int session, void * msg, uint32_t sz, int is_push) {
 	size_t namelen = 0;
 	const char *name = lua_tolstring(L, 1, &namelen);
 	if (name == NULL || namelen < 1 || namelen > 255) {
-		skynet_free(msg);
+		free_request(msg, sz);
 		if (name == NULL) {
 			luaL_error(L, "name is not a string, it's a %s", lua_typename(L, lua_type(L, 1)));
 		} else {
@@ -177,7 +185,7 @@ packrequest(lua_State *L, int is_push) {
 	uint32_t sz = (uint32_t)luaL_checkinteger(L,4);
 	int session = luaL_checkinteger(L,2);
 	if (session <= 0) {
-		skynet_free(msg);
+		free_request(msg, sz);
 		return luaL_error(L, "Invalid request session %d", session);
 	}
 	int addr_type = lua_type(L,1);
@@ -195,10 +203,10 @@ packrequest(lua_State *L, int is_push) {
 	if (multipak) {
 		lua_createtable(L, multipak, 0);
 		packreq_multi(L, session, msg, sz);
-		skynet_free(msg);
+		free_request(msg, sz);
 		return 3;
 	} else {
-		skynet_free(msg);
+		free_request(msg, sz);
 		return 2;
 	}
 }
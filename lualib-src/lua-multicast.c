@@ -8,6 +8,7 @@
 #include <string.h>
 
 #include "atomic.h"
+#include "lua-seri.h"
 
 struct mc_package {
 	ATOM_INT reference;
@@ -112,6 +113,8 @@ mc_closelocal(lua_State *L) {
 
 	int ref = ATOM_FDEC(&pack->reference)-1;
 	if (ref <= 0) {
+		// the message is shared by the subscribers, the last one releases the blobs in it
+		luaseri_release(pack->data, pack->size);
 		skynet_free(pack->data);
 		skynet_free(pack);
 		if (ref < 0) {
@@ -23,6 +23,9 @@
 #define TYPE_CLOSE 5
 #define TYPE_WARNING 6
 #define TYPE_INIT 7
+#define TYPE_BATCH 8
+
+#define NETPACK_BUFFER "NETPACK_BUFFER"
 
 /*
 	Each package is uint16 + data , uint16 (serialized in big-endian) is the number of bytes comprising the data .
@@ -41,6 +44,12 @@ struct uncomplete {
 	int header;
 };
 
+// the socket message buffer shared by all the packets of a batch, freed by gc
+struct netpack_buffer {
+	void * buffer;
+	int size;
+};
+
 struct queue {
 	int cap;
 	int head;
@@ -114,6 +123,19 @@ find_uncomplete(struct queue *q, int fd) {
 	return NULL;
 }
 
+static int
+has_uncomplete(struct queue *q, int fd) {
+	if (q == NULL)
+		return 0;
+	struct uncomplete * uc = q->hash[hash_fd(fd)];
+	while (uc) {
+		if (uc->pack.id == fd)
+			return 1;
+		uc = uc->next;
+	}
+	return 0;
+}
+
 static struct queue *
 get_queue(lua_State *L) {
 	struct queue *q = lua_touserdata(L,1);
@@ -316,6 +338,69 @@ filter_data(lua_State *L, int fd, uint8_t * buffer, int size) {
 	return ret;
 }
 
+// return the number of packets when buffer contains only complete packets, or -1
+static int
+count_packets(const uint8_t * buffer, int size) {
+	int n = 0;
+	while (size >= 2) {
+		int pack_size = read_size((uint8_t *)buffer);
+		if (pack_size > size - 2)
+			return -1;
+		buffer += 2 + pack_size;
+		size -= 2 + pack_size;
+		++n;
+	}
+	return size == 0 ? n : -1;
+}
+
+/*
+	When buffer contains only complete packets (always true for sockets started with framing),
+	return them as one batch without copy :
+		userdata netpack_buffer (own the buffer)
+		table { msg1, sz1, msg2, sz2, ... }	-- lightuserdata point into the buffer
+	or fallback to filter_data
+ */
+static int
+filter_batch(lua_State *L, int fd, uint8_t * buffer, int size) {
+	struct queue *q = lua_touserdata(L,1);
+	int n;
+	if (has_uncomplete(q, fd) || (n = count_packets(buffer, size)) <= 0) {
+		return filter_data(L, fd, buffer, size);
+	}
+	lua_pushvalue(L, lua_upvalueindex(TYPE_BATCH));
+	lua_pushinteger(L, fd);
+	struct netpack_buffer * b = lua_newuserdatauv(L, sizeof(*b), 0);
+	b->buffer = buffer;
+	b->size = size;
+	luaL_setmetatable(L, NETPACK_BUFFER);
+	lua_createtable(L, n * 2, 0);
+	int i;
+	for (i=1;i<=n*2;i+=2) {
+		int pack_size = read_size(buffer);
+		lua_pushlightuserdata(L, buffer + 2);
+		lua_rawseti(L, -2, i);
+		lua_pushinteger(L, pack_size);
+		lua_rawseti(L, -2, i+1);
+		buffer += 2 + pack_size;
+	}
+	return 5;
+}
+
+static int
+lbuffer_gc(lua_State *L) {
+	struct netpack_buffer * b = luaL_checkudata(L, 1, NETPACK_BUFFER);
+	skynet_free(b->buffer);
+	b->buffer = NULL;
+	return 0;
+}
+
+static int
+lbuffer_len(lua_State *L) {
+	struct netpack_buffer * b = luaL_checkudata(L, 1, NETPACK_BUFFER);
+	lua_pushinteger(L, b->size);
+	return 1;
+}
+
 static void
 pushstring(lua_State *L, const char * msg, int size) {
 	if (msg) {
@@ -336,7 +421,7 @@ pushstring(lua_State *L, const char * msg, int size) {
 		string msg | lightuserdata/integer
  */
 static int
-lfilter(lua_State *L) {
+filter_message(lua_State *L, int batch) {
 	struct skynet_socket_message *message = lua_touserdata(L,2);
 	int size = luaL_checkinteger(L,3);
 	char * buffer = message->buffer;
@@ -353,6 +438,9 @@ lfilter(lua_State *L) {
 	case SKYNET_SOCKET_TYPE_DATA:
 		// ignore listen id (message->id)
 		assert(size == -1);	// never padding string
+		if (batch) {
+			return filter_batch(L, message->id, (uint8_t *)buffer, message->ud);
+		}
 		return filter_data(L, message->id, (uint8_t *)buffer, message->ud);
 	case SKYNET_SOCKET_TYPE_CONNECT:
 		lua_pushvalue(L, lua_upvalueindex(TYPE_INIT));
@@ -390,6 +478,23 @@ lfilter(lua_State *L) {
 	}
 }
 
+static int
+lfilter(lua_State *L) {
+	return filter_message(L, 0);
+}
+
+/*
+	the same as filter, but complete packets in one socket message return as
+		integer type ("batch")
+		integer fd
+		userdata buffer
+		table packets
+ */
+static int
+lfilter_batch(lua_State *L) {
+	return filter_message(L, 1);
+}
+
 /*
 	userdata queue
 	return
@@ -480,6 +585,14 @@ luaopen_skynet_netpack(lua_State *L) {
 	};
 	luaL_newlib(L,l);
 
+	if (luaL_newmetatable(L, NETPACK_BUFFER)) {
+		lua_pushcfunction(L, lbuffer_gc);
+		lua_setfield(L, -2, "__gc");
+		lua_pushcfunction(L, lbuffer_len);
+		lua_setfield(L, -2, "__len");
+	}
+	lua_pop(L, 1);
+
 	// the order is same with macros : TYPE_* (defined top)
 	lua_pushliteral(L, "data");
 	lua_pushliteral(L, "more");
@@ -488,8 +601,16 @@ luaopen_skynet_netpack(lua_State *L) {
 	lua_pushliteral(L, "close");
 	lua_pushliteral(L, "warning");
 	lua_pushliteral(L, "init");
+	lua_pushliteral(L, "batch");
+
+	int i;
+	for (i=0;i<TYPE_BATCH;i++) {
+		lua_pushvalue(L, -TYPE_BATCH);
+	}
+	lua_pushcclosure(L, lfilter_batch, TYPE_BATCH);
+	lua_setfield(L, -TYPE_BATCH-2, "filter_batch");
 
-	lua_pushcclosure(L, lfilter, 7);
+	lua_pushcclosure(L, lfilter, TYPE_BATCH);
 	lua_setfield(L, -2, "filter");
 
 	return 1;
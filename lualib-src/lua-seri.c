@@ -8,10 +8,16 @@
 
 #include <lua.h>
 #include <lauxlib.h>
+#include "ltable.h"
+
 #include <stdlib.h>
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <unistd.h>
+
+#include "lua-blob.h"
+#include "lua-seri.h"
 
 #define TYPE_NIL 0
 #define TYPE_BOOLEAN 1
@@ -26,85 +32,137 @@
 #define TYPE_NUMBER_REAL 8
 
 #define TYPE_USERDATA 3
+// hibits 0 : lightuserdata , 1 : a blob (see lua-blob.c), dword : the index in the blob table of the message
+#define TYPE_USERDATA_POINTER 0
+#define TYPE_USERDATA_BLOB 1
 #define TYPE_SHORT_STRING 4
 // hibits 0~31 : len
 #define TYPE_LONG_STRING 5
 #define TYPE_TABLE 6
+#define TYPE_EXTEND 7
+// hibits : the extend type
+// 1: byte, 2:word, 4: dword , the offset of a short string packed before
+#define TYPE_EXTEND_STRINGREF_BYTE 1
+#define TYPE_EXTEND_STRINGREF_WORD 2
+#define TYPE_EXTEND_STRINGREF_DWORD 4
+// a byte : log2 of the hash size , then a TYPE_TABLE
+#define TYPE_EXTEND_TABLE 8
+// an array of records with the same keys :
+// integer size , byte n , n keys , then n columns (a type byte and the values of each record)
+// column type : TYPE_NUMBER (fixed size, not zero), TYPE_BOOLEAN (bytes), TYPE_NIL (any values)
+#define TYPE_EXTEND_COLUMN 9
+// the blob table, only at the beginning of a message (see luaseri_release)
+#define TYPE_EXTEND_BLOBS 10
 
 #define MAX_COOKIE 32
 #define COMBINE_TYPE(t,v) ((t) | (v) << 3)
 
-#define BLOCK_SIZE 128
+#define BLOCK_SIZE 256	// the scratch buffer on stack
 #define MAX_DEPTH 32
+#define MAX_HASH_HINT 24
+
+#define COLUMN_MIN 8	// the min size of a record array packed by columns
+#define COLUMN_MAX_FIELDS 64
+#define COLUMN_MAX_SIZE 0x1000000
+
+#define STRINGREF_MIN 4	// shorter strings are always packed
+#define STRINGREF_INIT 32
 
-struct block {
-	struct block * next;
-	char buffer[BLOCK_SIZE];
+#define BLOBS_INIT 8
+// type byte, the token of the process, the number of blobs ; then the pointers
+#define BLOBS_HEADER (1 + sizeof(uint64_t) + sizeof(uint32_t))
+
+/*
+	The short strings in lua are interned, so the same address means the same string
+	in one message. The string keeps the offset of its first copy in the message, the
+	later ones are packed as a reference to it.
+ */
+struct string_slot {
+	const char * str;
+	int offset;
+};
+
+struct string_ref {
+	struct string_slot * slot;
+	int size;	// 0 : not used yet
+	int n;
+	struct string_slot temp[STRINGREF_INIT];
 };
 
 struct write_block {
-	struct block * head;
-	struct block * current;
+	char * buffer;
 	int len;
-	int ptr;
+	int cap;
+	int temporary;	// the strings are not anchored (in __pairs), don't record them
+	int byvalue;	// pack the bytes of blobs rather than the references
+	struct string_ref ref;
+	// the blobs in the message, grabbed when the message is built (see seri)
+	struct blob ** blob;
+	int nblob;
+	int blob_cap;
+	char temp[BLOCK_SIZE];
 };
 
 struct read_block {
 	char * buffer;
 	int len;
 	int ptr;
+	const char * blob;	// the blob table of the message
+	int nblob;
 };
 
-inline static struct block *
-blk_alloc(void) {
-	struct block *b = skynet_malloc(sizeof(struct block));
-	b->next = NULL;
-	return b;
+static void
+wb_expand(struct write_block *b, int sz) {
+	int cap = b->cap;
+	while (cap < b->len + sz) {
+		cap *= 2;
+	}
+	if (b->buffer == b->temp) {
+		b->buffer = skynet_malloc(cap);
+		memcpy(b->buffer, b->temp, b->len);
+	} else {
+		b->buffer = skynet_realloc(b->buffer, cap);
+	}
+	b->cap = cap;
 }
 
 inline static void
 wb_push(struct write_block *b, const void *buf, int sz) {
-	const char * buffer = buf;
-	if (b->ptr == BLOCK_SIZE) {
-_again:
-		b->current = b->current->next = blk_alloc();
-		b->ptr = 0;
-	}
-	if (b->ptr <= BLOCK_SIZE - sz) {
-		memcpy(b->current->buffer + b->ptr, buffer, sz);
-		b->ptr+=sz;
-		b->len+=sz;
-	} else {
-		int copy = BLOCK_SIZE - b->ptr;
-		memcpy(b->current->buffer + b->ptr, buffer, copy);
-		buffer += copy;
-		b->len += copy;
-		sz -= copy;
-		goto _again;
+	if (b->len + sz > b->cap) {
+		wb_expand(b, sz);
 	}
+	memcpy(b->buffer + b->len, buf, sz);
+	b->len += sz;
 }
 
 static void
-wb_init(struct write_block *wb , struct block *b) {
-	wb->head = b;
-	assert(b->next == NULL);
+wb_init(struct write_block *wb) {
+	wb->buffer = wb->temp;
 	wb->len = 0;
-	wb->current = wb->head;
-	wb->ptr = 0;
+	wb->cap = BLOCK_SIZE;
+	wb->temporary = 0;
+	wb->byvalue = 0;
+	wb->ref.slot = NULL;
+	wb->ref.size = 0;
+	wb->ref.n = 0;
+	wb->blob = NULL;
+	wb->nblob = 0;
+	wb->blob_cap = 0;
 }
 
 static void
 wb_free(struct write_block *wb) {
-	struct block *blk = wb->head;
-	blk = blk->next;	// the first block is on stack
-	while (blk) {
-		struct block * next = blk->next;
-		skynet_free(blk);
-		blk = next;
-	}
-	wb->head = NULL;
-	wb->current = NULL;
-	wb->ptr = 0;
+	if (wb->buffer != wb->temp) {
+		skynet_free(wb->buffer);
+	}
+	if (wb->ref.slot != wb->ref.temp) {
+		skynet_free(wb->ref.slot);
+	}
+	// no reference is taken before the message is built
+	skynet_free(wb->blob);
+	wb->buffer = NULL;
+	wb->ref.slot = NULL;
+	wb->blob = NULL;
 	wb->len = 0;
 }
 
@@ -113,6 +171,15 @@ rball_init(struct read_block * rb, char * buffer, int size) {
 	rb->buffer = buffer;
 	rb->len = size;
 	rb->ptr = 0;
+	rb->blob = NULL;
+	rb->nblob = 0;
+}
+
+// the blob references are valid only in this process
+static inline uint64_t
+blob_token(void) {
+	static int anchor;
+	return ((uint64_t)(uintptr_t)&anchor << 16) ^ (uint64_t)getpid();
 }
 
 static const void *
@@ -187,9 +254,103 @@ wb_pointer(struct write_block *wb, void *v) {
 	wb_push(wb, &v, sizeof(v));
 }
 
+// the blob is recorded in the blob table, the value is the index
+static void
+wb_blob(struct write_block *wb, struct blob *b) {
+	if (wb->nblob >= wb->blob_cap) {
+		wb->blob_cap = wb->blob_cap ? wb->blob_cap * 2 : BLOBS_INIT;
+		wb->blob = skynet_realloc(wb->blob, wb->blob_cap * sizeof(struct blob *));
+	}
+	uint32_t index = (uint32_t)wb->nblob;
+	wb->blob[wb->nblob++] = b;
+	uint8_t n = COMBINE_TYPE(TYPE_USERDATA, TYPE_USERDATA_BLOB);
+	wb_push(wb, &n, 1);
+	wb_push(wb, &index, sizeof(index));
+}
+
+static inline unsigned
+ref_hash(const char *str, int size) {
+	return (unsigned)(((uintptr_t)str >> 3) * 2654435761u) & (size - 1);
+}
+
+static struct string_slot *
+ref_find(struct string_ref *r, const char *str) {
+	unsigned h = ref_hash(str, r->size);
+	for (;;) {
+		struct string_slot *s = &r->slot[h];
+		if (s->str == str || s->str == NULL)
+			return s;
+		h = (h + 1) & (r->size - 1);
+	}
+}
+
+static void
+ref_expand(struct string_ref *r) {
+	struct string_slot *old = r->slot;
+	int size = r->size;
+	r->size = size * 2;
+	r->slot = skynet_malloc(r->size * sizeof(struct string_slot));
+	memset(r->slot, 0, r->size * sizeof(struct string_slot));
+	int i;
+	for (i=0;i<size;i++) {
+		if (old[i].str) {
+			*ref_find(r, old[i].str) = old[i];
+		}
+	}
+	if (old != r->temp) {
+		skynet_free(old);
+	}
+}
+
+// pack a reference if the string is packed before, or record it
+static int
+wb_stringref(struct write_block *wb, const char *str, int len) {
+	struct string_ref *r = &wb->ref;
+	if (r->size == 0) {
+		r->slot = r->temp;
+		r->size = STRINGREF_INIT;
+		memset(r->temp, 0, sizeof(r->temp));
+	}
+	struct string_slot *s = ref_find(r, str);
+	if (s->str == NULL) {
+		if (!wb->temporary) {
+			s->str = str;
+			s->offset = wb->len;
+			if (++r->n * 2 > r->size) {
+				ref_expand(r);
+			}
+		}
+		return 0;
+	}
+	int offset = s->offset;
+	uint8_t n;
+	if (offset < 0x100) {
+		n = COMBINE_TYPE(TYPE_EXTEND, TYPE_EXTEND_STRINGREF_BYTE);
+		uint8_t byte = (uint8_t)offset;
+		wb_push(wb, &n, 1);
+		wb_push(wb, &byte, 1);
+	} else if (offset < 0x10000) {
+		n = COMBINE_TYPE(TYPE_EXTEND, TYPE_EXTEND_STRINGREF_WORD);
+		uint16_t word = (uint16_t)offset;
+		wb_push(wb, &n, 1);
+		wb_push(wb, &word, 2);
+	} else {
+		if (len <= 4)
+			return 0;
+		n = COMBINE_TYPE(TYPE_EXTEND, TYPE_EXTEND_STRINGREF_DWORD);
+		uint32_t dword = (uint32_t)offset;
+		wb_push(wb, &n, 1);
+		wb_push(wb, &dword, 4);
+	}
+	return 1;
+}
+
 static inline void
 wb_string(struct write_block *wb, const char *str, int len) {
 	if (len < MAX_COOKIE) {
+		if (len >= STRINGREF_MIN && wb_stringref(wb, str, len)) {
+			return;
+		}
 		uint8_t n = COMBINE_TYPE(TYPE_SHORT_STRING, len);
 		wb_push(wb, &n, 1);
 		if (len > 0) {
@@ -217,6 +378,12 @@ static void pack_one(lua_State *L, struct write_block *b, int index, int depth);
 static int
 wb_table_array(lua_State *L, struct write_block * wb, int index, int depth) {
 	int array_size = lua_rawlen(L,index);
+	const Table *t = (const Table *)lua_topointer(L, index);
+	if (!isdummy(t)) {
+		// the size hint of hash part
+		uint8_t hint[2] = { COMBINE_TYPE(TYPE_EXTEND, TYPE_EXTEND_TABLE), t->lsizenode };
+		wb_push(wb, hint, 2);
+	}
 	if (array_size >= MAX_COOKIE-1) {
 		uint8_t n = COMBINE_TYPE(TYPE_TABLE, MAX_COOKIE-1);
 		wb_push(wb, &n, 1);
@@ -263,6 +430,8 @@ wb_table_metapairs(lua_State *L, struct write_block *wb, int index, int depth) {
 	lua_pushvalue(L, index);
 	if (lua_pcall(L, 1, 3,0) != LUA_OK)
 		return 1;
+	// the keys and values from __pairs may be collected during packing
+	++wb->temporary;
 	for(;;) {
 		lua_pushvalue(L, -2);
 		lua_pushvalue(L, -2);
@@ -278,10 +447,233 @@ wb_table_metapairs(lua_State *L, struct write_block *wb, int index, int depth) {
 		pack_one(L, wb, -1, depth);
 		lua_pop(L, 1);
 	}
+	--wb->temporary;
 	wb_nil(wb);
 	return 0;
 }
 
+// a table without array part and metatable ; or return 0
+static inline int
+is_record(lua_State *L, int index) {
+	if (lua_type(L, index) != LUA_TTABLE || lua_rawlen(L, index) != 0)
+		return 0;
+	if (lua_getmetatable(L, index)) {
+		lua_pop(L, 1);
+		return 0;
+	}
+	return 1;
+}
+
+// push the string keys of the record, return the number of keys ; or 0
+static int
+record_keys(lua_State *L, int record) {
+	int n = 0;
+	lua_pushnil(L);
+	while (lua_next(L, record) != 0) {
+		lua_pop(L, 1);
+		if (lua_type(L, -1) != LUA_TSTRING || n >= COLUMN_MAX_FIELDS) {
+			lua_pop(L, n + 1);
+			return 0;
+		}
+		lua_pushvalue(L, -1);
+		++n;
+	}
+	return n;
+}
+
+// the record has the same keys with the first one (at key, n keys)
+static int
+same_keys(lua_State *L, int record, int key, int n) {
+	int i;
+	for (i=0;i<n;i++) {
+		lua_pushvalue(L, key + i);
+		int t = lua_rawget(L, record);
+		lua_pop(L, 1);
+		if (t == LUA_TNIL)
+			return 0;
+	}
+	// and no more keys
+	lua_pushnil(L);
+	for (i=0;lua_next(L, record) != 0;i++) {
+		lua_pop(L, 1);
+		if (i >= n) {
+			lua_pop(L, 1);
+			return 0;
+		}
+	}
+	return i == n;
+}
+
+static inline void
+column_value(lua_State *L, int index, int i, int key) {
+	lua_rawgeti(L, index, i);
+	lua_pushvalue(L, key);
+	lua_rawget(L, -2);
+	lua_replace(L, -2);
+}
+
+static void
+wb_column(lua_State *L, struct write_block *wb, int index, int depth, int array_size, int key) {
+	int i;
+	int integer = 1, real = 1, boolean = 1;
+	lua_Integer min = 0, max = 0;
+	for (i=1;i<=array_size && (integer || real || boolean);i++) {
+		column_value(L, index, i, key);
+		switch (lua_type(L, -1)) {
+		case LUA_TNUMBER:
+			boolean = 0;
+			if (lua_isinteger(L, -1)) {
+				real = 0;
+				lua_Integer v = lua_tointeger(L, -1);
+				if (v < min)
+					min = v;
+				if (v > max)
+					max = v;
+			} else {
+				integer = 0;
+			}
+			break;
+		case LUA_TBOOLEAN:
+			integer = real = 0;
+			break;
+		default:
+			integer = real = boolean = 0;
+			break;
+		}
+		lua_pop(L, 1);
+	}
+	uint8_t n;
+	if (integer) {
+		// no zero column, each value takes a byte at least, see unpack_column
+		int cookie;
+		if (min >= 0 && max < 0x100) {
+			cookie = TYPE_NUMBER_BYTE;
+		} else if (min >= 0 && max < 0x10000) {
+			cookie = TYPE_NUMBER_WORD;
+		} else if (min == (int32_t)min && max == (int32_t)max) {
+			cookie = TYPE_NUMBER_DWORD;
+		} else {
+			cookie = TYPE_NUMBER_QWORD;
+		}
+		n = COMBINE_TYPE(TYPE_NUMBER, cookie);
+		wb_push(wb, &n, 1);
+		for (i=1;i<=array_size;i++) {
+			column_value(L, index, i, key);
+			lua_Integer v = lua_tointeger(L, -1);
+			lua_pop(L, 1);
+			switch (cookie) {
+			case TYPE_NUMBER_BYTE: {
+				uint8_t byte = (uint8_t)v;
+				wb_push(wb, &byte, 1);
+				break;
+			}
+			case TYPE_NUMBER_WORD: {
+				uint16_t word = (uint16_t)v;
+				wb_push(wb, &word, 2);
+				break;
+			}
+			case TYPE_NUMBER_DWORD: {
+				int32_t dword = (int32_t)v;
+				wb_push(wb, &dword, 4);
+				break;
+			}
+			default: {
+				int64_t qword = v;
+				wb_push(wb, &qword, 8);
+				break;
+			}
+			}
+		}
+	} else if (real || boolean) {
+		n = real ? COMBINE_TYPE(TYPE_NUMBER, TYPE_NUMBER_REAL) : TYPE_BOOLEAN;
+		wb_push(wb, &n, 1);
+		for (i=1;i<=array_size;i++) {
+			column_value(L, index, i, key);
+			if (real) {
+				double v = lua_tonumber(L, -1);
+				wb_push(wb, &v, sizeof(v));
+			} else {
+				uint8_t v = lua_toboolean(L, -1);
+				wb_push(wb, &v, 1);
+			}
+			lua_pop(L, 1);
+		}
+	} else {
+		n = TYPE_NIL;
+		wb_push(wb, &n, 1);
+		for (i=1;i<=array_size;i++) {
+			column_value(L, index, i, key);
+			pack_one(L, wb, -1, depth);
+			lua_pop(L, 1);
+		}
+	}
+}
+
+// the table has no other entries than 1 .. array_size (the array part may have more after a hole)
+static int
+only_array(lua_State *L, int index, int array_size) {
+	int n = 0;
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		lua_pop(L, 1);
+		if (++n > array_size) {
+			lua_pop(L, 1);
+			return 0;
+		}
+	}
+	return n == array_size;
+}
+
+/*
+	Pack the array of records with the same string keys by columns : the keys are packed once,
+	and the numbers and booleans of a column are packed as a vector.
+	return 0 if the table is not a record array.
+ */
+static int
+wb_table_column(lua_State *L, struct write_block *wb, int index, int depth) {
+	int array_size = lua_rawlen(L, index);
+	if (array_size < COLUMN_MIN || !isdummy((const Table *)lua_topointer(L, index)))
+		return 0;
+	if (!lua_checkstack(L, COLUMN_MAX_FIELDS + LUA_MINSTACK))
+		return 0;
+	int top = lua_gettop(L);
+	lua_rawgeti(L, index, 1);
+	// t[1] first, only a candidate record array walks all the entries
+	if (!is_record(L, -1) || !only_array(L, index, array_size)) {
+		lua_settop(L, top);
+		return 0;
+	}
+	int n = record_keys(L, top + 1);
+	int key = top + 2;
+	int i;
+	for (i=2;n > 0 && i<=array_size;i++) {
+		lua_rawgeti(L, index, i);
+		if (!is_record(L, -1) || !same_keys(L, lua_gettop(L), key, n)) {
+			n = 0;
+		}
+		lua_pop(L, 1);
+	}
+	if (n == 0) {
+		lua_settop(L, top);
+		return 0;
+	}
+	uint8_t head = COMBINE_TYPE(TYPE_EXTEND, TYPE_EXTEND_COLUMN);
+	wb_push(wb, &head, 1);
+	wb_integer(wb, array_size);
+	uint8_t nkey = (uint8_t)n;
+	wb_push(wb, &nkey, 1);
+	for (i=0;i<n;i++) {
+		size_t sz;
+		const char * k = lua_tolstring(L, key + i, &sz);
+		wb_string(wb, k, (int)sz);
+	}
+	for (i=0;i<n;i++) {
+		wb_column(L, wb, index, depth + 1, array_size, key + i);
+	}
+	lua_settop(L, top);
+	return 1;
+}
+
 static int
 wb_table(lua_State *L, struct write_block *wb, int index, int depth) {
 	if (!lua_checkstack(L, LUA_MINSTACK)) {
@@ -293,11 +685,11 @@ wb_table(lua_State *L, struct write_block *wb, int index, int depth) {
 	}
 	if (luaL_getmetafield(L, index, "__pairs") != LUA_TNIL) {
 		return wb_table_metapairs(L, wb, index, depth);
-	} else {
+	} else if (!wb_table_column(L, wb, index, depth)) {
 		int array_size = wb_table_array(L, wb, index, depth);
 		wb_table_hash(L, wb, index, depth, array_size);
-		return 0;
 	}
+	return 0;
 }
 
 static void
@@ -333,6 +725,21 @@ pack_one(lua_State *L, struct write_block *b, int index, int depth) {
 	case LUA_TLIGHTUSERDATA:
 		wb_pointer(b, lua_touserdata(L,index));
 		break;
+	case LUA_TUSERDATA: {
+		struct blob * blob = luablob_get(L, index);
+		if (blob == NULL) {
+			wb_free(b);
+			luaL_error(L, "Unsupport type %s to serialize", lua_typename(L, type));
+		}
+		if (b->byvalue) {
+			size_t sz;
+			const char * data = (const char *)luablob_data(blob, &sz);
+			wb_string(b, data, (int)sz);
+		} else {
+			wb_blob(b, blob);
+		}
+		break;
+	}
 	case LUA_TTABLE: {
 		if (index < 0) {
 			index = lua_gettop(L) + index + 1;
@@ -430,6 +837,27 @@ get_pointer(lua_State *L, struct read_block *rb) {
 	return userdata;
 }
 
+// the message keeps its references until it is freed, the unpacked blob grabs a new one
+static void
+get_blob(lua_State *L, struct read_block *rb) {
+	uint32_t index;
+	const void * v = rb_read(rb, sizeof(index));
+	if (v == NULL) {
+		invalid_stream(L,rb);
+	}
+	memcpy(&index, v, sizeof(index));
+	if (index >= (uint32_t)rb->nblob) {
+		invalid_stream(L,rb);
+	}
+	struct blob * b;
+	memcpy(&b, rb->blob + index * sizeof(b), sizeof(b));
+	if (b == NULL) {
+		luaL_error(L, "The blob in the message is released");
+	}
+	luablob_grab(b);
+	luablob_push(L, b);
+}
+
 static void
 get_buffer(lua_State *L, struct read_block *rb, int len) {
 	const char * p = (const char *)rb_read(rb,len);
@@ -442,7 +870,7 @@ get_buffer(lua_State *L, struct read_block *rb, int len) {
 static void unpack_one(lua_State *L, struct read_block *rb);
 
 static void
-unpack_table(lua_State *L, struct read_block *rb, int array_size) {
+unpack_table(lua_State *L, struct read_block *rb, int array_size, int hash_size) {
 	if (array_size == MAX_COOKIE-1) {
 		uint8_t type;
 		const uint8_t * t = (const uint8_t *)rb_read(rb, sizeof(type));
@@ -457,7 +885,7 @@ unpack_table(lua_State *L, struct read_block *rb, int array_size) {
 		array_size = get_integer(L,rb,cookie);
 	}
 	luaL_checkstack(L,LUA_MINSTACK,NULL);
-	lua_createtable(L,array_size,0);
+	lua_createtable(L,array_size,hash_size);
 	int i;
 	for (i=1;i<=array_size;i++) {
 		unpack_one(L,rb);
@@ -474,6 +902,113 @@ unpack_table(lua_State *L, struct read_block *rb, int array_size) {
 	}
 }
 
+// the string packed at offset before
+static void
+get_stringref(lua_State *L, struct read_block *rb, int cookie) {
+	uint32_t offset;
+	switch (cookie) {
+	case TYPE_EXTEND_STRINGREF_BYTE:
+	case TYPE_EXTEND_STRINGREF_WORD:
+	case TYPE_EXTEND_STRINGREF_DWORD:
+		offset = (uint32_t)get_integer(L, rb, cookie);
+		break;
+	default:
+		invalid_stream(L,rb);
+		return;
+	}
+	if (offset >= (uint32_t)rb->ptr) {
+		invalid_stream(L,rb);
+	}
+	uint8_t type = (uint8_t)rb->buffer[offset];
+	int len = type >> 3;
+	if ((type & 7) != TYPE_SHORT_STRING || offset + 1 + len > (uint32_t)rb->ptr) {
+		invalid_stream(L,rb);
+	}
+	lua_pushlstring(L, rb->buffer + offset + 1, len);
+}
+
+static void
+unpack_column(lua_State *L, struct read_block *rb) {
+	const uint8_t * t = (const uint8_t *)rb_read(rb, 1);
+	if (t == NULL || (*t & 7) != TYPE_NUMBER || (*t >> 3) == TYPE_NUMBER_REAL) {
+		invalid_stream(L,rb);
+	}
+	lua_Integer array_size = get_integer(L, rb, *t >> 3);
+	t = (const uint8_t *)rb_read(rb, 1);
+	if (t == NULL || *t == 0 || *t > COLUMN_MAX_FIELDS || array_size <= 0 || array_size > COLUMN_MAX_SIZE) {
+		invalid_stream(L,rb);
+	}
+	int n = *t;
+	luaL_checkstack(L, n + LUA_MINSTACK, NULL);
+	int key = lua_gettop(L) + 1;
+	int i, j;
+	for (j=0;j<n;j++) {
+		unpack_one(L, rb);
+		if (lua_type(L, -1) != LUA_TSTRING) {
+			invalid_stream(L,rb);
+		}
+	}
+	// each value takes a byte at least, don't create the records more than the stream can fill
+	if (array_size > rb->len / n) {
+		invalid_stream(L,rb);
+	}
+	lua_createtable(L, (int)array_size, 0);
+	int index = lua_gettop(L);
+	for (i=1;i<=array_size;i++) {
+		lua_createtable(L, 0, n);
+		lua_rawseti(L, index, i);
+	}
+	for (j=0;j<n;j++) {
+		t = (const uint8_t *)rb_read(rb, 1);
+		if (t == NULL) {
+			invalid_stream(L,rb);
+		}
+		int type = *t & 7;
+		int cookie = *t >> 3;
+		if ((type != TYPE_NUMBER || cookie == TYPE_NUMBER_ZERO) && type != TYPE_BOOLEAN && type != TYPE_NIL) {
+			invalid_stream(L,rb);
+		}
+		for (i=1;i<=array_size;i++) {
+			lua_rawgeti(L, index, i);
+			lua_pushvalue(L, key + j);
+			if (type == TYPE_NIL) {
+				unpack_one(L, rb);
+			} else if (type == TYPE_BOOLEAN) {
+				const uint8_t * b = (const uint8_t *)rb_read(rb, 1);
+				if (b == NULL) {
+					invalid_stream(L,rb);
+				}
+				lua_pushboolean(L, *b);
+			} else if (cookie == TYPE_NUMBER_REAL) {
+				lua_pushnumber(L, get_real(L, rb));
+			} else {
+				lua_pushinteger(L, get_integer(L, rb, cookie));
+			}
+			lua_rawset(L, -3);
+			lua_pop(L, 1);
+		}
+	}
+	lua_replace(L, key);
+	lua_settop(L, key);
+}
+
+static void
+push_extend(lua_State *L, struct read_block *rb, int cookie) {
+	if (cookie == TYPE_EXTEND_COLUMN) {
+		unpack_column(L, rb);
+		return;
+	}
+	if (cookie != TYPE_EXTEND_TABLE) {
+		get_stringref(L, rb, cookie);
+		return;
+	}
+	const uint8_t * t = (const uint8_t *)rb_read(rb, 2);
+	if (t == NULL || t[0] > MAX_HASH_HINT || (t[1] & 7) != TYPE_TABLE) {
+		invalid_stream(L,rb);
+	}
+	unpack_table(L, rb, t[1] >> 3, 1 << t[0]);
+}
+
 static void
 push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 	switch(type) {
@@ -491,7 +1026,11 @@ push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 		}
 		break;
 	case TYPE_USERDATA:
-		lua_pushlightuserdata(L,get_pointer(L,rb));
+		if (cookie == TYPE_USERDATA_BLOB) {
+			get_blob(L,rb);
+		} else {
+			lua_pushlightuserdata(L,get_pointer(L,rb));
+		}
 		break;
 	case TYPE_SHORT_STRING:
 		get_buffer(L,rb,cookie);
@@ -520,9 +1059,12 @@ push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 		break;
 	}
 	case TYPE_TABLE: {
-		unpack_table(L,rb,cookie);
+		unpack_table(L,rb,cookie,0);
 		break;
 	}
+	case TYPE_EXTEND:
+		push_extend(L,rb,cookie);
+		break;
 	default: {
 		invalid_stream(L,rb);
 		break;
@@ -541,25 +1083,94 @@ unpack_one(lua_State *L, struct read_block *rb) {
 	push_value(L, rb, type & 0x7, type>>3);
 }
 
+/*
+	The message owns a reference of each blob in its blob table, they are released
+	by luaseri_release when the message is freed.
+ */
 static void
-seri(lua_State *L, struct block *b, int len) {
-	uint8_t * buffer = skynet_malloc(len);
-	uint8_t * ptr = buffer;
-	int sz = len;
-	while(len>0) {
-		if (len >= BLOCK_SIZE) {
-			memcpy(ptr, b->buffer, BLOCK_SIZE);
-			ptr += BLOCK_SIZE;
-			len -= BLOCK_SIZE;
-			b = b->next;
-		} else {
-			memcpy(ptr, b->buffer, len);
-			break;
-		}
+seri_blobs(lua_State *L, struct write_block *wb) {
+	size_t header = BLOBS_HEADER + wb->nblob * sizeof(struct blob *);
+	char * buffer = skynet_malloc(header + wb->len);
+	buffer[0] = COMBINE_TYPE(TYPE_EXTEND, TYPE_EXTEND_BLOBS);
+	uint64_t token = blob_token();
+	memcpy(buffer + 1, &token, sizeof(token));
+	uint32_t n = (uint32_t)wb->nblob;
+	memcpy(buffer + 1 + sizeof(token), &n, sizeof(n));
+	int i;
+	for (i=0;i<wb->nblob;i++) {
+		luablob_grab(wb->blob[i]);
+	}
+	memcpy(buffer + BLOBS_HEADER, wb->blob, wb->nblob * sizeof(struct blob *));
+	memcpy(buffer + header, wb->buffer, wb->len);
+	lua_pushlightuserdata(L, buffer);
+	lua_pushinteger(L, header + wb->len);
+}
+
+static void
+seri(lua_State *L, struct write_block *wb) {
+	if (wb->nblob > 0) {
+		seri_blobs(L, wb);
+		return;
+	}
+	void * buffer;
+	if (wb->buffer == wb->temp) {
+		buffer = skynet_malloc(wb->len);
+		memcpy(buffer, wb->temp, wb->len);
+	} else {
+		// the buffer is moved out
+		buffer = wb->buffer;
+		wb->buffer = wb->temp;
 	}
-	
 	lua_pushlightuserdata(L, buffer);
-	lua_pushinteger(L, sz);
+	lua_pushinteger(L, wb->len);
+}
+
+// return the size of the blob table at the beginning of the message, or 0
+static size_t
+blobs_header(const char * msg, size_t sz, uint32_t *n) {
+	if (sz < BLOBS_HEADER || (uint8_t)msg[0] != COMBINE_TYPE(TYPE_EXTEND, TYPE_EXTEND_BLOBS))
+		return 0;
+	uint64_t token;
+	memcpy(&token, msg + 1, sizeof(token));
+	if (token != blob_token())
+		return 0;
+	memcpy(n, msg + 1 + sizeof(token), sizeof(*n));
+	if (*n > (sz - BLOBS_HEADER) / sizeof(struct blob *))
+		return 0;
+	return BLOBS_HEADER + *n * sizeof(struct blob *);
+}
+
+// release the blob references in the message, the message itself is not freed
+void
+luaseri_release(void *msg, size_t sz) {
+	uint32_t n;
+	if (blobs_header(msg, sz, &n) == 0)
+		return;
+	char * slot = (char *)msg + BLOBS_HEADER;
+	uint32_t i;
+	for (i=0;i<n;i++) {
+		struct blob * b;
+		memcpy(&b, slot + i * sizeof(b), sizeof(b));
+		if (b) {
+			memset(slot + i * sizeof(b), 0, sizeof(b));
+			luablob_release(b);
+		}
+	}
+}
+
+// push a string copy of the message, the copy doesn't own the blob references
+void
+luaseri_pushstring(lua_State *L, const void *msg, size_t sz) {
+	uint32_t n;
+	if (blobs_header(msg, sz, &n) == 0) {
+		lua_pushlstring(L, msg, sz);
+		return;
+	}
+	luaL_Buffer b;
+	char * copy = luaL_buffinitsize(L, &b, sz);
+	memcpy(copy, msg, sz);
+	memset(copy + 1, 0, sizeof(uint64_t));
+	luaL_pushresultsize(&b, sz);
 }
 
 int
@@ -587,6 +1198,21 @@ luaseri_unpack(lua_State *L) {
 	lua_settop(L,1);
 	struct read_block rb;
 	rball_init(&rb, buffer, len);
+	if ((uint8_t)rb.buffer[0] == COMBINE_TYPE(TYPE_EXTEND, TYPE_EXTEND_BLOBS)) {
+		// a string doesn't own the references, the blobs may be released
+		if (lua_type(L,1) == LUA_TSTRING) {
+			return luaL_error(L, "The blobs in a string copy of the message can't be unpacked");
+		}
+		uint32_t n;
+		size_t header = blobs_header(buffer, len, &n);
+		if (header == 0) {
+			return luaL_error(L, "The blobs are from another process");
+		}
+		// the offsets of string references start from the body
+		rball_init(&rb, (char *)buffer + header, len - (int)header);
+		rb.blob = (const char *)buffer + BLOBS_HEADER;
+		rb.nblob = (int)n;
+	}
 
 	int i;
 	for (i=0;;i++) {
@@ -606,15 +1232,25 @@ luaseri_unpack(lua_State *L) {
 	return lua_gettop(L) - 1;
 }
 
+// pack to a string, the blobs are packed by value
+int
+luaseri_packstring(lua_State *L) {
+	struct write_block wb;
+	wb_init(&wb);
+	wb.byvalue = 1;
+	pack_from(L,&wb,0);
+	lua_pushlstring(L, wb.buffer, wb.len);
+	wb_free(&wb);
+
+	return 1;
+}
+
 LUAMOD_API int
 luaseri_pack(lua_State *L) {
-	struct block temp;
-	temp.next = NULL;
 	struct write_block wb;
-	wb_init(&wb, &temp);
+	wb_init(&wb);
 	pack_from(L,&wb,0);
-	assert(wb.head == &temp);
-	seri(L, &temp, wb.len);
+	seri(L, &wb);
 
 	wb_free(&wb);
 
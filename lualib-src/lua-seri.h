@@ -5,5 +5,10 @@
 
 int luaseri_pack(lua_State *L);
 int luaseri_unpack(lua_State *L);
+int luaseri_packstring(lua_State *L);
+// release the blob references in a message packed by luaseri_pack
+void luaseri_release(void *msg, size_t sz);
+// push a string copy of a message, the copy doesn't own the blob references
+void luaseri_pushstring(lua_State *L, const void *msg, size_t sz);
 
 #endif
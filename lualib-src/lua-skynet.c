@@ -50,6 +50,20 @@ struct callback_context {
 	lua_State *L;
 };
 
+// the messages of these protocols are packed by skynet.pack, they own the blob references (see lua-seri.c)
+static inline int
+blob_protocol(int type) {
+	switch (type) {
+	case PTYPE_RESPONSE:
+	case PTYPE_RESERVED_LUA:
+	case PTYPE_RESERVED_SNAX:
+	case PTYPE_RESERVED_DEBUG:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
 static int
 _cb(struct skynet_context * context, void * ud, int type, int session, uint32_t source, const void * msg, size_t sz) {
 	struct callback_context *cb_ctx = (struct callback_context *)ud;
@@ -66,6 +80,11 @@ _cb(struct skynet_context * context, void * ud, int type, int session, uint32_t
 
 	r = lua_pcall(L, 5, 0 , trace);
 
+	if (blob_protocol(type)) {
+		// the message is freed after the callback
+		luaseri_release((void *)msg, sz);
+	}
+
 	if (r == LUA_OK) {
 		return 0;
 	}
@@ -312,6 +331,108 @@ lredirect(lua_State *L) {
 	return send_message(L, source, 3);
 }
 
+/*
+	table requests : { address, type, message, size, ... } 4 fields for each request
+	 address is a uint32 or a string
+	 message is a string (size is ignored) or a lightuserdata
+	integer n
+	integer timeout (optional)
+
+	Send n requests with the consecutive sessions, returns the first session
+	and the indexes (1 based) of the requests failed to send.
+	Each request sent has the timeout (see skynet_deadline).
+ */
+static int
+lsendmulti(lua_State *L) {
+	struct skynet_context * context = lua_touserdata(L, lua_upvalueindex(1));
+	luaL_checktype(L, 1, LUA_TTABLE);
+	int n = luaL_checkinteger(L, 2);
+	if (n <= 0) {
+		return luaL_error(L, "Invalid request count %d", n);
+	}
+	int ti = luaL_optinteger(L, 3, -1);
+	lua_settop(L, 2);
+	luaL_checkstack(L, n + 8, NULL);
+	int base = skynet_newsessions(context, n);
+	lua_pushinteger(L, base);
+	int i;
+	for (i=0;i<n;i++) {
+		int top = lua_gettop(L);
+		lua_geti(L, 1, i * 4 + 1);
+		lua_geti(L, 1, i * 4 + 2);
+		lua_geti(L, 1, i * 4 + 3);
+		lua_geti(L, 1, i * 4 + 4);
+		uint32_t dest = (uint32_t)lua_tointeger(L, top + 1);
+		const char * dest_string = NULL;
+		if (dest == 0) {
+			dest_string = lua_tostring(L, top + 1);
+		}
+		int type = luaL_checkinteger(L, top + 2);
+		void * msg = NULL;
+		size_t sz = 0;
+		switch (lua_type(L, top + 3)) {
+		case LUA_TSTRING:
+			msg = (void *)lua_tolstring(L, top + 3, &sz);
+			if (sz == 0) {
+				msg = NULL;
+			}
+			break;
+		case LUA_TLIGHTUSERDATA:
+			msg = lua_touserdata(L, top + 3);
+			sz = luaL_checkinteger(L, top + 4);
+			type |= PTYPE_TAG_DONTCOPY;
+			break;
+		default:
+			return luaL_error(L, "invalid param %s", lua_typename(L, lua_type(L, top + 3)));
+		}
+		int session = base + i;
+		int r;
+		if (dest_string) {
+			r = skynet_sendname(context, 0, dest_string, type, session, msg, sz);
+		} else if (dest == 0) {
+			if (type & PTYPE_TAG_DONTCOPY) {
+				skynet_free(msg);
+			}
+			r = -1;
+		} else {
+			r = skynet_send(context, 0, dest, type, session, msg, sz);
+		}
+		lua_settop(L, top);
+		if (r < 0) {
+			lua_pushinteger(L, i + 1);
+		} else if (ti >= 0) {
+			skynet_deadline(context, session, ti);
+		}
+	}
+	return lua_gettop(L) - 2;
+}
+
+/*
+	integer session
+	integer timeout (optional)
+
+	The response of the session must arrive in timeout (1/100 s),
+	or the service receives an error message from address 0 (see skynet_deadline).
+	Without timeout, cancel the deadline of a call ended by another error.
+ */
+static int
+ldeadline(lua_State *L) {
+	struct skynet_context * context = lua_touserdata(L, lua_upvalueindex(1));
+	int session = luaL_checkinteger(L, 1);
+	int ti = -1;
+	if (!lua_isnoneornil(L, 2)) {
+		ti = luaL_checkinteger(L, 2);
+		if (ti < 0) {
+			ti = 0;
+		}
+	}
+	if (session <= 0) {
+		return luaL_error(L, "Invalid session %d", session);
+	}
+	skynet_deadline(context, session, ti);
+	return 0;
+}
+
 static int
 lerror(lua_State *L) {
 	struct skynet_context * context = lua_touserdata(L, lua_upvalueindex(1));
@@ -344,7 +465,7 @@ ltostring(lua_State *L) {
 	}
 	char * msg = lua_touserdata(L,1);
 	int sz = luaL_checkinteger(L,2);
-	lua_pushlstring(L,msg,sz);
+	luaseri_pushstring(L,msg,sz);
 	return 1;
 }
 
@@ -360,16 +481,14 @@ lharbor(lua_State *L) {
 	return 2;
 }
 
-static int
-lpackstring(lua_State *L) {
-	luaseri_pack(L);
-	char * str = (char *)lua_touserdata(L, -2);
-	int sz = lua_tointeger(L, -1);
-	lua_pushlstring(L, str, sz);
-	skynet_free(str);
-	return 1;
-}
+/*
+	lightuserdata msg
+	integer sz
+	integer type (optional)
 
+	Free the message, the blobs in it are released if the type is a protocol
+	packed by skynet.pack (skynet.PTYPE_LUA, ...).
+ */
 static int
 ltrash(lua_State *L) {
 	int t = lua_type(L,1);
@@ -379,7 +498,10 @@ ltrash(lua_State *L) {
 	}
 	case LUA_TLIGHTUSERDATA: {
 		void * msg = lua_touserdata(L,1);
-		luaL_checkinteger(L,2);
+		size_t sz = (size_t)luaL_checkinteger(L,2);
+		if (blob_protocol((int)luaL_optinteger(L,3,PTYPE_TEXT))) {
+			luaseri_release(msg, sz);
+		}
 		skynet_free(msg);
 		break;
 	}
@@ -476,6 +598,8 @@ luaopen_skynet_core(lua_State *L) {
 
 	luaL_Reg l[] = {
 		{ "send" , lsend },
+		{ "sendmulti", lsendmulti },
+		{ "deadline", ldeadline },
 		{ "genid", lgenid },
 		{ "redirect", lredirect },
 		{ "command" , lcommand },
@@ -493,7 +617,7 @@ luaopen_skynet_core(lua_State *L) {
 		{ "tostring", ltostring },
 		{ "pack", luaseri_pack },
 		{ "unpack", luaseri_unpack },
-		{ "packstring", lpackstring },
+		{ "packstring", luaseri_packstring },
 		{ "trash" , ltrash },
 		{ "now", lnow },
 		{ "hpc", lhpc },	// getHPCounter
@@ -508,7 +632,6 @@ luaopen_skynet_core(lua_State *L) {
 		return luaL_error(L, "Init skynet context first");
 	}
 
-
 	luaL_setfuncs(L,l,1);
 
 	luaL_setfuncs(L,l2,0);
@@ -1,4 +1,7 @@
 #define LUA_LIB
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	// memmem
+#endif
 
 #include "skynet_malloc.h"
 
@@ -11,6 +14,12 @@
 #include <lua.h>
 #include <lauxlib.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -19,51 +28,94 @@
 
 #include "skynet.h"
 #include "skynet_socket.h"
+#include "socket_server.h"
 
 #define BACKLOG 32
 // 2 ** 12 == 4096
 #define LARGE_PAGE_NODE 12
 #define POOL_SIZE_WARNING 32
 #define BUFFER_LIMIT (256 * 1024)
+#define SHAREDBUFFER_META "socket_sharedbuffer"
+#define BROADCAST_STACK 256
+#define CHUNK_META "socket_chunk"
+#define VIEW_META "socket_view"
+#define SCAN_SEP_MAX 16
 
 struct buffer_node {
 	char * msg;
 	int sz;
+	bool shared;	// msg is owned by a socket_chunk (referenced by views)
 	struct buffer_node *next;
 };
 
+// owns a block of socket data, shared by the views
+struct socket_chunk {
+	char * msg;
+};
+
+// a read-only slice of socket data, uservalue 1 is the socket_chunk
+struct socket_view {
+	const char * ptr;
+	int sz;
+};
+
 struct socket_buffer {
 	int size;
 	int offset;
 	struct buffer_node *head;
 	struct buffer_node *tail;
+	// readline remembers where the last scan stopped, reset when the buffer is consumed
+	int scan;
+	int scan_len;
+	char scan_sep[SCAN_SEP_MAX];
+	int nodes;
+};
+
+/*
+	The buffer_node arena of a service, shared by all the socket buffers of it.
+	Nodes are allocated in chunks (16, 32, ... LARGE_PAGE_NODE nodes), and never freed until the VM closed.
+ */
+struct node_chunk {
+	struct node_chunk * next;
+	int n;
+	struct buffer_node node[1];
+};
+
+struct node_arena {
+	struct buffer_node * free;
+	struct node_chunk * chunk;
+	int chunks;
+	int nodes;
 };
 
 static int
 lfreepool(lua_State *L) {
-	struct buffer_node * pool = lua_touserdata(L, 1);
-	int sz = lua_rawlen(L,1) / sizeof(*pool);
-	int i;
-	for (i=0;i<sz;i++) {
-		struct buffer_node *node = &pool[i];
-		if (node->msg) {
-			skynet_free(node->msg);
-			node->msg = NULL;
+	struct node_arena * arena = lua_touserdata(L, 1);
+	struct node_chunk * c = arena->chunk;
+	while (c) {
+		int i;
+		for (i=0;i<c->n;i++) {
+			struct buffer_node *node = &c->node[i];
+			if (node->msg && !node->shared) {
+				skynet_free(node->msg);
+			}
 		}
+		struct node_chunk * next = c->next;
+		skynet_free(c);
+		c = next;
 	}
+	arena->chunk = NULL;
+	arena->free = NULL;
 	return 0;
 }
 
 static int
-lnewpool(lua_State *L, int sz) {
-	struct buffer_node * pool = lua_newuserdatauv(L, sizeof(struct buffer_node) * sz, 0);
-	int i;
-	for (i=0;i<sz;i++) {
-		pool[i].msg = NULL;
-		pool[i].sz = 0;
-		pool[i].next = &pool[i+1];
-	}
-	pool[sz-1].next = NULL;
+lnewpool(lua_State *L) {
+	struct node_arena * arena = lua_newuserdatauv(L, sizeof(*arena), 0);
+	arena->free = NULL;
+	arena->chunk = NULL;
+	arena->chunks = 0;
+	arena->nodes = 0;
 	if (luaL_newmetatable(L, "buffer_pool")) {
 		lua_pushcfunction(L, lfreepool);
 		lua_setfield(L, -2, "__gc");
@@ -72,33 +124,66 @@ lnewpool(lua_State *L, int sz) {
 	return 1;
 }
 
+static struct buffer_node *
+alloc_node(struct node_arena * arena) {
+	struct buffer_node * node = arena->free;
+	if (node == NULL) {
+		int sz = 16 << arena->chunks;
+		if (sz > (1 << LARGE_PAGE_NODE)) {
+			sz = 1 << LARGE_PAGE_NODE;
+		}
+		struct node_chunk * c = skynet_malloc(sizeof(*c) + (sz - 1) * sizeof(struct buffer_node));
+		c->next = arena->chunk;
+		c->n = sz;
+		arena->chunk = c;
+		if (++arena->chunks > POOL_SIZE_WARNING) {
+			skynet_error(NULL, "Too many socket pool (%d)", arena->chunks);
+		}
+		int i;
+		for (i=0;i<sz;i++) {
+			c->node[i].msg = NULL;
+			c->node[i].sz = 0;
+			c->node[i].shared = false;
+			c->node[i].next = &c->node[i+1];
+		}
+		c->node[sz-1].next = NULL;
+		node = c->node;
+	}
+	arena->free = node->next;
+	++arena->nodes;
+	return node;
+}
+
+/*
+	The uservalue of buffer object is a table (created when the first view is made)
+	that anchors the socket_chunk of shared buffer_node : [lightuserdata msg] = chunk
+ */
 static int
 lnewbuffer(lua_State *L) {
-	struct socket_buffer * sb = lua_newuserdatauv(L, sizeof(*sb), 0);
+	struct socket_buffer * sb = lua_newuserdatauv(L, sizeof(*sb), 1);
 	sb->size = 0;
 	sb->offset = 0;
 	sb->head = NULL;
 	sb->tail = NULL;
+	sb->scan = 0;
+	sb->scan_len = 0;
+	sb->nodes = 0;
 	
 	return 1;
 }
 
 /*
 	userdata send_buffer
-	table pool
+	userdata pool
 	lightuserdata msg
 	int size
 
 	return size
 
-	Comment: The table pool record all the buffers chunk, 
-	and the first index [1] is a lightuserdata : free_node. We can always use this pointer for struct buffer_node .
-	The following ([2] ...)  userdatas in table pool is the buffer chunk (for struct buffer_node), 
-	we never free them until the VM closed. The size of first chunk ([2]) is 16 struct buffer_node,
-	and the second size is 32 ... The largest size of chunk is LARGE_PAGE_NODE (4096)
-
-	lpushbbuffer will get a free struct buffer_node from table pool, and then put the msg/size in it.
-	lpopbuffer return the struct buffer_node back to table pool (By calling return_free_node).
+	Comment: The pool is the node_arena of the service (created by driver.pool()).
+	lpushbbuffer will get a free struct buffer_node from the arena, and then put the msg/size in it.
+	lpopbuffer return the struct buffer_node back to the arena (By calling return_free_node),
+	and the msg goes back to the receive pool of socket server.
  */
 static int
 lpushbuffer(lua_State *L) {
@@ -110,33 +195,12 @@ lpushbuffer(lua_State *L) {
 	if (msg == NULL) {
 		return luaL_error(L, "need message block at param 3");
 	}
-	int pool_index = 2;
-	luaL_checktype(L,pool_index,LUA_TTABLE);
+	struct node_arena * arena = luaL_checkudata(L,2,"buffer_pool");
 	int sz = luaL_checkinteger(L,4);
-	lua_rawgeti(L,pool_index,1);
-	struct buffer_node * free_node = lua_touserdata(L,-1);	// sb poolt msg size free_node
-	lua_pop(L,1);
-	if (free_node == NULL) {
-		int tsz = lua_rawlen(L,pool_index);
-		if (tsz == 0)
-			tsz++;
-		int size = 8;
-		if (tsz <= LARGE_PAGE_NODE-3) {
-			size <<= tsz;
-		} else {
-			size <<= LARGE_PAGE_NODE-3;
-		}
-		lnewpool(L, size);	
-		free_node = lua_touserdata(L,-1);
-		lua_rawseti(L, pool_index, tsz+1);
-		if (tsz > POOL_SIZE_WARNING) {
-			skynet_error(NULL, "Too many socket pool (%d)", tsz);
-		}
-	}
-	lua_pushlightuserdata(L, free_node->next);	
-	lua_rawseti(L, pool_index, 1);	// sb poolt msg size
+	struct buffer_node * free_node = alloc_node(arena);
 	free_node->msg = msg;
 	free_node->sz = sz;
+	free_node->shared = false;
 	free_node->next = NULL;
 
 	if (sb->head == NULL) {
@@ -147,6 +211,7 @@ lpushbuffer(lua_State *L) {
 		sb->tail = free_node;
 	}
 	sb->size += sz;
+	++sb->nodes;
 
 	lua_pushinteger(L, sb->size);
 
@@ -161,15 +226,24 @@ return_free_node(lua_State *L, int pool, struct socket_buffer *sb) {
 	if (sb->head == NULL) {
 		sb->tail = NULL;
 	}
-	lua_rawgeti(L,pool,1);
-	free_node->next = lua_touserdata(L,-1);
-	lua_pop(L,1);
-	skynet_free(free_node->msg);
+	struct node_arena * arena = lua_touserdata(L,pool);
+	free_node->next = arena->free;
+	arena->free = free_node;
+	--arena->nodes;
+	--sb->nodes;
+	if (free_node->shared) {
+		// the buffer object is always at index 1, the chunk frees msg when no view refers it
+		lua_getiuservalue(L, 1, 1);
+		lua_pushnil(L);
+		lua_rawsetp(L, -2, free_node->msg);
+		lua_pop(L, 1);
+		free_node->shared = false;
+	} else {
+		// sz is the bytes read into msg, the receive pool keeps it for the next read of the socket thread
+		skynet_socket_recycle(free_node->msg, free_node->sz);
+	}
 	free_node->msg = NULL;
-
 	free_node->sz = 0;
-	lua_pushlightuserdata(L, free_node);
-	lua_rawseti(L, pool, 1);
 }
 
 static void
@@ -235,7 +309,7 @@ lheader(lua_State *L) {
 
 /*
 	userdata send_buffer
-	table pool
+	userdata pool
 	integer sz 
  */
 static int
@@ -244,13 +318,14 @@ lpopbuffer(lua_State *L) {
 	if (sb == NULL) {
 		return luaL_error(L, "Need buffer object at param 1");
 	}
-	luaL_checktype(L,2,LUA_TTABLE);
+	luaL_checkudata(L,2,"buffer_pool");
 	int sz = luaL_checkinteger(L,3);
 	if (sb->size < sz || sz == 0) {
 		lua_pushnil(L);
 	} else {
 		pop_lstring(L,sb,sz,0);
 		sb->size -= sz;
+		sb->scan = 0;
 	}
 	lua_pushinteger(L, sb->size);
 
@@ -259,7 +334,7 @@ lpopbuffer(lua_State *L) {
 
 /*
 	userdata send_buffer
-	table pool
+	userdata pool
  */
 static int
 lclearbuffer(lua_State *L) {
@@ -270,11 +345,12 @@ lclearbuffer(lua_State *L) {
 		}
 		return luaL_error(L, "Need buffer object at param 1");
 	}
-	luaL_checktype(L,2,LUA_TTABLE);
+	luaL_checkudata(L,2,"buffer_pool");
 	while(sb->head) {
 		return_free_node(L,2,sb);
 	}
 	sb->size = 0;
+	sb->scan = 0;
 	return 0;
 }
 
@@ -284,7 +360,7 @@ lreadall(lua_State *L) {
 	if (sb == NULL) {
 		return luaL_error(L, "Need buffer object at param 1");
 	}
-	luaL_checktype(L,2,LUA_TTABLE);
+	luaL_checkudata(L,2,"buffer_pool");
 	luaL_Buffer b;
 	luaL_buffinit(L, &b);
 	while(sb->head) {
@@ -294,9 +370,32 @@ lreadall(lua_State *L) {
 	}
 	luaL_pushresult(&b);
 	sb->size = 0;
+	sb->scan = 0;
 	return 1;
 }
 
+/*
+	userdata send_buffer
+	userdata pool (optional)
+
+	return bytes buffered, nodes used (by the buffer, and by the pool if given)
+ */
+static int
+lbufferinfo(lua_State *L) {
+	struct socket_buffer * sb = lua_touserdata(L, 1);
+	if (sb == NULL) {
+		return luaL_error(L, "Need buffer object at param 1");
+	}
+	lua_pushinteger(L, sb->size);
+	lua_pushinteger(L, sb->nodes);
+	struct node_arena * arena = luaL_testudata(L, 2, "buffer_pool");
+	if (arena) {
+		lua_pushinteger(L, arena->nodes);
+		return 3;
+	}
+	return 2;
+}
+
 static int
 ldrop(lua_State *L) {
 	void * msg = lua_touserdata(L,1);
@@ -324,10 +423,286 @@ check_sep(struct buffer_node * node, int from, const char *sep, int seplen) {
 	}
 }
 
+static int
+lchunk_gc(lua_State *L) {
+	struct socket_chunk * c = lua_touserdata(L, 1);
+	skynet_free(c->msg);
+	c->msg = NULL;
+	return 0;
+}
+
+static struct socket_chunk *
+new_chunk(lua_State *L, char * msg) {
+	struct socket_chunk * c = lua_newuserdatauv(L, sizeof(*c), 0);
+	c->msg = msg;
+	if (luaL_newmetatable(L, CHUNK_META)) {
+		lua_pushcfunction(L, lchunk_gc);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+	return c;
+}
+
+// push the chunk of node, the buffer object is at index 1
+static void
+push_chunk(lua_State *L, struct buffer_node *node) {
+	if (lua_getiuservalue(L, 1, 1) != LUA_TTABLE) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_pushvalue(L, -1);
+		lua_setiuservalue(L, 1, 1);
+	}
+	if (node->shared) {
+		lua_rawgetp(L, -1, node->msg);
+	} else {
+		new_chunk(L, node->msg);
+		lua_pushvalue(L, -1);
+		lua_rawsetp(L, -3, node->msg);
+		node->shared = true;
+	}
+	lua_remove(L, -2);
+}
+
+static int view_sub(lua_State *L);
+static int view_byte(lua_State *L);
+static int view_find(lua_State *L);
+static int view_ptr(lua_State *L);
+static int view_len(lua_State *L);
+static int view_tostring(lua_State *L);
+
+// new view with the chunk at the top of stack (popped)
+static struct socket_view *
+new_view(lua_State *L, const char * ptr, int sz) {
+	struct socket_view * v = lua_newuserdatauv(L, sizeof(*v), 1);
+	v->ptr = ptr;
+	v->sz = sz;
+	if (luaL_newmetatable(L, VIEW_META)) {
+		luaL_Reg l[] = {
+			{ "sub", view_sub },
+			{ "byte", view_byte },
+			{ "find", view_find },
+			{ "ptr", view_ptr },
+			{ NULL, NULL },
+		};
+		luaL_newlib(L, l);
+		lua_setfield(L, -2, "__index");
+		lua_pushcfunction(L, view_len);
+		lua_setfield(L, -2, "__len");
+		lua_pushcfunction(L, view_tostring);
+		lua_setfield(L, -2, "__tostring");
+	}
+	lua_setmetatable(L, -2);
+	lua_insert(L, -2);
+	lua_setiuservalue(L, -2, 1);
+	return v;
+}
+
+/*
+	Like pop_lstring, but push a view instead of string.
+	The data in one buffer_node is referenced without copy,
+	the data across nodes is copied once into a new chunk.
+ */
+static void
+pop_view(lua_State *L, struct socket_buffer *sb, int sz, int skip) {
+	struct buffer_node * current = sb->head;
+	int bytes = current->sz - sb->offset;
+	if (sz <= bytes) {
+		push_chunk(L, current);
+		new_view(L, current->msg + sb->offset, sz - skip);
+		sb->offset += sz;
+		if (sz == bytes) {
+			return_free_node(L,2,sb);
+		}
+		return;
+	}
+	int need = sz - skip;
+	char * ptr = skynet_malloc(need > 0 ? need : 1);
+	new_chunk(L, ptr);
+	new_view(L, ptr, need);
+	for (;;) {
+		current = sb->head;
+		bytes = current->sz - sb->offset;
+		int n = (bytes < sz) ? bytes : sz;
+		int copy = (n < need) ? n : need;
+		if (copy > 0) {
+			memcpy(ptr, current->msg + sb->offset, copy);
+			ptr += copy;
+			need -= copy;
+		}
+		sz -= n;
+		if (n == bytes) {
+			return_free_node(L,2,sb);
+		} else {
+			sb->offset += n;
+		}
+		if (sz == 0)
+			break;
+	}
+}
+
 /*
 	userdata send_buffer
-	table pool , nil for check
+	userdata pool
+	integer sz (nil for all)
+
+	return view (or nil), size
+ */
+static int
+lpopview(lua_State *L) {
+	struct socket_buffer * sb = lua_touserdata(L, 1);
+	if (sb == NULL) {
+		return luaL_error(L, "Need buffer object at param 1");
+	}
+	luaL_checkudata(L,2,"buffer_pool");
+	int sz = luaL_optinteger(L,3,sb->size);
+	if (sb->size < sz || sz == 0) {
+		lua_pushnil(L);
+	} else {
+		pop_view(L,sb,sz,0);
+		sb->size -= sz;
+		sb->scan = 0;
+	}
+	lua_pushinteger(L, sb->size);
+
+	return 2;
+}
+
+static inline struct socket_view *
+check_view(lua_State *L, int index) {
+	return luaL_checkudata(L, index, VIEW_META);
+}
+
+// translate the relative position (lua string style) to [0, sz]
+static int
+posrelat(lua_Integer pos, int sz) {
+	if (pos > 0)
+		return (pos > sz) ? sz : (int)pos - 1;
+	else if (pos == 0)
+		return 0;
+	else if (pos < -(lua_Integer)sz)
+		return 0;
+	else
+		return sz + (int)pos;
+}
+
+// view:sub(i [, j]) , share the same memory
+static int
+view_sub(lua_State *L) {
+	struct socket_view * v = check_view(L, 1);
+	int from = posrelat(luaL_checkinteger(L, 2), v->sz);
+	lua_Integer j = luaL_optinteger(L, 3, -1);
+	int to = (j < 0) ? posrelat(j, v->sz) + 1 : ((j > v->sz) ? v->sz : (int)j);
+	if (to < from) {
+		to = from;
+	}
+	lua_getiuservalue(L, 1, 1);
+	new_view(L, v->ptr + from, to - from);
+	return 1;
+}
+
+// view:byte(i)
+static int
+view_byte(lua_State *L) {
+	struct socket_view * v = check_view(L, 1);
+	lua_Integer i = luaL_optinteger(L, 2, 1);
+	if (i < 0)
+		i += v->sz + 1;
+	if (i < 1 || i > v->sz)
+		return 0;
+	lua_pushinteger(L, (uint8_t)v->ptr[i-1]);
+	return 1;
+}
+
+// view:find(str [, init]) , plain find, return start, end
+static int
+view_find(lua_State *L) {
+	struct socket_view * v = check_view(L, 1);
+	size_t len;
+	const char * str = luaL_checklstring(L, 2, &len);
+	int init = posrelat(luaL_optinteger(L, 3, 1), v->sz);
+	if (len > (size_t)(v->sz - init))
+		return 0;
+	const char * p = memmem(v->ptr + init, v->sz - init, str, len);
+	if (p == NULL)
+		return 0;
+	lua_pushinteger(L, p - v->ptr + 1);
+	lua_pushinteger(L, p - v->ptr + len);
+	return 2;
+}
+
+// view:ptr() , return lightuserdata, size for the C parsers (sproto, skynet.unpack, ...). Keep the view alive while using it.
+static int
+view_ptr(lua_State *L) {
+	struct socket_view * v = check_view(L, 1);
+	lua_pushlightuserdata(L, (void *)v->ptr);
+	lua_pushinteger(L, v->sz);
+	return 2;
+}
+
+static int
+view_len(lua_State *L) {
+	struct socket_view * v = check_view(L, 1);
+	lua_pushinteger(L, v->sz);
+	return 1;
+}
+
+static int
+view_tostring(lua_State *L) {
+	struct socket_view * v = check_view(L, 1);
+	lua_pushlstring(L, v->ptr, v->sz);
+	return 1;
+}
+
+/*
+	Find the first candidate of sep in [ptr, ptr+sz) : the first two bytes of sep match,
+	or the first byte matches at the end of the block (the rest may be in the next node).
+	The candidate must be confirmed by check_sep.
+ */
+static const char *
+scan_sep(const char *ptr, int sz, const char *sep, int seplen) {
+	if (seplen == 1) {
+		return memchr(ptr, sep[0], sz);
+	}
+	int i = 0;
+#if defined(__AVX2__)
+	__m256i c0 = _mm256_set1_epi8(sep[0]);
+	__m256i c1 = _mm256_set1_epi8(sep[1]);
+	for (; i + 33 <= sz; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(ptr + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(ptr + i + 1));
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, c0), _mm256_cmpeq_epi8(b, c1)));
+		if (mask) {
+			return ptr + i + __builtin_ctz(mask);
+		}
+	}
+#elif defined(__SSE2__)
+	__m128i c0 = _mm_set1_epi8(sep[0]);
+	__m128i c1 = _mm_set1_epi8(sep[1]);
+	for (; i + 17 <= sz; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(ptr + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(ptr + i + 1));
+		int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, c0), _mm_cmpeq_epi8(b, c1)));
+		if (mask) {
+			return ptr + i + __builtin_ctz(mask);
+		}
+	}
+#endif
+	for (;;) {
+		const char * p = memchr(ptr + i, sep[0], sz - i);
+		if (p == NULL)
+			return NULL;
+		i = p - ptr;
+		if (i + 1 == sz || p[1] == sep[1])
+			return p;
+		++i;
+	}
+}
+
+/*
+	userdata send_buffer
+	userdata pool , nil for check
 	string sep
+	boolean view , return view instead of string
  */
 static int
 lreadline(lua_State *L) {
@@ -336,36 +711,73 @@ lreadline(lua_State *L) {
 		return luaL_error(L, "Need buffer object at param 1");
 	}
 	// only check
-	bool check = !lua_istable(L, 2);
+	bool check = lua_isnoneornil(L, 2);
 	size_t seplen = 0;
 	const char *sep = luaL_checklstring(L,3,&seplen);
-	int i;
+	bool view = lua_toboolean(L, 4);
 	struct buffer_node *current = sb->head;
 	if (current == NULL)
 		return 0;
+	int limit = sb->size - (int)seplen;
 	int from = sb->offset;
-	int bytes = current->sz - from;
-	for (i=0;i<=sb->size - (int)seplen;i++) {
-		if (check_sep(current, from, sep, seplen)) {
-			if (check) {
-				lua_pushboolean(L,true);
-			} else {
-				pop_lstring(L, sb, i+seplen, seplen);
-				sb->size -= i+seplen;
-			}
-			return 1;
+	int pos = 0;	// the position of current->msg[from] in buffer
+	int i = -1;
+	if (sb->scan > 0 && sb->scan_len == (int)seplen && memcmp(sb->scan_sep, sep, seplen) == 0) {
+		// continue from the last scan : skip the nodes already scanned
+		while (current && pos + current->sz - from <= sb->scan) {
+			pos += current->sz - from;
+			current = current->next;
+			from = 0;
+		}
+		from += sb->scan - pos;
+		pos = sb->scan;
+	}
+	if (seplen == 0) {
+		i = 0;
+	} else while (current && pos <= limit) {
+		const char * p = scan_sep(current->msg + from, current->sz - from, sep, seplen);
+		if (p == NULL) {
+			pos += current->sz - from;
+			current = current->next;
+			from = 0;
+			continue;
 		}
-		++from;
-		--bytes;
-		if (bytes == 0) {
+		int offset = p - current->msg;
+		pos += offset - from;
+		if (pos > limit)
+			break;
+		if (check_sep(current, offset, sep, seplen)) {
+			i = pos;
+			break;
+		}
+		++pos;
+		from = offset + 1;
+		if (from == current->sz) {
 			current = current->next;
 			from = 0;
-			if (current == NULL)
-				break;
-			bytes = current->sz;
 		}
 	}
-	return 0;
+	if (i < 0) {
+		// no sep starts before limit + 1, remember it for the next check (when more data pushed)
+		if (seplen <= SCAN_SEP_MAX && limit > 0) {
+			sb->scan = limit + 1;
+			sb->scan_len = (int)seplen;
+			memcpy(sb->scan_sep, sep, seplen);
+		}
+		return 0;
+	}
+	if (check) {
+		lua_pushboolean(L,true);
+	} else {
+		if (view) {
+			pop_view(L, sb, i+seplen, seplen);
+		} else {
+			pop_lstring(L, sb, i+seplen, seplen);
+		}
+		sb->size -= i+seplen;
+		sb->scan = 0;
+	}
+	return 1;
 }
 
 static int
@@ -488,9 +900,12 @@ llisten(lua_State *L) {
 	const char * host = luaL_checkstring(L,1);
 	int port = luaL_checkinteger(L,2);
 	int backlog = luaL_optinteger(L,3,BACKLOG);
+	int reuseport = lua_toboolean(L,4);
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
     // tcp的绑定监听
-	int id = skynet_socket_listen(ctx, host,port,backlog);
+	int id = reuseport ?
+		skynet_socket_listen_reuseport(ctx, host,port,backlog) :
+		skynet_socket_listen(ctx, host,port,backlog);
 	if (id < 0) {
 		return luaL_error(L, "Listen error");
 	}
@@ -535,13 +950,77 @@ concat_table(lua_State *L, int index, void *buffer, size_t tlen) {
 	lua_pop(L,1);
 }
 
+static int
+lsharedbuffer_gc(lua_State *L) {
+	struct skynet_socket_sharedbuffer **ud = luaL_checkudata(L, 1, SHAREDBUFFER_META);
+	if (*ud) {
+		skynet_socket_sharedbuffer_release(*ud);
+		*ud = NULL;
+	}
+	return 0;
+}
+
+static int
+lsharedbuffer_len(lua_State *L) {
+	struct skynet_socket_sharedbuffer **ud = luaL_checkudata(L, 1, SHAREDBUFFER_META);
+	lua_pushinteger(L, *ud ? skynet_socket_sharedbuffer_size(*ud) : 0);
+	return 1;
+}
+
+static struct skynet_socket_sharedbuffer *
+new_sharedbuffer(lua_State *L, const void *data, size_t sz) {
+	struct skynet_socket_sharedbuffer **ud = lua_newuserdatauv(L, sizeof(*ud), 0);
+	*ud = NULL;
+	if (luaL_newmetatable(L, SHAREDBUFFER_META)) {
+		lua_pushcfunction(L, lsharedbuffer_gc);
+		lua_setfield(L, -2, "__gc");
+		lua_pushcfunction(L, lsharedbuffer_len);
+		lua_setfield(L, -2, "__len");
+	}
+	lua_setmetatable(L, -2);
+	*ud = skynet_socket_sharedbuffer_new(data, sz);
+	return *ud;
+}
+
+/*
+	string data
+
+	return userdata sharedbuffer, send it to many sockets without copy
+ */
+static int
+lsharedbuffer(lua_State *L) {
+	size_t sz = 0;
+	const char * data = luaL_checklstring(L, 1, &sz);
+	new_sharedbuffer(L, data, sz);
+	return 1;
+}
+
+static struct skynet_socket_sharedbuffer *
+test_sharedbuffer(lua_State *L, int index) {
+	struct skynet_socket_sharedbuffer **ud = luaL_testudata(L, index, SHAREDBUFFER_META);
+	if (ud == NULL)
+		return NULL;
+	if (*ud == NULL) {
+		luaL_error(L, "Released sharedbuffer");
+	}
+	return *ud;
+}
+
 static void
 get_buffer(lua_State *L, int index, struct socket_sendbuffer *buf) {
 	void *buffer;
 	switch(lua_type(L, index)) {
 		size_t len;
-	case LUA_TUSERDATA:
-		// lua full useobject must be a raw pointer, it can't be a socket object or a memory object.
+	case LUA_TUSERDATA: {
+		struct skynet_socket_sharedbuffer *sb = test_sharedbuffer(L, index);
+		if (sb) {
+			// sharedbuffer is a socket object, the socket server releases the reference after sending.
+			buf->type = SOCKET_BUFFER_OBJECT;
+			buf->buffer = skynet_socket_sharedbuffer_grab(sb);
+			buf->sz = 0;
+			break;
+		}
+		// other lua full useobject must be a raw pointer, it can't be a socket object or a memory object.
 		buf->type = SOCKET_BUFFER_RAWPOINTER;
 		buf->buffer = lua_touserdata(L, index);
 		if (lua_isinteger(L, index+1)) {
@@ -550,6 +1029,7 @@ get_buffer(lua_State *L, int index, struct socket_sendbuffer *buf) {
 			buf->sz = lua_rawlen(L, index);
 		}
 		break;
+		}
 	case LUA_TLIGHTUSERDATA: {
 		int sz = -1;
 		if (lua_isinteger(L, index+1)) {
@@ -592,6 +1072,55 @@ lsend(lua_State *L) {
 	return 1;
 }
 
+/*
+	table ids
+	string or sharedbuffer data
+	integer header (optional, 0, 2 or 4)
+
+	Send the same data to all the sockets in ids by one socket server request, the data is copied at most once.
+	If header is 2 or 4, the big-endian size of data is written before it (without copy).
+	return the number of sockets sent
+ */
+static int
+lbroadcast(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	luaL_checktype(L, 1, LUA_TTABLE);
+	int header = luaL_optinteger(L, 3, 0);
+	if (header != 0 && header != 2 && header != 4) {
+		return luaL_error(L, "Invalid header size %d", header);
+	}
+	lua_settop(L, 2);
+	struct skynet_socket_sharedbuffer *sb = test_sharedbuffer(L, 2);
+	if (sb == NULL) {
+		size_t sz = 0;
+		const char * data = luaL_checklstring(L, 2, &sz);
+		sb = new_sharedbuffer(L, data, sz);
+	}
+	if (header == 2 && skynet_socket_sharedbuffer_size(sb) > 0xffff) {
+		return luaL_error(L, "Data is too large (%d) for 2 bytes header", (int)skynet_socket_sharedbuffer_size(sb));
+	}
+	int n = (int)lua_rawlen(L, 1);
+	int tmp[BROADCAST_STACK];
+	int *ids = tmp;
+	if (n > BROADCAST_STACK) {
+		ids = lua_newuserdatauv(L, n * sizeof(int), 0);
+	}
+	int i;
+	for (i=1;i<=n;i++) {
+		lua_rawgeti(L, 1, i);
+		int isnum;
+		int id = (int)lua_tointegerx(L, -1, &isnum);
+		lua_pop(L, 1);
+		if (!isnum) {
+			return luaL_error(L, "Invalid socket id at [%d]", i);
+		}
+		ids[i-1] = id;
+	}
+	int count = skynet_socket_multicast(ctx, sb, header, ids, n);
+	lua_pushinteger(L, count < 0 ? 0 : count);
+	return 1;
+}
+
 static int
 lsendlow(lua_State *L) {
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -617,7 +1146,26 @@ static int
 lstart(lua_State *L) {
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
 	int id = luaL_checkinteger(L, 1);
-	skynet_socket_start(ctx,id);
+	if (lua_isnoneornil(L, 2)) {
+		skynet_socket_start(ctx,id);
+		return 0;
+	}
+	// framing : header size (2/4) or "websocket", byte order ("big"/"little"), max packet size
+	static const char * const byteorder[] = { "big", "little", NULL };
+	int header;
+	if (lua_type(L, 2) == LUA_TSTRING) {
+		if (strcmp(lua_tostring(L, 2), "websocket") != 0) {
+			return luaL_error(L, "Invalid framing %s", lua_tostring(L, 2));
+		}
+		header = SKYNET_SOCKET_FRAME_WEBSOCKET;
+	} else {
+		header = luaL_checkinteger(L, 2);
+	}
+	int little = luaL_checkoption(L, 3, "big", byteorder);
+	int max = luaL_optinteger(L, 4, 0);
+	if (skynet_socket_start_framing(ctx, id, header, little, max)) {
+		return luaL_error(L, "Invalid header size %d", header);
+	}
 	return 0;
 }
 
@@ -637,6 +1185,54 @@ lnodelay(lua_State *L) {
 	return 0;
 }
 
+/*
+	integer id
+	integer usec (optional, default 0) : coalesce window, negative turn off
+		rounded up to whole milliseconds, the resolution of the poll timeout
+ */
+static int
+lcoalesce(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	int usec = luaL_optinteger(L, 2, 0);
+	skynet_socket_coalesce(ctx, id, usec);
+	return 0;
+}
+
+static int
+limit_policy(lua_State *L, int index) {
+	static const char * const policies[] = { "notify", "drop", "close", NULL };
+	static const int policy_id[] = { SOCKET_LIMIT_NOTIFY, SOCKET_LIMIT_DROP, SOCKET_LIMIT_CLOSE };
+	return policy_id[luaL_checkoption(L, index, "close", policies)];
+}
+
+/*
+	integer id
+	integer limit : bytes of write buffer, 0 means no limit
+	string policy (optional) : "notify", "drop" or "close" (default)
+ */
+static int
+lwrite_limit(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	lua_Integer limit = luaL_checkinteger(L, 2);
+	int policy = limit_policy(L, 3);
+	skynet_socket_limit(ctx, id, limit, policy);
+	return 0;
+}
+
+/*
+	integer limit : total bytes of all the write buffers, 0 means no limit
+	string policy (optional) : applied to the socket which is growing
+ */
+static int
+lwrite_limit_global(lua_State *L) {
+	lua_Integer limit = luaL_checkinteger(L, 1);
+	int policy = limit_policy(L, 2);
+	skynet_socket_limit_global(limit, policy);
+	return 0;
+}
+
 static int
 ludp(lua_State *L) {
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -718,9 +1314,100 @@ ludp_address(lua_State *L) {
 	return 2;
 }
 
+/*
+	lightuserdata msg (SKYNET_SOCKET_TYPE_UDP_BATCH)
+	integer size
+
+	return table { data1, address1, data2, address2, ... }, n
+ */
+static int
+ludp_batch(lua_State *L) {
+	const uint8_t * ptr = lua_touserdata(L, 1);
+	int size = luaL_checkinteger(L, 2);
+	if (ptr == NULL) {
+		return luaL_error(L, "Need message block at param 1");
+	}
+	const uint8_t * end = ptr + size;
+	lua_newtable(L);
+	int n = 0;
+	while (ptr + sizeof(uint16_t) <= end) {
+		uint16_t sz;
+		memcpy(&sz, ptr, sizeof(sz));
+		ptr += sizeof(sz);
+		struct skynet_socket_message tmp;
+		tmp.type = SKYNET_SOCKET_TYPE_UDP;
+		tmp.id = 0;
+		tmp.ud = sz;
+		tmp.buffer = (char *)ptr;
+		int addrsz = 0;
+		const char * address = skynet_socket_udp_address(&tmp, &addrsz);
+		if (address == NULL || ptr + sz + addrsz > end) {
+			return luaL_error(L, "Invalid udp batch message");
+		}
+		lua_pushlstring(L, (const char *)ptr, sz);
+		lua_rawseti(L, -2, n*2+1);
+		lua_pushlstring(L, address, addrsz);
+		lua_rawseti(L, -2, n*2+2);
+		++n;
+		ptr += sz + addrsz;
+	}
+	lua_pushinteger(L, n);
+	return 2;
+}
+
+/*
+	lightuserdata msg
+	integer size
+	integer header (2 or 4, big-endian)
+
+	split a framed SKYNET_SOCKET_TYPE_DATA message (see skynet_socket_handoff)
+	return table { packet1, packet2, ... }, n
+ */
+static int
+lpackets(lua_State *L) {
+	const uint8_t * ptr = lua_touserdata(L, 1);
+	int size = luaL_checkinteger(L, 2);
+	int header = luaL_optinteger(L, 3, 2);
+	if (ptr == NULL) {
+		return luaL_error(L, "Need message block at param 1");
+	}
+	if (header != 2 && header != 4) {
+		return luaL_error(L, "Invalid header size %d", header);
+	}
+	const uint8_t * end = ptr + size;
+	lua_newtable(L);
+	int n = 0;
+	while (ptr + header <= end) {
+		size_t sz;
+		if (header == 2) {
+			sz = ptr[0] << 8 | ptr[1];
+		} else {
+			sz = (size_t)ptr[0] << 24 | ptr[1] << 16 | ptr[2] << 8 | ptr[3];
+		}
+		ptr += header;
+		if (sz > (size_t)(end - ptr)) {
+			return luaL_error(L, "Invalid framed message");
+		}
+		lua_pushlstring(L, (const char *)ptr, sz);
+		lua_rawseti(L, -2, ++n);
+		ptr += sz;
+	}
+	lua_pushinteger(L, n);
+	return 2;
+}
+
 static void
 getinfo(lua_State *L, struct socket_info *si) {
 	lua_newtable(L);
+	if (si->type == SOCKET_INFO_SERVER) {
+		lua_pushstring(L, "SERVER");
+		lua_setfield(L, -2, "type");
+		lua_pushinteger(L, si->wbuffer);
+		lua_setfield(L, -2, "wbuffer");
+		lua_pushinteger(L, si->wlimit);
+		lua_setfield(L, -2, "wlimit");
+		return;
+	}
 	lua_pushinteger(L, si->id);
 	lua_setfield(L, -2, "id");
 	lua_pushinteger(L, si->opaque);
@@ -762,6 +1449,10 @@ getinfo(lua_State *L, struct socket_info *si) {
 	lua_setfield(L, -2, "write");
 	lua_pushinteger(L, si->wbuffer);
 	lua_setfield(L, -2, "wbuffer");
+	if (si->wlimit > 0) {
+		lua_pushinteger(L, si->wlimit);
+		lua_setfield(L, -2, "wlimit");
+	}
 	lua_pushinteger(L, si->rtime);
 	lua_setfield(L, -2, "rtime");
 	lua_pushinteger(L, si->wtime);
@@ -824,8 +1515,11 @@ luaopen_skynet_socketdriver(lua_State *L) {
 	luaL_checkversion(L);
 	luaL_Reg l[] = {
 		{ "buffer", lnewbuffer },
+		{ "pool", lnewpool },
+		{ "bufferinfo", lbufferinfo },
 		{ "push", lpushbuffer },
 		{ "pop", lpopbuffer },
+		{ "popview", lpopview },
 		{ "drop", ldrop },
 		{ "readall", lreadall },
 		{ "clear", lclearbuffer },
@@ -833,6 +1527,9 @@ luaopen_skynet_socketdriver(lua_State *L) {
 		{ "str2p", lstr2p },
 		{ "header", lheader },
 		{ "info", linfo },
+		{ "udp_batch", ludp_batch },
+		{ "packets", lpackets },
+		{ "sharedbuffer", lsharedbuffer },
 
 		{ "unpack", lunpack },
 		{ NULL, NULL },
@@ -845,10 +1542,14 @@ luaopen_skynet_socketdriver(lua_State *L) {
 		{ "listen", llisten },
 		{ "send", lsend },
 		{ "lsend", lsendlow },
+		{ "broadcast", lbroadcast },
 		{ "bind", lbind },
 		{ "start", lstart },
 		{ "pause", lpause },
 		{ "nodelay", lnodelay },
+		{ "coalesce", lcoalesce },
+		{ "write_limit", lwrite_limit },
+		{ "write_limit_global", lwrite_limit_global },
 		{ "udp", ludp },
 		{ "udp_connect", ludp_connect },
 		{ "udp_send", ludp_send },
@@ -0,0 +1,244 @@
+#define LUA_LIB
+
+#include "websocket_mask.h"
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+	websocket frame (RFC 6455 5.2)
+
+	 0                   1                   2                   3
+	+-+-+-+-+-------+-+-------------+-------------------------------+
+	|F|R|R|R| opcode|M| Payload len |    Extended payload length    |
+	|I|S|S|S|  (4)  |A|     (7)     |             (16/64)           |
+	|N|V|V|V|       |S|             |   (if payload len==126/127)   |
+	+-+-+-+-+-------+-+-------------+-------------------------------+
+	|    Masking-key (0 or 4 bytes) |          Payload Data         |
+	+-------------------------------+-------------------------------+
+ */
+
+#define HEADER_MAX 14
+#define DEFAULT_MAX (256 * 1024)
+
+static void
+get_key(lua_State *L, int index, uint8_t key[4]) {
+	if (lua_type(L, index) == LUA_TSTRING) {
+		size_t sz;
+		const char * s = lua_tolstring(L, index, &sz);
+		if (sz != 4) {
+			luaL_error(L, "Invalid masking key size %d", (int)sz);
+		}
+		memcpy(key, s, 4);
+	} else {
+		uint32_t k = (uint32_t)luaL_checkinteger(L, index);
+		key[0] = k >> 24;
+		key[1] = k >> 16;
+		key[2] = k >> 8;
+		key[3] = k;
+	}
+}
+
+static inline int
+zero_key(const uint8_t key[4]) {
+	return (key[0] | key[1] | key[2] | key[3]) == 0;
+}
+
+/*
+	string data
+	string key (4 bytes) or integer (big-endian)
+	integer offset (optional) : the position of data in payload
+
+	return masked data
+ */
+static int
+lmask(lua_State *L) {
+	size_t sz;
+	const uint8_t * data = (const uint8_t *)luaL_checklstring(L, 1, &sz);
+	uint8_t key[4];
+	get_key(L, 2, key);
+	size_t offset = (size_t)luaL_optinteger(L, 3, 0);
+	if (zero_key(key)) {
+		lua_settop(L, 1);
+		return 1;
+	}
+	luaL_Buffer b;
+	uint8_t * dst = (uint8_t *)luaL_buffinitsize(L, &b, sz);
+	websocket_mask(dst, data, sz, key, offset);
+	luaL_pushresultsize(&b, sz);
+	return 1;
+}
+
+/*
+	integer opcode
+	string payload (optional)
+	boolean fin (optional, default true)
+	masking key (optional, string or integer)
+	integer rsv (optional, the RSV1-3 bits : 0x40 0x20 0x10)
+
+	return the frame, the payload is masked if the key is given
+ */
+static int
+lpack(lua_State *L) {
+	int op = (int)luaL_checkinteger(L, 1);
+	size_t sz = 0;
+	const uint8_t * payload = (const uint8_t *)luaL_optlstring(L, 2, "", &sz);
+	int fin = lua_isnoneornil(L, 3) ? 1 : lua_toboolean(L, 3);
+	int masked = !lua_isnoneornil(L, 4);
+	uint8_t key[4];
+	if (masked) {
+		get_key(L, 4, key);
+	}
+	int rsv = (int)luaL_optinteger(L, 5, 0) & 0x70;
+	if (op < 0 || op > 0xf) {
+		return luaL_error(L, "Invalid opcode %d", op);
+	}
+	uint8_t head[HEADER_MAX];
+	int n = 2;
+	head[0] = (fin ? 0x80 : 0) | rsv | op;
+	uint8_t mask = masked ? 0x80 : 0;
+	if (sz < 126) {
+		head[1] = mask | (uint8_t)sz;
+	} else if (sz <= 0xffff) {
+		head[1] = mask | 126;
+		head[2] = sz >> 8;
+		head[3] = sz;
+		n = 4;
+	} else {
+		head[1] = mask | 127;
+		int i;
+		for (i=0;i<8;i++) {
+			head[2+i] = (uint8_t)((uint64_t)sz >> (56 - i * 8));
+		}
+		n = 10;
+	}
+	if (masked) {
+		memcpy(head + n, key, 4);
+		n += 4;
+	}
+	luaL_Buffer b;
+	uint8_t * dst = (uint8_t *)luaL_buffinitsize(L, &b, n + sz);
+	memcpy(dst, head, n);
+	if (masked) {
+		websocket_mask(dst + n, payload, sz, key, 0);
+	} else {
+		memcpy(dst + n, payload, sz);
+	}
+	luaL_pushresultsize(&b, n + sz);
+	return 1;
+}
+
+// return the size of header, 0 when uncomplete
+static int
+parse_header(const uint8_t *h, size_t sz, uint64_t *len) {
+	if (sz < 2) {
+		return 0;
+	}
+	int n = h[1] & 0x7f;
+	int ext = (n == 126) ? 2 : (n == 127) ? 8 : 0;
+	int header = 2 + ext + ((h[1] & 0x80) ? 4 : 0);
+	if (sz < (size_t)header) {
+		return 0;
+	}
+	uint64_t l = n;
+	if (ext) {
+		int i;
+		l = 0;
+		for (i=0;i<ext;i++) {
+			l = l << 8 | h[2+i];
+		}
+	}
+	*len = l;
+	return header;
+}
+
+/*
+	string head : at least 2 bytes of the frame
+
+	return the size of header, or nil if head is too short ;
+	then fin, opcode, payload length, rsv when the header is complete
+ */
+static int
+lheader(lua_State *L) {
+	size_t sz;
+	const uint8_t * h = (const uint8_t *)luaL_checklstring(L, 1, &sz);
+	if (sz < 2) {
+		return 0;
+	}
+	int n = h[1] & 0x7f;
+	int header = 2 + ((n == 126) ? 2 : (n == 127) ? 8 : 0) + ((h[1] & 0x80) ? 4 : 0);
+	lua_pushinteger(L, header);
+	uint64_t len;
+	if (parse_header(h, sz, &len) == 0) {
+		return 1;
+	}
+	lua_pushboolean(L, h[0] & 0x80);
+	lua_pushinteger(L, h[0] & 0xf);
+	lua_pushinteger(L, (lua_Integer)len);
+	lua_pushinteger(L, h[0] & 0x70);
+	return 5;
+}
+
+/*
+	string data
+	integer pos (optional, default 1)
+	integer max (optional) : max payload size
+
+	Parse one frame at pos, the payload is unmasked.
+	return fin, opcode, payload, next pos, rsv ; or nil if the frame is uncomplete
+ */
+static int
+lunpack(lua_State *L) {
+	size_t sz;
+	const uint8_t * data = (const uint8_t *)luaL_checklstring(L, 1, &sz);
+	lua_Integer pos = luaL_optinteger(L, 2, 1);
+	lua_Integer max = luaL_optinteger(L, 3, DEFAULT_MAX);
+	if (pos < 1 || (size_t)pos > sz + 1) {
+		return luaL_error(L, "Invalid position %d", (int)pos);
+	}
+	const uint8_t * h = data + pos - 1;
+	size_t left = sz - (pos - 1);
+	uint64_t len;
+	int header = parse_header(h, left, &len);
+	if (header == 0) {
+		return 0;
+	}
+	if (len > (uint64_t)max) {
+		return luaL_error(L, "payload_len is too large");
+	}
+	if (left - header < len) {
+		return 0;
+	}
+	lua_pushboolean(L, h[0] & 0x80);
+	lua_pushinteger(L, h[0] & 0xf);
+	const uint8_t * payload = h + header;
+	if ((h[1] & 0x80) && !zero_key(payload - 4)) {
+		luaL_Buffer b;
+		uint8_t * dst = (uint8_t *)luaL_buffinitsize(L, &b, len);
+		websocket_mask(dst, payload, len, payload - 4, 0);
+		luaL_pushresultsize(&b, len);
+	} else {
+		lua_pushlstring(L, (const char *)payload, len);
+	}
+	lua_pushinteger(L, pos + header + len);
+	lua_pushinteger(L, h[0] & 0x70);
+	return 5;
+}
+
+LUAMOD_API int
+luaopen_skynet_websocket(lua_State *L) {
+	luaL_checkversion(L);
+	luaL_Reg l[] = {
+		{ "mask", lmask },
+		{ "pack", lpack },
+		{ "header", lheader },
+		{ "unpack", lunpack },
+		{ NULL, NULL },
+	};
+	luaL_newlib(L,l);
+	return 1;
+}
@@ -1,6 +1,7 @@
 local internal = require "http.internal"
 local socket = require "skynet.socket"
 local crypt = require "skynet.crypt"
+local wsframe = require "skynet.websocket"
 local httpd = require "http.httpd"
 local skynet = require "skynet"
 local sockethelper = require "http.sockethelper"
@@ -8,6 +9,7 @@ local socket_error = sockethelper.socket_error
 
 local GLOBAL_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
 local MAX_FRAME_SIZE = 256 * 1024 -- max frame is 256K
+local DEFLATE_RSV = 0x40 -- RSV1 : the message is compressed (permessage-deflate)
 
 local M = {}
 
@@ -18,6 +20,16 @@ local function _close_websocket(ws_obj)
     assert(ws_pool[id] == ws_obj)
     ws_pool[id] = nil
     ws_obj.close()
+    local ext = ws_obj.deflate
+    if ext then
+        -- the streams without context takeover are shared by the connections
+        if not ext.deflate_reset then
+            ext.deflater:close()
+        end
+        if not ext.inflate_reset then
+            ext.inflater:close()
+        end
+    end
 end
 
 local function _isws_closed(id)
@@ -25,13 +37,192 @@ local function _isws_closed(id)
 end
 
 
-local function write_handshake(self, host, url, header)
+--[[
+permessage-deflate (RFC 7692), options.deflate of accept/connect :
+    level : compression level, 1 - 9
+    mem_level : memory level of compressor, 1 - 9 (default 8)
+    window_bits : the window of our compressor, 9 - 15 (default 15)
+    peer_window_bits : ask the peer to use a smaller window, 9 - 15 (default 15)
+    context_takeover : false to reset the streams for each message. The streams are
+        shared by all the connections of the service, so a connection costs no memory for compression.
+    dictionary : the preset dictionary applied after each reset, it's only negotiated between
+        skynet peers, and both sides must use the same one.
+    max_size : max size of inflated message (default MAX_FRAME_SIZE)
+]]
+
+local ldeflate
+local shared_stream = {}
+
+local function dictionary_id(dict)
+    return crypt.hexencode(crypt.hashkey(dict))
+end
+
+local function new_stream(mode, bits, conf, dict, takeover)
+    ldeflate = ldeflate or require "ldeflate"
+    if takeover then
+        return ldeflate.new(mode, bits, conf.level, conf.mem_level, dict)
+    end
+    local key = string.format("%s:%d:%s:%s:%s", mode, bits, conf.level, conf.mem_level, dict and dictionary_id(dict))
+    local stream = shared_stream[key]
+    if not stream then
+        stream = ldeflate.new(mode, bits, conf.level, conf.mem_level, dict)
+        shared_stream[key] = stream
+    end
+    return stream
+end
+
+local function new_deflate(conf, deflate_bits, deflate_takeover, inflate_bits, inflate_takeover, dict)
+    return {
+        deflater = new_stream("deflate", deflate_bits, conf, dict, deflate_takeover),
+        deflate_reset = not deflate_takeover,
+        -- zlib can't deflate with 8 bits window, but inflate with 9 bits is compatible
+        inflater = new_stream("inflate", math.max(inflate_bits, 9), conf, dict, inflate_takeover),
+        inflate_reset = not inflate_takeover,
+        max_size = conf.max_size or MAX_FRAME_SIZE,
+    }
+end
+
+-- Sec-WebSocket-Extensions: name; param1; param2=value, name2 ...
+-- return { { name = name, params = { [param] = value or true } } }, params is nil if duplicated
+local function parse_extensions(s)
+    local exts = {}
+    for ext in s:gmatch("[^,]+") do
+        local name, params
+        for item in ext:gmatch("[^;]+") do
+            local k, v = item:match('^%s*([^=%s]+)%s*=?%s*"?([^"]-)"?%s*$')
+            if not name then
+                name = k and k:lower()
+                params = {}
+            elseif k and params then
+                k = k:lower()
+                if params[k] ~= nil then
+                    params = nil
+                else
+                    params[k] = v ~= "" and v or true
+                end
+            end
+        end
+        exts[#exts+1] = { name = name, params = params }
+    end
+    return exts
+end
+
+local function window_bits(v, min)
+    local n = math.tointeger(tonumber(v))
+    if n and n >= min and n <= 15 then
+        return n
+    end
+end
+
+-- server : return the response of the first acceptable offer and the deflate
+local function accept_deflate(conf, offers)
+    for _, offer in ipairs(offers) do
+        local params = offer.params
+        if offer.name == "permessage-deflate" and params then
+            local takeover = conf.context_takeover ~= false
+            local server_takeover, client_takeover = takeover, takeover
+            local server_bits = conf.window_bits or 15
+            local client_bits = 15
+            local client_bits_offer, dict
+            local ok = true
+            for k, v in pairs(params) do
+                if k == "server_no_context_takeover" and v == true then
+                    server_takeover = false
+                elseif k == "client_no_context_takeover" and v == true then
+                    client_takeover = false
+                elseif k == "server_max_window_bits" and window_bits(v, 9) then
+                    server_bits = math.min(server_bits, window_bits(v, 9))
+                elseif k == "client_max_window_bits" and (v == true or window_bits(v, 8)) then
+                    client_bits_offer = true
+                    client_bits = math.min(conf.peer_window_bits or 15, v == true and 15 or window_bits(v, 8))
+                elseif k == "skynet_dictionary" then
+                    if conf.dictionary and v == dictionary_id(conf.dictionary) then
+                        dict = conf.dictionary
+                    end
+                else
+                    ok = false
+                    break
+                end
+            end
+            if ok then
+                local resp = { "permessage-deflate" }
+                if not server_takeover then
+                    resp[#resp+1] = "server_no_context_takeover"
+                end
+                if not client_takeover then
+                    resp[#resp+1] = "client_no_context_takeover"
+                end
+                if server_bits < 15 then
+                    resp[#resp+1] = "server_max_window_bits=" .. server_bits
+                end
+                if client_bits_offer and client_bits < 15 then
+                    resp[#resp+1] = "client_max_window_bits=" .. client_bits
+                end
+                if dict then
+                    resp[#resp+1] = "skynet_dictionary=" .. dictionary_id(dict)
+                end
+                return table.concat(resp, "; "),
+                    new_deflate(conf, server_bits, server_takeover, client_bits, client_takeover, dict)
+            end
+        end
+    end
+end
+
+-- client
+local function offer_deflate(conf)
+    local offer = { "permessage-deflate" }
+    if conf.context_takeover == false then
+        offer[#offer+1] = "server_no_context_takeover"
+        offer[#offer+1] = "client_no_context_takeover"
+    end
+    if conf.peer_window_bits then
+        offer[#offer+1] = "server_max_window_bits=" .. conf.peer_window_bits
+    end
+    offer[#offer+1] = "client_max_window_bits" .. (conf.window_bits and ("=" .. conf.window_bits) or "")
+    if conf.dictionary then
+        offer[#offer+1] = "skynet_dictionary=" .. dictionary_id(conf.dictionary)
+    end
+    return table.concat(offer, "; ")
+end
+
+local function resolve_deflate(conf, s)
+    local exts = parse_extensions(s)
+    local params = exts[1].params
+    if #exts ~= 1 or exts[1].name ~= "permessage-deflate" or not params then
+        error("websocket handshake invalid Sec-WebSocket-Extensions: " .. s)
+    end
+    local takeover = conf.context_takeover ~= false
+    local server_takeover, client_takeover = takeover, takeover
+    local server_bits = 15
+    local client_bits = conf.window_bits or 15
+    local dict
+    for k, v in pairs(params) do
+        if k == "server_no_context_takeover" and v == true then
+            server_takeover = false
+        elseif k == "client_no_context_takeover" and v == true then
+            client_takeover = false
+        elseif k == "server_max_window_bits" and window_bits(v, 8) then
+            server_bits = window_bits(v, 8)
+        elseif k == "client_max_window_bits" and window_bits(v, 9) then
+            client_bits = math.min(client_bits, window_bits(v, 9))
+        elseif k == "skynet_dictionary" and conf.dictionary and v == dictionary_id(conf.dictionary) then
+            dict = conf.dictionary
+        else
+            error("websocket handshake invalid permessage-deflate parameter: " .. k)
+        end
+    end
+    return new_deflate(conf, client_bits, client_takeover, server_bits, server_takeover, dict)
+end
+
+
+local function write_handshake(self, host, url, header, deflate)
     local key = crypt.base64encode(crypt.randomkey()..crypt.randomkey())
     local request_header = {
         ["Upgrade"] = "websocket",
         ["Connection"] = "Upgrade",
         ["Sec-WebSocket-Version"] = "13",
-        ["Sec-WebSocket-Key"] = key
+        ["Sec-WebSocket-Key"] = key,
+        ["Sec-WebSocket-Extensions"] = deflate and offer_deflate(deflate),
     }
     if header then
         for k,v in pairs(header) do
@@ -65,10 +256,18 @@ local function write_handshake(self, host, url, header)
     if sw_key ~= crypt.sha1(key .. guid) then
         error("websocket handshake invalid Sec-WebSocket-Accept")
     end
+
+    local extensions = recvheader["sec-websocket-extensions"]
+    if extensions then
+        if not deflate then
+            error("websocket handshake unexpected Sec-WebSocket-Extensions")
+        end
+        self.deflate = resolve_deflate(deflate, extensions)
+    end
 end
 
 
-local function read_handshake(self, upgrade_ops)
+local function read_handshake(self, upgrade_ops, deflate)
     local header, method, url
     if upgrade_ops then
         header, method, url = upgrade_ops.header, upgrade_ops.method, upgrade_ops.url
@@ -139,6 +338,16 @@ local function read_handshake(self, upgrade_ops)
         end
     end
 
+    local extension = ""
+    local extensions = header["sec-websocket-extensions"]
+    if deflate and extensions then
+        local resp
+        resp, self.deflate = accept_deflate(deflate, parse_extensions(extensions))
+        if resp then
+            extension = string.format("Sec-WebSocket-Extensions: %s\r\n", resp)
+        end
+    end
+
     -- read 'x-real-ip' header from nginx
     self.real_ip = header["x-real-ip"]
 
@@ -149,7 +358,13 @@ local function read_handshake(self, upgrade_ops)
                  "Connection: Upgrade\r\n"..
     string.format("Sec-WebSocket-Accept: %s\r\n", accept)..
                   sub_pro ..
+                  extension ..
                   "\r\n"
+    if self.protocol == "ws" then
+        -- the socket thread splits and unmasks the frames, turn it on before the client
+        -- reads the 101 response, then no frame straddles the switch
+        socket.framing(self.id, "websocket", nil, MAX_FRAME_SIZE)
+    end
     self.write(resp)
     return nil, header, url
 end
@@ -178,32 +393,28 @@ local op_code = {
 }
 
 local function write_frame(self, op, payload_data, masking_key)
-    payload_data = payload_data or ""
-    local payload_len = #payload_data
     local op_v = assert(op_code[op])
-    local v1 = 0x80 | op_v -- fin is 1 with opcode
-    local s
-    local mask = masking_key and 0x80 or 0x00
-    -- mask set to 0
-    if payload_len < 126 then
-        s = string.pack("I1I1", v1, mask | payload_len)
-    elseif payload_len <= 0xffff then
-        s = string.pack("I1I1>I2", v1, mask | 126, payload_len)
-    else
-        s = string.pack("I1I1>I8", v1, mask | 127, payload_len)
-    end
-    self.write(s)
+    local rsv
+    local ext = self.deflate
+    if ext and payload_data and op_v < 0x08 then
+        -- compress the data frames only
+        payload_data = ext.deflater:deflate(payload_data, ext.deflate_reset)
+        rsv = DEFLATE_RSV
+    end
+    -- fin is 1, header and (masked) payload are built in C as one string
+    self.write(wsframe.pack(op_v, payload_data, true, masking_key, rsv))
+end
 
-    -- write masking_key
-    if masking_key then
-        s = string.pack(">I4", masking_key)
-        self.write(s)
-        payload_data = crypt.xor_str(payload_data, s)
-    end
 
-    if payload_len > 0 then
-        self.write(payload_data)
+local function inflate_message(self, payload_data, rsv)
+    if rsv & DEFLATE_RSV == 0 then
+        return payload_data
     end
+    local ext = self.deflate
+    if not ext then
+        error("websocket RSV1 is set without permessage-deflate")
+    end
+    return ext.inflater:inflate(payload_data, ext.max_size, ext.inflate_reset)
 end
 
 
@@ -220,38 +431,30 @@ end
 
 local function read_frame(self)
     local s = self.read(2)
-    local v1, v2 = string.unpack("I1I1", s)
-    local fin  = (v1 & 0x80) ~= 0
-    -- unused flag
-    -- local rsv1 = (v1 & 0x40) ~= 0
-    -- local rsv2 = (v1 & 0x20) ~= 0
-    -- local rsv3 = (v1 & 0x10) ~= 0
-    local op   =  v1 & 0x0f
-    local mask = (v2 & 0x80) ~= 0
-    local payload_len = (v2 & 0x7f)
-    if payload_len == 126 then
-        s = self.read(2)
-        payload_len = string.unpack(">I2", s)
-    elseif payload_len == 127 then
-        s = self.read(8)
-        payload_len = string.unpack(">I8", s)
+    local header_len = wsframe.header(s)
+    if header_len > 2 then
+        -- extended payload length and masking key
+        s = s .. self.read(header_len - 2)
     end
+    local _, fin, op, payload_len, rsv = wsframe.header(s)
 
     if self.mode == "server" and payload_len > MAX_FRAME_SIZE then
         error("payload_len is too large")
     end
 
-    -- print(string.format("fin:%s, op:%s, mask:%s, payload_len:%s", fin, op_code[op], mask, payload_len))
-    local masking_key = mask and self.read(4) or false
+    -- print(string.format("fin:%s, op:%s, payload_len:%s", fin, op_code[op], payload_len))
     local payload_data = payload_len>0 and self.read(payload_len) or ""
-    payload_data = masking_key and crypt.xor_str(payload_data, masking_key) or payload_data
-    return fin, assert(op_code[op]), payload_data
+    if (s:byte(2) & 0x80) ~= 0 then
+        -- the socket thread may have unmasked it (websocket framing), then the key is 0
+        payload_data = wsframe.mask(payload_data, s:sub(-4))
+    end
+    return fin, assert(op_code[op]), payload_data, rsv
 end
 
 
 local function resolve_accept(self, options)
     try_handle(self, "connect")
-    local code, err, url = read_handshake(self, options and options.upgrade)
+    local code, err, url = read_handshake(self, options and options.upgrade, options and options.deflate)
     if code then
         local ok, s = httpd.write_response(self.write, code, err)
         if not ok then
@@ -265,13 +468,13 @@ local function resolve_accept(self, options)
     try_handle(self, "handshake", header, url)
     local recv_count = 0
     local recv_buf = {}
-    local first_op
+    local first_op, first_rsv
     while true do
         if _isws_closed(self.id) then
             try_handle(self, "close")
             return
         end
-        local fin, op, payload_data = read_frame(self)
+        local fin, op, payload_data, rsv = read_frame(self)
         if op == "close" then
             local code, reason = read_close(payload_data)
             write_frame(self, "close")
@@ -284,7 +487,7 @@ local function resolve_accept(self, options)
             try_handle(self, "pong")
         else
             if fin and #recv_buf == 0 then
-                try_handle(self, "message", payload_data, op)
+                try_handle(self, "message", inflate_message(self, payload_data, rsv), op)
             else
                 recv_buf[#recv_buf+1] = payload_data
                 recv_count = recv_count + #payload_data
@@ -292,12 +495,14 @@ local function resolve_accept(self, options)
                     error("payload_len is too large")
                 end
                 first_op = first_op or op
+                first_rsv = first_rsv or rsv
                 if fin then
-                    local s = table.concat(recv_buf)
+                    local s = inflate_message(self, table.concat(recv_buf), first_rsv)
                     try_handle(self, "message", s, first_op)
                     recv_buf = {}  -- clear recv_buf
                     recv_count = 0
                     first_op = nil
+                    first_rsv = nil
                 end
             end
         end
@@ -385,6 +590,7 @@ local function _new_server_ws(socket_id, handle, protocol)
     end
 
     obj.mode = "server"
+    obj.protocol = protocol
     obj.id = assert(socket_id)
     obj.handle = handle
     obj.guid = GLOBAL_GUID
@@ -430,7 +636,7 @@ function M.accept(socket_id, handle, protocol, addr, options)
 end
 
 
-function M.connect(url, header, timeout)
+function M.connect(url, header, timeout, options)
     local protocol, host, uri = string.match(url, "^(wss?)://([^/]+)(.*)$")
     if protocol ~= "wss" and protocol ~= "ws" then
         error(string.format("invalid protocol: %s", protocol))
@@ -451,16 +657,16 @@ function M.connect(url, header, timeout)
     local socket_id = sockethelper.connect(host_addr, host_port, timeout)
     local ws_obj = _new_client_ws(socket_id, protocol, hostname)
     ws_obj.addr = host
-    write_handshake(ws_obj, host_addr, uri, header)
+    write_handshake(ws_obj, host_addr, uri, header, options and options.deflate)
     return socket_id
 end
 
 
 function M.read(id)
     local ws_obj = assert(ws_pool[id])
-    local recv_buf
+    local recv_buf, first_rsv
     while true do
-        local fin, op, payload_data = read_frame(ws_obj)
+        local fin, op, payload_data, rsv = read_frame(ws_obj)
         if op == "close" then
             _close_websocket(ws_obj)
             return false, payload_data
@@ -468,13 +674,14 @@ function M.read(id)
             write_frame(ws_obj, "pong", payload_data)
         elseif op ~= "pong" then  -- op is frame, text binary
             if fin and not recv_buf then
-                return payload_data
+                return inflate_message(ws_obj, payload_data, rsv)
             else
                 recv_buf = recv_buf or {}
                 recv_buf[#recv_buf+1] = payload_data
+                first_rsv = first_rsv or rsv
                 if fin then
                     local s = table.concat(recv_buf)
-                    return s
+                    return inflate_message(ws_obj, s, first_rsv)
                 end
             end
         end
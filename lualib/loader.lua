@@ -7,21 +7,42 @@ SERVICE_NAME = args[1]
 
 local main, pattern
 
-local err = {}
-for pat in string.gmatch(LUA_SERVICE, "([^;]+);*") do
-	local filename = string.gsub(pat, "?", SERVICE_NAME)
-	local f, msg = loadfile(filename)
-	if not f then
-		table.insert(err, msg)
-	else
-		pattern = pat
-		main = f
-		break
+-- the warm data recorded by the first instance of this service (see service_snlua.c)
+local template = require "skynet.template"
+local cached = template.get(SERVICE_NAME)
+local modules = {}
+if cached then
+	local rest
+	pattern, rest = string.match(cached, "^([^\n]*)\n(.*)$")
+	for name, index, filename in string.gmatch(rest, "([^\t]+)\t(%d+)\t([^\n]+)\n") do
+		modules[name] = { tonumber(index), filename }
+	end
+	local filename = string.gsub(pattern, "?", SERVICE_NAME)
+	main = loadfile(filename)
+	if not main then
+		-- the file is moved, search it again
+		cached = nil
+		modules = {}
 	end
 end
 
 if not main then
-	error(table.concat(err, "\n"))
+	local err = {}
+	for pat in string.gmatch(LUA_SERVICE, "([^;]+);*") do
+		local filename = string.gsub(pat, "?", SERVICE_NAME)
+		local f, msg = loadfile(filename)
+		if not f then
+			table.insert(err, msg)
+		else
+			pattern = pat
+			main = f
+			break
+		end
+	end
+
+	if not main then
+		error(table.concat(err, "\n"))
+	end
 end
 
 LUA_SERVICE = nil
@@ -39,6 +60,35 @@ else
 	SERVICE_PATH = p
 end
 
+-- Find the modules by the template first, or record the files found by the searchers.
+local record = not cached and {}
+local searchers = package.searchers
+table.insert(searchers, 2, function(name)
+	local m = modules[name]
+	if m then
+		local index, filename = m[1], m[2]
+		local f
+		if index == 2 then
+			f = loadfile(filename)
+		else
+			f = package.loadlib(filename, "luaopen_" .. string.gsub(name, "%.", "_"))
+		end
+		if f then
+			return f, filename
+		end
+	end
+	for i = 3, #searchers do
+		local f, extra = searchers[i](name)
+		if type(f) == "function" then
+			-- the lua searcher (2), c searcher (3) and all-in-one searcher (4)
+			if record and i <= 5 and type(extra) == "string" and not string.find(name, "-", 1, true) then
+				table.insert(record, string.format("%s\t%d\t%s\n", name, i - 1, extra))
+			end
+			return f, extra
+		end
+	end
+end)
+
 if LUA_PRELOAD then
 	local f = assert(loadfile(LUA_PRELOAD))
 	f(table.unpack(args))
@@ -48,3 +98,7 @@ end
 _G.require = (require "skynet.require").require
 
 main(select(2, table.unpack(args)))
+
+if record then
+	template.set(SERVICE_NAME, pattern .. "\n" .. table.concat(record))
+end
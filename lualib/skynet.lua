@@ -41,6 +41,7 @@ local skynet = {
 	PTYPE_LUA = 10,
 	PTYPE_SNAX = 11,
 	PTYPE_TRACE = 12,	-- use for debug trace
+	PTYPE_IDLE = 13,	-- the workers are idle, see skynet.gc.idle
 }
 
 -- code cache
@@ -56,15 +57,19 @@ function skynet.register_protocol(class)
 end
 
 local session_id_coroutine = {}
-local session_coroutine_id = {}
-local session_coroutine_address = {}
-local session_coroutine_tracetag = {}
+-- The request (session, address and trace tag) served by a coroutine : co -> record.
+-- The record is created with the coroutine by co_create, and reused with it in the pool,
+-- so a request sets and clears the fields only.
+local coroutine_record = {}
 local unresponse = {}
 
 local wakeup_queue = {}
 local sleep_session = {}
 
 local watching_session = {}
+-- the calls timeout (skynet.calltimeout and skynet.callmulti), the core sends an error from address 0
+-- and drops the late response (see skynet_deadline in skynet_server.c)
+local expired_session = {}
 local error_queue = {}
 local fork_queue = { h = 1, t = 0 }
 
@@ -79,7 +84,8 @@ do ---- request/select
 			local addr = req[1]
 			local p = proto[req[2]]
 			assert(p.unpack)
-			local tag = session_coroutine_tracetag[running_thread]
+			local r = coroutine_record[running_thread]
+			local tag = r and r.tag
 			if tag then
 				c.trace(tag, "call", 4)
 				c.send(addr, skynet.PTYPE_TRACE, 0, tag)
@@ -209,13 +215,58 @@ end
 -- suspend is function
 local suspend
 
+----- callmulti
+
+-- A batch of skynet.callmulti : the requests use the sessions from base to base + n - 1.
+-- The caller waits in one suspension, the responses are collected into batch.results.
+
+-- drop the pending calls of the batch (killed), the late responses are ignored
+local function callmulti_drop(batch, reason)
+	local results = batch.results
+	for i = 1, batch.n do
+		if results[i] == nil then
+			local session = batch.base + i - 1
+			session_id_coroutine[session] = "BREAK"
+			watching_session[session] = nil
+			results[i] = { false, reason, n = 2 }
+		end
+	end
+	batch.pending = 0
+end
+
+-- returns true when all the calls of the batch are done
+local function callmulti_response(batch, session, succ, msg, sz)
+	local i = session - batch.base + 1
+	watching_session[session] = nil
+	if succ then
+		batch.results[i] = tpack(pcall(batch.unpack[i], msg, sz))
+	elseif expired_session[session] then
+		expired_session[session] = nil
+		batch.results[i] = { false, "timeout", n = 2 }
+	else
+		batch.results[i] = { false, "error", n = 2 }
+	end
+	local pending = batch.pending - 1
+	batch.pending = pending
+	return pending == 0
+end
+
 ----- monitor exit
 
-local function dispatch_error_queue()
+local dispatch_error_queue
+
+function dispatch_error_queue()
 	local session = tremove(error_queue,1)
 	if session then
+		-- the call is ended by the error, the core doesn't wait for its timeout any more
+		c.deadline(session)
 		local co = session_id_coroutine[session]
 		session_id_coroutine[session] = nil
+		local r = coroutine_record[co]
+		if r and r.batch and not callmulti_response(r.batch, session, false) then
+			-- the batch is waiting for the others
+			return dispatch_error_queue()
+		end
 		return suspend(co, coroutine_resume(co, false, nil, nil, session))
 	end
 end
@@ -237,56 +288,98 @@ local function _error_dispatch(error_session, error_source)
 	else
 		-- capture an error for error_session
 		if watching_session[error_session] then
+			if error_source == 0 then
+				expired_session[error_session] = true
+			end
 			tinsert(error_queue, error_session)
+		elseif error_source == 0 and session_id_coroutine[error_session] == "BREAK" then
+			-- the call is killed before timeout, the late response will be dropped by the core
+			session_id_coroutine[error_session] = nil
 		end
 	end
 end
 
 -- coroutine reuse
 
-local coroutine_pool = setmetatable({}, { __mode = "kv" })
+-- The pool keeps the idle coroutines (strong references) up to coroutine_pool_max,
+-- the coroutines above the high-water mark exit.
+local coroutine_pool = {}
+local coroutine_pool_max = 256
+local coroutine_count = 0	-- the coroutines alive with a record
+local coroutine_peak = 0
 
 local function co_create(f)
 	local co = tremove(coroutine_pool)
+	local r
 	if co == nil then
+		r = {}
 		co = coroutine_create(function(...)
 			f(...)
 			while true do
-				local session = session_coroutine_id[co]
+				local session = r.session
 				if session and session ~= 0 then
 					local source = debug.getinfo(f,"S")
 					skynet.error(string.format("Maybe forgot response session %s from %s : %s:%d",
 						session,
-						skynet.address(session_coroutine_address[co]),
+						skynet.address(r.address),
 						source.source, source.linedefined))
 				end
 				-- coroutine exit
-				local tag = session_coroutine_tracetag[co]
+				local tag = r.tag
 				if tag ~= nil then
 					if tag then c.trace(tag, "end")	end
-					session_coroutine_tracetag[co] = nil
-				end
-				local address = session_coroutine_address[co]
-				if address then
-					session_coroutine_id[co] = nil
-					session_coroutine_address[co] = nil
+					r.tag = nil
 				end
+				r.session = nil
+				r.address = nil
 
-				-- recycle co into pool
 				f = nil
+				if #coroutine_pool >= coroutine_pool_max then
+					-- the pool is full, exit
+					coroutine_record[co] = nil
+					coroutine_count = coroutine_count - 1
+					-- the dead coroutine returns "SUSPEND" to suspend() as the yield does
+					return "SUSPEND"
+				end
+				-- recycle co into pool
 				coroutine_pool[#coroutine_pool+1] = co
 				-- recv new main function f
 				f = coroutine_yield "SUSPEND"
 				f(coroutine_yield())
 			end
 		end)
+		coroutine_record[co] = r
+		coroutine_count = coroutine_count + 1
+		if coroutine_count > coroutine_peak then
+			coroutine_peak = coroutine_count
+		end
 	else
+		r = coroutine_record[co]
 		-- pass the main function f to coroutine, and restore running thread
 		local running = running_thread
 		coroutine_resume(co, f)
 		running_thread = running
 	end
-	return co
+	return co, r
+end
+
+-- the record of a coroutine not created by co_create (request thread) is created on demand
+local function co_record(co)
+	local r = coroutine_record[co]
+	if r == nil then
+		r = {}
+		coroutine_record[co] = r
+		coroutine_count = coroutine_count + 1
+	end
+	return r
+end
+
+-- remove the coroutine (closed or dropped) from the bookkeeping
+local function co_remove(co)
+	if coroutine_record[co] then
+		coroutine_record[co] = nil
+		coroutine_count = coroutine_count - 1
+	end
 end
 
 local function dispatch_wakeup()
@@ -296,8 +389,8 @@ local function dispatch_wakeup()
 			local session = sleep_session[token]
 			if session then
 				local co = session_id_coroutine[session]
-				local tag = session_coroutine_tracetag[co]
-				if tag then c.trace(tag, "resume") end
+				local r = coroutine_record[co]
+				if r and r.tag then c.trace(r.tag, "resume") end
 				session_id_coroutine[session] = "BREAK"
 				return suspend(co, coroutine_resume(co, false, "BREAK", nil, session))
 			end
@@ -311,19 +404,16 @@ end
 -- suspend is local function
 function suspend(co, result, command)
 	if not result then
-		local session = session_coroutine_id[co]
-		if session then -- coroutine may fork by others (session is nil)
-			local addr = session_coroutine_address[co]
-			if session ~= 0 then
+		local r = coroutine_record[co]
+		if r then
+			local session = r.session
+			if session and session ~= 0 then
 				-- only call response error
-				local tag = session_coroutine_tracetag[co]
-				if tag then c.trace(tag, "error") end
-				c.send(addr, skynet.PTYPE_ERROR, session, "")
+				if r.tag then c.trace(r.tag, "error") end
+				c.send(r.address, skynet.PTYPE_ERROR, session, "")
 			end
-			session_coroutine_id[co] = nil
+			co_remove(co)
 		end
-		session_coroutine_address[co] = nil
-		session_coroutine_tracetag[co] = nil
 		skynet.fork(function() end)	-- trigger command "SUSPEND"
 		local tb = traceback(co,tostring(command))
 		coroutine.close(co)
@@ -332,6 +422,7 @@ function suspend(co, result, command)
 	if command == "SUSPEND" then
 		return dispatch_wakeup()
 	elseif command == "QUIT" then
+		co_remove(co)
 		coroutine.close(co)
 		-- service exit
 		return
@@ -381,7 +472,8 @@ function skynet.timeout(ti, func)
 end
 
 local function suspend_sleep(session, token)
-	local tag = session_coroutine_tracetag[running_thread]
+	local r = coroutine_record[running_thread]
+	local tag = r and r.tag
 	if tag then c.trace(tag, "sleep", 2) end
 	session_id_coroutine[session] = running_thread
 	assert(sleep_session[token] == nil, "token duplicative")
@@ -436,6 +528,7 @@ function skynet.killthread(thread)
 				table.move(fork_queue, i+1, t, i)
 				fork_queue[t] = nil
 				fork_queue.t = t - 1
+				co_remove(thread)
 				return thread
 			end
 		end
@@ -450,12 +543,12 @@ function skynet.killthread(thread)
 	if co == nil then
 		return
 	end
-	local addr = session_coroutine_address[co]
-	if addr then
-		session_coroutine_address[co] = nil
-		session_coroutine_tracetag[co] = nil
-		c.send(addr, skynet.PTYPE_ERROR, session_coroutine_id[co], "")
-		session_coroutine_id[co] = nil
+	local r = coroutine_record[co]
+	if r then
+		if r.session and r.session ~= 0 then
+			c.send(r.address, skynet.PTYPE_ERROR, r.session, "")
+		end
+		co_remove(co)
 	end
 	if watching_session[session] then
 		session_id_coroutine[session] = "BREAK"
@@ -463,6 +556,10 @@ function skynet.killthread(thread)
 	else
 		session_id_coroutine[session] = nil
 	end
+	if r and r.batch then
+		-- the other sessions of skynet.callmulti
+		callmulti_drop(r.batch, "killed")
+	end
 	for k,v in pairs(sleep_session) do
 		if v == session then
 			sleep_session[k] = nil
@@ -486,15 +583,16 @@ skynet.hpc = c.hpc	-- high performance counter
 
 local traceid = 0
 function skynet.trace(info)
-	skynet.error("TRACE", session_coroutine_tracetag[running_thread])
-	if session_coroutine_tracetag[running_thread] == false then
+	local r = co_record(running_thread)
+	skynet.error("TRACE", r.tag)
+	if r.tag == false then
 		-- force off trace log
 		return
 	end
 	traceid = traceid + 1
 
 	local tag = string.format(":%08x-%d",skynet.self(), traceid)
-	session_coroutine_tracetag[running_thread] = tag
+	r.tag = tag
 	if info then
 		c.trace(tag, "trace " .. info)
 	else
@@ -503,7 +601,8 @@ function skynet.trace(info)
 end
 
 function skynet.tracetag()
-	return session_coroutine_tracetag[running_thread]
+	local r = coroutine_record[running_thread]
+	return r and r.tag
 end
 
 local starttime
@@ -523,10 +622,10 @@ function skynet.exit()
 	fork_queue = { h = 1, t = 0 }	-- no fork coroutine can be execute after skynet.exit
 	skynet.send(".launcher","lua","REMOVE",skynet.self(), false)
 	-- report the sources that call me
-	for co, session in pairs(session_coroutine_id) do
-		local address = session_coroutine_address[co]
-		if session~=0 and address then
-			c.send(address, skynet.PTYPE_ERROR, session, "")
+	for co, r in pairs(coroutine_record) do
+		local session = r.session
+		if session and session~=0 then
+			c.send(r.address, skynet.PTYPE_ERROR, session, "")
 		end
 	end
 	for session, co in pairs(session_id_coroutine) do
@@ -580,6 +679,7 @@ skynet.pack = assert(c.pack)
 skynet.packstring = assert(c.packstring)
 skynet.unpack = assert(c.unpack)
 skynet.tostring = assert(c.tostring)
+-- skynet.trash(msg, sz [, ptype]) releases the blobs in the message when ptype is packed by skynet.pack
 skynet.trash = assert(c.trash)
 
 local function yield_call(service, session)
@@ -588,13 +688,18 @@ local function yield_call(service, session)
 	local succ, msg, sz = coroutine_yield "SUSPEND"
 	watching_session[session] = nil
 	if not succ then
+		if expired_session[session] then
+			expired_session[session] = nil
+			error "call timeout"
+		end
 		error "call failed"
 	end
 	return msg,sz
 end
 
 function skynet.call(addr, typename, ...)
-	local tag = session_coroutine_tracetag[running_thread]
+	local r = coroutine_record[running_thread]
+	local tag = r and r.tag
 	if tag then
 		c.trace(tag, "call", 2)
 		c.send(addr, skynet.PTYPE_TRACE, 0, tag)
@@ -608,8 +713,28 @@ function skynet.call(addr, typename, ...)
 	return p.unpack(yield_call(addr, session))
 end
 
+-- skynet.call with a timeout (in 1/100 s) enforced by the core, raises the error "call timeout"
+-- when the response doesn't arrive in time, and the late response is dropped by the core.
+function skynet.calltimeout(ti, addr, typename, ...)
+	local r = coroutine_record[running_thread]
+	local tag = r and r.tag
+	if tag then
+		c.trace(tag, "call", 2)
+		c.send(addr, skynet.PTYPE_TRACE, 0, tag)
+	end
+
+	local p = proto[typename]
+	local session = c.send(addr, p.id , nil , p.pack(...))
+	if session == nil then
+		error("call to invalid address " .. skynet.address(addr))
+	end
+	c.deadline(session, ti)
+	return p.unpack(yield_call(addr, session))
+end
+
 function skynet.rawcall(addr, typename, msg, sz)
-	local tag = session_coroutine_tracetag[running_thread]
+	local r = coroutine_record[running_thread]
+	local tag = r and r.tag
 	if tag then
 		c.trace(tag, "call", 2)
 		c.send(addr, skynet.PTYPE_TRACE, 0, tag)
@@ -629,22 +754,80 @@ function skynet.tracecall(tag, addr, typename, msg, sz)
 	return msg, sz
 end
 
+-- Call many services with one suspension.
+-- requests is an array of { address, typename, ... } (the same as skynet.request),
+-- and the timeout (in 1/100 s, optional) applies to each call (enforced by the core as skynet.calltimeout).
+-- Returns an array of the results in the order of requests, the result of a call is
+-- { true, ... } (packed as table.pack) or { false, "error" | "timeout" }.
+function skynet.callmulti(requests, timeout)
+	local n = #requests
+	local results = {}
+	if n == 0 then
+		return results
+	end
+	local r = co_record(running_thread)
+	local tag = r.tag
+	local args = {}
+	local unpack = {}
+	for i = 1, n do
+		local req = requests[i]
+		local addr = req[1]
+		local p = proto[req[2]]
+		if tag then
+			c.trace(tag, "call", 2)
+			c.send(addr, skynet.PTYPE_TRACE, 0, tag)
+		end
+		local j = i * 4
+		args[j-3] = addr
+		args[j-2] = p.id
+		args[j-1], args[j] = p.pack(tunpack(req, 3, req.n))
+		unpack[i] = p.unpack
+	end
+	local failed = tpack(c.sendmulti(args, n, timeout))
+	local base = failed[1]
+	local batch = {
+		base = base,
+		n = n,
+		pending = n - (failed.n - 1),
+		unpack = unpack,
+		results = results,
+	}
+	for i = 2, failed.n do
+		-- invalid address
+		results[failed[i]] = { false, "error", n = 2 }
+	end
+	for i = 1, n do
+		if results[i] == nil then
+			local session = base + i - 1
+			session_id_coroutine[session] = running_thread
+			watching_session[session] = requests[i][1]
+		end
+	end
+	if batch.pending == 0 then
+		return results
+	end
+	r.batch = batch
+	coroutine_yield "SUSPEND"
+	r.batch = nil
+	return results
+end
+
 function skynet.ret(msg, sz)
 	msg = msg or ""
-	local tag = session_coroutine_tracetag[running_thread]
-	if tag then c.trace(tag, "response") end
-	local co_session = session_coroutine_id[running_thread]
+	local r = coroutine_record[running_thread]
+	local co_session = r and r.session
 	if co_session == nil then
 		error "No session"
 	end
-	session_coroutine_id[running_thread] = nil
+	if r.tag then c.trace(r.tag, "response") end
+	r.session = nil
 	if co_session == 0 then
 		if sz ~= nil then
-			c.trash(msg, sz)
+			c.trash(msg, sz, skynet.PTYPE_RESPONSE)
 		end
 		return false	-- send don't need ret
 	end
-	local co_address = session_coroutine_address[running_thread]
+	local co_address = r.address
 	local ret = c.send(co_address, skynet.PTYPE_RESPONSE, co_session, msg, sz)
 	if ret then
 		return true
@@ -656,22 +839,27 @@ function skynet.ret(msg, sz)
 end
 
 function skynet.context()
-	local co_session = session_coroutine_id[running_thread]
-	local co_address = session_coroutine_address[running_thread]
-	return co_session, co_address
+	local r = coroutine_record[running_thread]
+	if r then
+		return r.session, r.address
+	end
 end
 
 function skynet.ignoreret()
 	-- We use session for other uses
-	session_coroutine_id[running_thread] = nil
+	local r = coroutine_record[running_thread]
+	if r then
+		r.session = nil
+	end
 end
 
 function skynet.response(pack)
 	pack = pack or skynet.pack
 
-	local co_session = assert(session_coroutine_id[running_thread], "no session")
-	session_coroutine_id[running_thread] = nil
-	local co_address = session_coroutine_address[running_thread]
+	local r = coroutine_record[running_thread]
+	local co_session = assert(r and r.session, "no session")
+	r.session = nil
+	local co_address = r.address
 	if co_session == 0 then
 		--  do not response when session == 0 (send)
 		return function() end
@@ -768,6 +956,7 @@ function skynet.fork(func,...)
 end
 
 local trace_source = {}
+local gc_idle = require("skynet.gc").idle
 
 local function raw_dispatch_message(prototype, msg, sz, session, source)
 	-- skynet.PTYPE_RESPONSE = 1, read skynet.h
@@ -778,9 +967,14 @@ local function raw_dispatch_message(prototype, msg, sz, session, source)
 		elseif co == nil then
 			unknown_response(session, source, msg, sz)
 		else
-			local tag = session_coroutine_tracetag[co]
-			if tag then c.trace(tag, "resume") end
+			local r = coroutine_record[co]
 			session_id_coroutine[session] = nil
+			if r then
+				if r.batch and not callmulti_response(r.batch, session, true, msg, sz) then
+					return
+				end
+				if r.tag then c.trace(r.tag, "resume") end
+			end
 			suspend(co, coroutine_resume(co, true, msg, sz, session))
 		end
 	else
@@ -789,6 +983,9 @@ local function raw_dispatch_message(prototype, msg, sz, session, source)
 			if prototype == skynet.PTYPE_TRACE then
 				-- trace next request
 				trace_source[source] = c.tostring(msg,sz)
+			elseif prototype == skynet.PTYPE_IDLE then
+				-- a gc slice in the idle time of the workers
+				gc_idle()
 			elseif session ~= 0 then
 				c.send(source, skynet.PTYPE_ERROR, session, "")
 			else
@@ -799,20 +996,20 @@ local function raw_dispatch_message(prototype, msg, sz, session, source)
 
 		local f = p.dispatch
 		if f then
-			local co = co_create(f)
-			session_coroutine_id[co] = session
-			session_coroutine_address[co] = source
+			local co, r = co_create(f)
+			r.session = session
+			r.address = source
 			local traceflag = p.trace
 			if traceflag == false then
 				-- force off
 				trace_source[source] = nil
-				session_coroutine_tracetag[co] = false
+				r.tag = false
 			else
 				local tag = trace_source[source]
 				if tag then
 					trace_source[source] = nil
 					c.trace(tag, "request")
-					session_coroutine_tracetag[co] = tag
+					r.tag = tag
 				elseif traceflag then
 					-- set running_thread for trace
 					running_thread = co
@@ -961,7 +1158,19 @@ function skynet.mqlen()
 	return c.intcommand("STAT", "mqlen")
 end
 
+-- skynet.stat "gc" returns a table : the gc mode and metrics of the service (see skynet.gc in service_snlua.c)
+-- skynet.stat "coroutine" returns a table : the coroutines alive, the peak of them, and the pool
 function skynet.stat(what)
+	if what == "gc" then
+		return require("skynet.gc").stat()
+	elseif what == "coroutine" then
+		return {
+			count = coroutine_count,
+			peak = coroutine_peak,
+			pool = #coroutine_pool,
+			pool_max = coroutine_pool_max,
+		}
+	end
 	return c.intcommand("STAT", what)
 end
 
@@ -1044,6 +1253,23 @@ function skynet.term(service)
 	return _error_dispatch(0, service)
 end
 
+-- Set the high-water mark of the coroutine pool, returns the previous one.
+-- The idle coroutines above it exit.
+function skynet.coroutine_pool(max)
+	local prev = coroutine_pool_max
+	if max then
+		assert(max >= 0)
+		coroutine_pool_max = max
+		for i = #coroutine_pool, max + 1, -1 do
+			local co = coroutine_pool[i]
+			coroutine_pool[i] = nil
+			co_remove(co)
+			coroutine.close(co)
+		end
+	end
+	return prev
+end
+
 function skynet.memlimit(bytes)
 	debug.getregistry().memlimit = bytes
 	skynet.memlimit = nil	-- set only once
@@ -35,6 +35,15 @@ local function init(skynet, export)
 			gcing = false
 		end
 
+		function dbgcmd.GCSTAT()
+			skynet.ret(skynet.pack(skynet.stat "gc"))
+		end
+
+		function dbgcmd.GCTUNE(policy, heap)
+			local gc = require "skynet.gc"
+			skynet.ret(skynet.pack(gc.tune(policy, heap)))
+		end
+
 		function dbgcmd.STAT()
 			local stat = {}
 			stat.task = skynet.task()
@@ -71,7 +71,7 @@ function skynet.forward_type(map, start_func)
 			dispatch_message(prototype, msg, sz, ...)
 		else
 			local ok, err = pcall(dispatch_message, ptype, msg, sz, ...)
-			c.trash(msg, sz)
+			c.trash(msg, sz, ptype)
 			if not ok then
 				error(err)
 			end
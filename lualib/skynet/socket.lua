@@ -69,6 +69,17 @@ socket_message[1] = function(id, size, data)
 		return
 	end
 
+	if s.packet then
+		-- handed off by the gate, data contains complete packets
+		local packets, n = driver.packets(data, size, s.header)
+		skynet_core.trash(data, size)
+		local packet = s.packet
+		for i = 1, n do
+			packet(id, packets[i])
+		end
+		return
+	end
+
 	local sz = driver.push(s.buffer, s.pool, data, size)
 	local rr = s.read_required
 	local rrt = type(rr)
@@ -124,6 +135,11 @@ socket_message[3] = function(id)
 	local s = socket_pool[id]
 	if s then
 		s.connected = false
+		if s.packet then
+			-- the handed off connection is owned here, close it (the read side is closed by the peer)
+			socket_pool[id] = nil
+			driver.close(id)
+		end
 		wakeup(s)
 	else
 		driver.close(id)
@@ -163,6 +179,9 @@ socket_message[5] = function(id, _, err)
 		s.connecting = err
 	end
 	s.connected = false
+	if s.packet then
+		socket_pool[id] = nil
+	end
 	driver.shutdown(id)
 
 	wakeup(s)
@@ -181,6 +200,22 @@ socket_message[6] = function(id, size, data, address)
 	s.callback(str, address)
 end
 
+-- SKYNET_SOCKET_TYPE_UDP_BATCH = 8
+socket_message[8] = function(id, size, data)
+	local s = socket_pool[id]
+	if s == nil or s.callback == nil then
+		skynet.error("socket: drop udp packages from " .. id)
+		driver.drop(data, size)
+		return
+	end
+	local packages, n = driver.udp_batch(data, size)
+	skynet_core.trash(data, size)
+	local callback = s.callback
+	for i = 1, n*2, 2 do
+		callback(packages[i], packages[i+1])
+	end
+end
+
 local function default_warning(id, size)
 	local s = socket_pool[id]
 	if not s then
@@ -207,6 +242,16 @@ skynet.register_protocol {
 	end
 }
 
+-- buffer_node arena shared by all the socket buffers of this service
+local buffer_pool = driver.pool()
+
+-- the nodes left in the buffer of a removed socket go back to the arena
+local function free_buffer(s)
+	if s.buffer then
+		driver.clear(s.buffer, s.pool)
+	end
+end
+
 local function connect(id, func)
 	local newbuffer
 	if func == nil then
@@ -215,7 +260,7 @@ local function connect(id, func)
 	local s = {
 		id = id,
 		buffer = newbuffer,
-		pool = newbuffer and {},
+		pool = newbuffer and buffer_pool,
 		connected = false,
 		connecting = true,
 		read_required = false,
@@ -236,6 +281,7 @@ local function connect(id, func)
 		return id
 	else
 		socket_pool[id] = nil
+		free_buffer(s)
 		return nil, err
 	end
 end
@@ -254,11 +300,35 @@ function socket.stdin()
 	return socket.bind(0)
 end
 
-function socket.start(id, func)
-	driver.start(id)
+-- header (2 or 4, or "websocket"), byteorder ("big" or "little"), max : optional framing,
+-- then the socket thread only forwards complete length-prefixed packets (headers are kept)
+function socket.start(id, func, header, byteorder, max)
+	driver.start(id, header, byteorder, max)
 	return connect(id, func)
 end
 
+-- change the framing of a started socket, the data already read is not affected
+function socket.framing(id, header, byteorder, max)
+	assert(socket_pool[id], "socket is not started")
+	driver.start(id, header, byteorder, max)
+end
+
+-- Accept a connection handed off by the C gate ("handoff id agent"), call it before the gate hands off.
+-- The socket thread sends the packets (header 2 or 4, big-endian) to this service directly,
+-- func(id, packet) is called for each. The gate still gets close/error of the connection,
+-- and the connection is closed by this service then.
+function socket.handoff(id, func, header)
+	assert(socket_pool[id] == nil, "socket is not closed")
+	socket_pool[id] = {
+		id = id,
+		connected = true,
+		co = false,
+		packet = func,
+		header = header or 2,
+		protocol = "TCP",
+	}
+end
+
 function socket.pause(id)
 	local s = socket_pool[id]
 	if s == nil then
@@ -300,14 +370,15 @@ function socket.close(id)
 		s.connected = false
 	end
 	socket_pool[id] = nil
+	free_buffer(s)
 end
 
-function socket.read(id, sz)
+local function read(id, sz, pop, popall)
 	local s = socket_pool[id]
 	assert(s)
 	if sz == nil then
 		-- read some bytes
-		local ret = driver.readall(s.buffer, s.pool)
+		local ret = popall(s.buffer, s.pool)
 		if ret ~= "" then
 			return ret
 		end
@@ -318,7 +389,7 @@ function socket.read(id, sz)
 		assert(not s.read_required)
 		s.read_required = 0
 		suspend(s)
-		ret = driver.readall(s.buffer, s.pool)
+		ret = popall(s.buffer, s.pool)
 		if ret ~= "" then
 			return ret
 		else
@@ -326,7 +397,7 @@ function socket.read(id, sz)
 		end
 	end
 
-	local ret = driver.pop(s.buffer, s.pool, sz)
+	local ret = pop(s.buffer, s.pool, sz)
 	if ret then
 		return ret
 	end
@@ -337,7 +408,7 @@ function socket.read(id, sz)
 	assert(not s.read_required)
 	s.read_required = sz
 	suspend(s)
-	ret = driver.pop(s.buffer, s.pool, sz)
+	ret = pop(s.buffer, s.pool, sz)
 	if ret then
 		return ret
 	else
@@ -345,6 +416,20 @@ function socket.read(id, sz)
 	end
 end
 
+function socket.read(id, sz)
+	return read(id, sz, driver.pop, driver.readall)
+end
+
+local function viewall(buffer, pool)
+	return driver.popview(buffer, pool) or ""
+end
+
+-- the same as socket.read, but return a view refers to the received data without copy.
+-- view:sub(i, j), view:byte(i), view:find(str, init), view:ptr() (lightuserdata, size), #view, tostring(view)
+function socket.readview(id, sz)
+	return read(id, sz, driver.popview, viewall)
+end
+
 function socket.readall(id)
 	local s = socket_pool[id]
 	assert(s)
@@ -359,11 +444,11 @@ function socket.readall(id)
 	return driver.readall(s.buffer, s.pool)
 end
 
-function socket.readline(id, sep)
+local function readline(id, sep, view)
 	sep = sep or "\n"
 	local s = socket_pool[id]
 	assert(s)
-	local ret = driver.readline(s.buffer, s.pool, sep)
+	local ret = driver.readline(s.buffer, s.pool, sep, view)
 	if ret then
 		return ret
 	end
@@ -374,12 +459,21 @@ function socket.readline(id, sep)
 	s.read_required = sep
 	suspend(s)
 	if s.connected then
-		return driver.readline(s.buffer, s.pool, sep)
+		return driver.readline(s.buffer, s.pool, sep, view)
 	else
 		return false, driver.readall(s.buffer, s.pool)
 	end
 end
 
+function socket.readline(id, sep)
+	return readline(id, sep, false)
+end
+
+-- the same as socket.readline, but return a view
+function socket.readlineview(id, sep)
+	return readline(id, sep, true)
+end
+
 function socket.block(id)
 	local s = socket_pool[id]
 	if not s or not s.connected then
@@ -394,6 +488,18 @@ end
 socket.write = assert(driver.send)
 socket.lwrite = assert(driver.lsend)
 socket.header = assert(driver.header)
+-- socket.sharedbuffer(str) : an immutable buffer can be written to many sockets without copy
+socket.sharedbuffer = assert(driver.sharedbuffer)
+-- socket.broadcast({ id1, id2, ... }, str_or_sharedbuffer [, header]) : one request to the socket thread for all the sockets,
+-- header (2 or 4) prepends the big-endian size of data to each socket without copy. returns the number of sockets sent
+socket.broadcast = assert(driver.broadcast)
+-- socket.write_limit(id, bytes [, policy]) : policy is "notify", "drop" (low priority buffers) or "close" (default)
+socket.write_limit = assert(driver.write_limit)
+-- socket.write_limit_global(bytes [, policy]) : limit of all the write buffers, netstat() reports it as type "SERVER"
+socket.write_limit_global = assert(driver.write_limit_global)
+-- socket.coalesce(id [, usec]) : batch writes within usec microseconds, negative usec turn it off
+-- the resolution is 1 ms, usec is rounded up to whole milliseconds (0 flushes once per poll batch)
+socket.coalesce = assert(driver.coalesce)
 
 function socket.invalid(id)
 	return socket_pool[id] == nil
@@ -406,12 +512,13 @@ function socket.disconnected(id)
 	end
 end
 
-function socket.listen(host, port, backlog)
+-- reuseport : listen with SO_REUSEPORT, so several services (shards) can listen the same port
+function socket.listen(host, port, backlog, reuseport)
 	if port == nil then
 		host, port = string.match(host, "([^:]+):(.+)$")
 		port = tonumber(port)
 	end
-	local id = driver.listen(host, port, backlog)
+	local id = driver.listen(host, port, backlog, reuseport)
 	local s = {
 		id = id,
 		connected = false,
@@ -432,6 +539,12 @@ function socket.abandon(id)
 		wakeup(s)
 		socket_onclose[id] = nil
 		socket_pool[id] = nil
+		if s.co then
+			-- the reading coroutine is woken up, it reads the buffer before the clear
+			skynet.fork(free_buffer, s)
+		else
+			free_buffer(s)
+		end
 	end
 end
 
@@ -474,6 +587,27 @@ end
 socket.sendto = assert(driver.udp_send)
 socket.udp_address = assert(driver.udp_address)
 socket.netstat = assert(driver.info)
+
+-- the memory used by a connection : receive buffer in this service and write buffer in socket server
+function socket.info(id)
+	local info
+	for _, v in ipairs(driver.info()) do
+		if v.id == id then
+			info = v
+			break
+		end
+	end
+	local s = socket_pool[id]
+	if s == nil and info == nil then
+		return
+	end
+	info = info or { id = id }
+	if s and s.buffer then
+		info.rbuffer, info.rnodes, info.pool = driver.bufferinfo(s.buffer, s.pool)
+	end
+	info.memory = (info.rbuffer or 0) + (info.wbuffer or 0)
+	return info
+end
 socket.resolve = assert(driver.resolve)
 
 function socket.warning(id, callback)
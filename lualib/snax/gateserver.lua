@@ -10,6 +10,7 @@ local maxclient	-- max client
 local client_number = 0
 local CMD = setmetatable({}, { __gc = function() netpack.clear(queue) end })
 local nodelay = false
+local coalesce
 
 local connection = {}
 -- true : connected
@@ -18,10 +19,17 @@ local connection = {}
 
 function gateserver.openclient(fd)
 	if connection[fd] then
-		socketdriver.start(fd)
+		-- the socket thread splits the stream into complete packets (2 bytes big-endian header)
+		socketdriver.start(fd, 2)
 	end
 end
 
+-- send msg (string or socket.sharedbuffer) with 2 bytes header to all the fds by one socket request,
+-- the header is written separately, msg is not copied for each connection
+function gateserver.broadcast(fds, msg)
+	return socketdriver.broadcast(fds, msg, 2)
+end
+
 function gateserver.closeclient(fd)
 	local c = connection[fd]
 	if c ~= nil then
@@ -31,7 +39,7 @@ function gateserver.closeclient(fd)
 end
 
 function gateserver.start(handler)
-	assert(handler.message)
+	assert(handler.message or handler.batch)
 	assert(handler.connect)
 
 	local listen_context = {}
@@ -42,8 +50,9 @@ function gateserver.start(handler)
 		local port = assert(conf.port)
 		maxclient = conf.maxclient or 1024
 		nodelay = conf.nodelay
+		coalesce = conf.coalesce
 		skynet.error(string.format("Listen on %s:%d", address, port))
-		socket = socketdriver.listen(address, port)
+		socket = socketdriver.listen(address, port, conf.backlog, conf.reuseport)
 		listen_context.co = coroutine.running()
 		listen_context.fd = socket
 		skynet.wait(listen_context.co)
@@ -63,11 +72,36 @@ function gateserver.start(handler)
 
 	local MSG = {}
 
-	local function dispatch_msg(fd, msg, sz)
-		if connection[fd] then
-			handler.message(fd, msg, sz)
-		else
-			skynet.error(string.format("Drop message from fd (%d) : %s", fd, netpack.tostring(msg,sz)))
+	local dispatch_msg
+	local filter = netpack.filter
+
+	if handler.batch then
+		-- handler.batch(fd, packets, buffer) : packets is { msg1, sz1, msg2, sz2, ... } ,
+		-- msg points into buffer, don't free it, and keep buffer if the packets are used after return.
+		filter = netpack.filter_batch
+
+		function MSG.batch(fd, buffer, packets)
+			if connection[fd] then
+				handler.batch(fd, packets, buffer)
+			else
+				skynet.error(string.format("Drop %d messages from fd (%d)", #packets // 2, fd))
+			end
+		end
+
+		-- packets can't be split without copy (never happen when the socket started with framing)
+		function dispatch_msg(fd, msg, sz)
+			if connection[fd] then
+				handler.batch(fd, { msg, sz })
+			end
+			skynet.trash(msg, sz)
+		end
+	else
+		function dispatch_msg(fd, msg, sz)
+			if connection[fd] then
+				handler.message(fd, msg, sz)
+			else
+				skynet.error(string.format("Drop message from fd (%d) : %s", fd, netpack.tostring(msg,sz)))
+			end
 		end
 	end
 
@@ -98,6 +132,9 @@ function gateserver.start(handler)
 		if nodelay then
 			socketdriver.nodelay(fd)
 		end
+		if coalesce then
+			socketdriver.coalesce(fd, coalesce)
+		end
 		connection[fd] = true
 		handler.connect(fd, msg)
 	end
@@ -150,7 +187,7 @@ function gateserver.start(handler)
 		name = "socket",
 		id = skynet.PTYPE_SOCKET,	-- PTYPE_SOCKET = 6
 		unpack = function ( msg, sz )
-			return netpack.filter( queue, msg, sz)
+			return filter( queue, msg, sz)
 		end,
 		dispatch = function (_, _, q, type, ...)
 			queue = q
@@ -1,6 +1,5 @@
 #include "skynet.h"
 #include "skynet_socket.h"
-#include "databuffer.h"
 #include "hashid.h"
 
 #include <stdlib.h>
@@ -16,8 +15,8 @@ struct connection {
 	int id;	// skynet_socket id
 	uint32_t agent;
 	uint32_t client;
+	uint32_t shard;	// the shard owns this connection, only used by the master gate
 	char remote_name[32];
-	struct databuffer buffer;
 };
 
 struct gate {
@@ -30,8 +29,11 @@ struct gate {
 	int max_connection;
 	struct hashid hash;
 	struct connection *conn;
+	// 分片模式: master 不监听, 只路由控制命令; 每个 shard 以 SO_REUSEPORT 监听同一个端口
+	int shards;
+	uint32_t *shard;	// master : handles of the shards
+	uint32_t master;	// shard : handle of the master
 	// todo: save message pool ptr for release
-	struct messagepool mp;
 };
 
 struct gate *
@@ -46,6 +48,21 @@ void
 gate_release(struct gate *g) {
 	int i;
 	struct skynet_context *ctx = g->ctx;
+	if (g->shards) {
+		// the connections are owned by the shards, they close them when they exit
+		for (i=0;i<g->shards;i++) {
+			if (g->shard[i]) {
+				char addr[16];
+				snprintf(addr, sizeof(addr), ":%x", g->shard[i]);
+				skynet_command(ctx, "KILL", addr);
+			}
+		}
+		skynet_free(g->shard);
+		hashid_clear(&g->hash);
+		skynet_free(g->conn);
+		skynet_free(g);
+		return;
+	}
 	for (i=0;i<g->max_connection;i++) {
 		struct connection *c = &g->conn[i];
 		if (c->id >=0) {
@@ -55,7 +72,6 @@ gate_release(struct gate *g) {
 	if (g->listen_id >= 0) {
 		skynet_socket_close(ctx, g->listen_id);
 	}
-	messagepool_free(&g->mp);
 	hashid_clear(&g->hash);
 	skynet_free(g->conn);
 	skynet_free(g);
@@ -85,6 +101,85 @@ _forward_agent(struct gate * g, int fd, uint32_t agentaddr, uint32_t clientaddr)
 	}
 }
 
+static void
+_notify_master(struct gate * g, const char * cmd, int fd) {
+	if (g->master == 0) {
+		return;
+	}
+	char tmp[32];
+	int n = snprintf(tmp, sizeof(tmp), "%s %d", cmd, fd);
+	skynet_send(g->ctx, 0, g->master, PTYPE_TEXT, 0, tmp, n);
+}
+
+static int
+_is_shard(struct gate * g, uint32_t source) {
+	int i;
+	for (i=0;i<g->shards;i++) {
+		if (g->shard[i] == source)
+			return 1;
+	}
+	return 0;
+}
+
+// master gate : own/disown come from the shards, the other commands are routed to the shard owns the connection
+static void
+_route(struct gate * g, uint32_t source, const void * msg, int sz) {
+	struct skynet_context * ctx = g->ctx;
+	char tmp[sz+1];
+	memcpy(tmp, msg, sz);
+	tmp[sz] = '\0';
+	char * command = tmp;
+	int i;
+	if (sz == 0)
+		return;
+	for (i=0;i<sz;i++) {
+		if (command[i]==' ') {
+			break;
+		}
+	}
+	if (memcmp(command,"broker",i)==0 || memcmp(command,"close",i)==0) {
+		for (i=0;i<g->shards;i++) {
+			skynet_send(ctx, source, g->shard[i], PTYPE_TEXT, 0, (void *)msg, sz);
+		}
+		return;
+	}
+	int own = memcmp(command,"own",i)==0;
+	int disown = memcmp(command,"disown",i)==0;
+	int route = memcmp(command,"kick",i)==0 || memcmp(command,"forward",i)==0 || memcmp(command,"start",i)==0
+		|| memcmp(command,"handoff",i)==0;
+	if (!own && !disown && !route) {
+		skynet_error(ctx, "[gate] Unkown command : %s", command);
+		return;
+	}
+	_parm(tmp, sz, i);
+	int uid = strtol(command, NULL, 10);
+	if (route) {
+		int id = hashid_lookup(&g->hash, uid);
+		if (id >= 0) {
+			skynet_send(ctx, source, g->conn[id].shard, PTYPE_TEXT, 0, (void *)msg, sz);
+		}
+		return;
+	}
+	if (!_is_shard(g, source)) {
+		skynet_error(ctx, "[gate] Invalid shard %x", source);
+		return;
+	}
+	if (own) {
+		if (hashid_lookup(&g->hash, uid) < 0 && !hashid_full(&g->hash)) {
+			struct connection *c = &g->conn[hashid_insert(&g->hash, uid)];
+			c->id = uid;
+			c->shard = source;
+		}
+	} else {
+		int id = hashid_remove(&g->hash, uid);
+		if (id >= 0) {
+			struct connection *c = &g->conn[id];
+			memset(c, 0, sizeof(*c));
+			c->id = -1;
+		}
+	}
+}
+
 static void
 _ctrl(struct gate * g, const void * msg, int sz) {
 	struct skynet_context * ctx = g->ctx;
@@ -126,6 +221,23 @@ _ctrl(struct gate * g, const void * msg, int sz) {
 		_forward_agent(g, id, agent_handle, client_handle);
 		return;
 	}
+	if (memcmp(command,"handoff",i)==0) {
+		_parm(tmp, sz, i);
+		char * agent = tmp;
+		char * idstr = strsep(&agent, " ");
+		if (agent == NULL) {
+			return;
+		}
+		int uid = strtol(idstr , NULL, 10);
+		int id = hashid_lookup(&g->hash, uid);
+		if (id>=0) {
+			// the socket thread sends the packets to agent directly, gate only gets close/error
+			uint32_t agent_handle = strtoul(agent+1, NULL, 16);
+			g->conn[id].agent = agent_handle;
+			skynet_socket_handoff(ctx, uid, agent_handle, g->header_size);
+		}
+		return;
+	}
 	if (memcmp(command,"broker",i)==0) {
 		_parm(tmp, sz, i);
 		g->broker = skynet_queryname(ctx, command);
@@ -136,7 +248,8 @@ _ctrl(struct gate * g, const void * msg, int sz) {
 		int uid = strtol(command , NULL, 10);
 		int id = hashid_lookup(&g->hash, uid);
 		if (id>=0) {
-			skynet_socket_start(ctx, uid);
+			// the socket thread splits packets, messages over 16M close the connection
+			skynet_socket_start_framing(ctx, uid, g->header_size, 0, 0);
 		}
 		return;
 	}
@@ -165,8 +278,22 @@ _report(struct gate * g, const char * data, ...) {
 	skynet_send(ctx, 0, g->watchdog, PTYPE_TEXT,  0, tmp, n);
 }
 
+// the last packet of a socket message can reuse its buffer (*reuse), others are copied
+static void *
+_packet(const char * data, int size, void ** reuse) {
+	void * temp = *reuse;
+	if (temp) {
+		memmove(temp, data, size);
+		*reuse = NULL;
+	} else {
+		temp = skynet_malloc(size);
+		memcpy(temp, data, size);
+	}
+	return temp;
+}
+
 static void
-_forward(struct gate *g, struct connection * c, int size) {
+_forward(struct gate *g, struct connection * c, const char * data, int size, void ** reuse) {
 	struct skynet_context * ctx = g->ctx;
 	int fd = c->id;
 	if (fd <= 0) {
@@ -174,43 +301,49 @@ _forward(struct gate *g, struct connection * c, int size) {
 		return;
 	}
 	if (g->broker) {
-		void * temp = skynet_malloc(size);
-		databuffer_read(&c->buffer,&g->mp,(char *)temp, size);
+		void * temp = _packet(data, size, reuse);
 		skynet_send(ctx, 0, g->broker, g->client_tag | PTYPE_TAG_DONTCOPY, fd, temp, size);
 		return;
 	}
 	if (c->agent) {
-		void * temp = skynet_malloc(size);
-		databuffer_read(&c->buffer,&g->mp,(char *)temp, size);
+		void * temp = _packet(data, size, reuse);
 		skynet_send(ctx, c->client, c->agent, g->client_tag | PTYPE_TAG_DONTCOPY, fd , temp, size);
 	} else if (g->watchdog) {
 		char * tmp = skynet_malloc(size + 32);
 		int n = snprintf(tmp,32,"%d data ",c->id);
-		databuffer_read(&c->buffer,&g->mp,tmp+n,size);
+		memcpy(tmp+n,data,size);
 		skynet_send(ctx, 0, g->watchdog, PTYPE_TEXT | PTYPE_TAG_DONTCOPY, fd, tmp, size + n);
 	}
 }
 
+// connections are started with framing, so data contains only complete packets (big-endian header)
 static void
-dispatch_message(struct gate *g, struct connection *c, int id, void * data, int sz) {
-	databuffer_push(&c->buffer,&g->mp, data, sz);
-	for (;;) {
-		int size = databuffer_readheader(&c->buffer, &g->mp, g->header_size);
-		if (size < 0) {
-			return;
-		} else if (size > 0) {
-			if (size >= 0x1000000) {
-				struct skynet_context * ctx = g->ctx;
-				databuffer_clear(&c->buffer,&g->mp);
-				skynet_socket_close(ctx, id);
-				skynet_error(ctx, "Recv socket message > 16M");
-				return;
-			} else {
-				_forward(g, c, size);
-				databuffer_reset(&c->buffer);
-			}
+dispatch_message(struct gate *g, struct connection *c, void * data, int sz) {
+	const uint8_t * ptr = data;
+	int header = g->header_size;
+	void * reuse = NULL;
+	while (sz >= header) {
+		int size;
+		if (header == 2) {
+			size = ptr[0] << 8 | ptr[1];
+		} else {
+			size = ptr[0] << 24 | ptr[1] << 16 | ptr[2] << 8 | ptr[3];
+		}
+		ptr += header;
+		sz -= header;
+		assert(size <= sz);
+		if (size == sz) {
+			reuse = data;
+			data = NULL;
+		}
+		if (size > 0) {
+			_forward(g, c, (const char *)ptr, size, &reuse);
 		}
+		ptr += size;
+		sz -= size;
 	}
+	skynet_free(reuse);
+	skynet_free(data);
 }
 
 static void
@@ -221,7 +354,7 @@ dispatch_socket_message(struct gate *g, const struct skynet_socket_message * mes
 		int id = hashid_lookup(&g->hash, message->id);
 		if (id>=0) {
 			struct connection *c = &g->conn[id];
-			dispatch_message(g, c, message->id, message->buffer, message->ud);
+			dispatch_message(g, c, message->buffer, message->ud);
 		} else {
 			skynet_error(ctx, "Drop unknown connection %d message", message->id);
 			skynet_socket_close(ctx, message->id);
@@ -246,9 +379,9 @@ dispatch_socket_message(struct gate *g, const struct skynet_socket_message * mes
 		int id = hashid_remove(&g->hash, message->id);
 		if (id>=0) {
 			struct connection *c = &g->conn[id];
-			databuffer_clear(&c->buffer,&g->mp);
 			memset(c, 0, sizeof(*c));
 			c->id = -1;
+			_notify_master(g, "disown", message->id);
 			_report(g, "%d close", message->id);
 		}
 		break;
@@ -266,6 +399,8 @@ dispatch_socket_message(struct gate *g, const struct skynet_socket_message * mes
 			c->id = message->ud;
 			memcpy(c->remote_name, message+1, sz);
 			c->remote_name[sz] = '\0';
+			// master must know the owner before the watchdog sends any command of this connection
+			_notify_master(g, "own", c->id);
 			_report(g, "%d open %d %s:0",c->id, c->id, c->remote_name);
 			skynet_error(ctx, "socket open: %x", c->id);
 		}
@@ -281,7 +416,11 @@ _cb(struct skynet_context * ctx, void * ud, int type, int session, uint32_t sour
 	struct gate *g = ud;
 	switch(type) {
 	case PTYPE_TEXT:
-		_ctrl(g , msg , (int)sz);
+		if (g->shards) {
+			_route(g, source, msg, (int)sz);
+		} else {
+			_ctrl(g , msg , (int)sz);
+		}
 		break;
 	case PTYPE_CLIENT: {
 		if (sz <=4 ) {
@@ -332,7 +471,12 @@ start_listen(struct gate *g, char * listen_addr) {
 		portstr[0] = '\0';
 		host = listen_addr;
 	}
-	g->listen_id = skynet_socket_listen(ctx, host, port, BACKLOG);
+	if (g->master) {
+		// shards share the port, the kernel distributes the connections
+		g->listen_id = skynet_socket_listen_reuseport(ctx, host, port, BACKLOG);
+	} else {
+		g->listen_id = skynet_socket_listen(ctx, host, port, BACKLOG);
+	}
 	if (g->listen_id < 0) {
 		return 1;
 	}
@@ -340,6 +484,39 @@ start_listen(struct gate *g, char * listen_addr) {
 	return 0;
 }
 
+static int
+start_shards(struct gate *g, char header, const char * watchdog, const char * binding, int max) {
+	struct skynet_context * ctx = g->ctx;
+	char self[16];
+	char wd[16];
+	strcpy(self, skynet_command(ctx, "REG", NULL));
+	if (g->watchdog) {
+		// shards can't query the name of watchdog if it's a local name
+		snprintf(wd, sizeof(wd), ":%x", g->watchdog);
+		watchdog = wd;
+	}
+	int sz = strlen(watchdog) + strlen(binding) + 64;
+	char cmd[sz];
+	int i;
+	g->shard = skynet_malloc(g->shards * sizeof(uint32_t));
+	memset(g->shard, 0, g->shards * sizeof(uint32_t));
+	for (i=0;i<g->shards;i++) {
+		snprintf(cmd, sz, "gate %c %s %s %d %d %s", header, watchdog, binding, g->client_tag, max, self);
+		const char * addr = skynet_command(ctx, "LAUNCH", cmd);
+		if (addr == NULL) {
+			skynet_error(ctx, "Launch gate shard %d failed", i);
+			return 1;
+		}
+		g->shard[i] = strtoul(addr+1, NULL, 16);
+	}
+	return 0;
+}
+
+// parm : header watchdog binding client_tag max [shards]
+// With shards > 1, this gate becomes the master of shards listen the same port with SO_REUSEPORT,
+// the kernel doesn't balance them exactly, so each shard accepts up to max connections. The master routes the ctrl commands to the shard
+// owns the connection, so the watchdog and agents can use the master as a single gate.
+// (A shard is launched with the master address instead of shards.)
 int
 gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 	if (parm == NULL)
@@ -348,9 +525,10 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 	int sz = strlen(parm)+1;
 	char watchdog[sz];
 	char binding[sz];
+	char shard[sz];
 	int client_tag = 0;
 	char header;
-	int n = sscanf(parm, "%c %s %s %d %d", &header, watchdog, binding, &client_tag, &max);
+	int n = sscanf(parm, "%c %s %s %d %d %s", &header, watchdog, binding, &client_tag, &max, shard);
 	if (n<4) {
 		skynet_error(ctx, "Invalid gate parm %s",parm);
 		return 1;
@@ -379,6 +557,32 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 
 	g->ctx = ctx;
 
+	if (n >= 6) {
+		if (shard[0] == ':') {
+			g->master = strtoul(shard+1, NULL, 16);
+		} else {
+			int shards = strtol(shard, NULL, 10);
+			if (shards > 1) {
+				g->shards = shards;
+			}
+		}
+	}
+
+	if (g->shards) {
+		// master keeps the owner of every connection
+		hashid_init(&g->hash, max * g->shards);
+		g->max_connection = max * g->shards;
+		g->conn = skynet_malloc(g->max_connection * sizeof(struct connection));
+		memset(g->conn, 0, g->max_connection * sizeof(struct connection));
+		int i;
+		for (i=0;i<g->max_connection;i++) {
+			g->conn[i].id = -1;
+		}
+		g->client_tag = client_tag;
+		skynet_callback(ctx,g,_cb);
+		return start_shards(g, header, watchdog, binding, max);
+	}
+
 	hashid_init(&g->hash, max);
 	g->conn = skynet_malloc(max * sizeof(struct connection));
 	memset(g->conn, 0, max *sizeof(struct connection));
@@ -1,9 +1,11 @@
 #include "skynet.h"
 #include "atomic.h"
+#include "spinlock.h"
 
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
+#include "lstate.h"
 
 #include <assert.h>
 #include <string.h>
@@ -23,6 +25,85 @@
 
 #define MEMORY_WARNING_REPORT (1024 * 1024 * 32)
 
+/*
+	slab : the small blocks (<= SLAB_MAX) of a lua state are allocated from the pages owned by the service.
+	A service runs in one thread at a time, so there is no lock or atomic operation.
+	Lua always gives the size of the old block (osize), so the blocks have no header, and the page
+	is found by the alignment of address.
+ */
+
+#define SLAB_PAGE 4096
+#define SLAB_CHUNK 16	// pages are allocated by chunk, and a chunk is freed when all of its pages are empty
+#define SLAB_ALIGN 16
+#define SLAB_MAX 256
+#define SLAB_CLASS (SLAB_MAX / SLAB_ALIGN)
+#define SLAB_HEADER ((sizeof(struct slab_page) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1))
+
+struct slab_chunk {
+	struct slab_chunk * prev;
+	struct slab_chunk * next;
+	char * base;
+	int empty;
+};
+
+struct slab_page {
+	struct slab_page * prev;
+	struct slab_page * next;
+	struct slab_chunk * chunk;
+	void * freelist;
+	uint16_t inuse;
+	uint16_t carved;	// the blocks after carved are never used
+	uint16_t total;
+	uint16_t size;
+};
+
+struct slab {
+	struct slab_page * partial[SLAB_CLASS];	// the pages have free blocks
+	struct slab_page * empty;	// the empty pages of all the chunks
+	struct slab_chunk * chunks;
+	int empty_n;
+	size_t pages;
+};
+
+/*
+	gc tune : choose the gc mode and parameters by the metrics of the service.
+	The small services keep the generational mode, the major collections of a big heap are
+	stop-the-world, so the big services switch to the incremental mode, and the step size is
+	adjusted by the max time of the resumes (message handling includes the gc steps).
+	It runs after the resumes from the main thread, at most once per GC_TUNE_INTERVAL.
+ */
+
+#define GC_FIXED 0
+#define GC_AUTO 1
+
+#define GC_TUNE_INTERVAL 100	// 1s (in 1/100 sec)
+#define GC_INCREMENTAL_HEAP (64 * 1024 * 1024)	// switch to incremental mode above it
+#define GC_LATENCY_HIGH 0.01	// 10ms, smaller steps
+#define GC_LATENCY_LOW 0.002
+#define GC_STEPSIZE_MIN 10	// 1K
+#define GC_STEPSIZE_DEFAULT 13	// 8K, see LUAI_GCSTEPSIZE
+#define GC_IDLE_AHEAD 20	// run the idle steps when the collector is less than 1/20 heap away
+
+struct gc_tune {
+	int policy;
+	int mode;	// LUA_GCGEN or LUA_GCINC
+	int stepsize;
+	int switches;
+	size_t heap;	// the threshold of incremental mode
+	size_t alloc;	// total bytes allocated
+	size_t alloc_last;
+	double alloc_rate;	// bytes per second
+	double latency;	// max time of resume in current interval
+	double latency_last;
+	uint64_t last;
+	int depth;	// the depth of nested resumes, the outermost one handles a message
+	double idle_budget;	// max time of an idle slice, 0 : disabled
+	double idle_time;	// the gc time moved to idle slices
+	uint64_t idle_slices;
+	uint64_t idle_steps;
+	uint64_t idle_cycles;
+};
+
 struct snlua {
 	lua_State * L;
 	struct skynet_context * ctx;
@@ -31,6 +112,9 @@ struct snlua {
 	size_t mem_limit;
 	lua_State * activeL;
 	ATOM_INT trap;
+	int use_slab;
+	struct slab slab;
+	struct gc_tune gc;
 };
 
 // LUA_CACHELIB may defined in patched lua for shared proto
@@ -60,6 +144,108 @@ codecache(lua_State *L) {
 
 #endif
 
+/*
+	service template : the warm data of a service name, shared by all the snlua services.
+	The first instance of a service records the matched pattern of LUA_SERVICE and the files
+	of the modules it required (see loader.lua), so the next instances skip the searching
+	and load the shared protos from codecache directly.
+ */
+
+struct template_entry {
+	struct template_entry *next;
+	size_t sz;
+	char *data;		// after the name
+	char name[1];
+};
+
+struct service_template {
+	struct spinlock lock;	// zero is unlocked
+	struct template_entry *list;
+};
+
+static struct service_template TEMPLATE;
+
+static struct template_entry *
+template_find(const char *name) {
+	struct template_entry *e = TEMPLATE.list;
+	while (e && strcmp(e->name, name) != 0) {
+		e = e->next;
+	}
+	return e;
+}
+
+// nothing in the lock can raise an error, the bytes are copied out and pushed after the unlock
+static int
+ltemplate_get(lua_State *L) {
+	const char * name = luaL_checkstring(L, 1);
+	char * t = NULL;
+	size_t sz = 0;
+	SPIN_LOCK(&TEMPLATE)
+	struct template_entry *e = template_find(name);
+	if (e) {
+		sz = e->sz;
+		t = skynet_malloc(sz);
+		memcpy(t, e->data, sz);
+	}
+	SPIN_UNLOCK(&TEMPLATE)
+	if (t == NULL) {
+		lua_pushnil(L);
+		return 1;
+	}
+	lua_pushlstring(L, t, sz);	// may raise an error
+	skynet_free(t);
+	return 1;
+}
+
+static int
+ltemplate_set(lua_State *L) {
+	size_t namelen;
+	const char * name = luaL_checklstring(L, 1, &namelen);
+	size_t sz;
+	const char * t = luaL_checklstring(L, 2, &sz);
+	struct template_entry *e = skynet_malloc(sizeof(*e) + namelen + sz);
+	memcpy(e->name, name, namelen + 1);
+	e->data = e->name + namelen + 1;
+	memcpy(e->data, t, sz);
+	e->sz = sz;
+	SPIN_LOCK(&TEMPLATE)
+	// the first one wins
+	if (template_find(name) == NULL) {
+		e->next = TEMPLATE.list;
+		TEMPLATE.list = e;
+		e = NULL;
+	}
+	SPIN_UNLOCK(&TEMPLATE)
+	skynet_free(e);
+	return 0;
+}
+
+static int
+ltemplate_clear(lua_State *L) {
+	SPIN_LOCK(&TEMPLATE)
+	struct template_entry *e = TEMPLATE.list;
+	TEMPLATE.list = NULL;
+	SPIN_UNLOCK(&TEMPLATE)
+	while (e) {
+		struct template_entry *next = e->next;
+		skynet_free(e);
+		e = next;
+	}
+	return 0;
+}
+
+static int
+init_template(lua_State *L) {
+	luaL_Reg l[] = {
+		{ "get", ltemplate_get },
+		{ "set", ltemplate_set },
+		{ "clear", ltemplate_clear },
+		{ NULL, NULL },
+	};
+	luaL_newlib(L,l);
+	return 1;
+}
+
 static void
 signal_hook(lua_State *L, lua_Debug *ar) {
 	void *ud = NULL;
@@ -81,21 +267,224 @@ switchL(lua_State *L, struct snlua *l) {
 	}
 }
 
+static inline double
+monotonic_time() {
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+	return (double)ti.tv_sec + (double)ti.tv_nsec / NANOSEC;
+}
+
+static void
+gc_setmode(lua_State *L, struct gc_tune *gc, int mode) {
+	if (mode == LUA_GCINC) {
+		lua_gc(L, LUA_GCINC, 0, 0, gc->stepsize);
+	} else {
+		lua_gc(L, LUA_GCGEN, 0, 0);
+	}
+	if (gc->mode != mode) {
+		gc->mode = mode;
+		++gc->switches;
+	}
+}
+
+static void
+gc_tune(lua_State *L, struct snlua *l) {
+	struct gc_tune *gc = &l->gc;
+	uint64_t now = skynet_now();
+	if (now - gc->last < GC_TUNE_INTERVAL)
+		return;
+	double dt = (double)(now - gc->last) / 100;
+	gc->alloc_rate = (double)(gc->alloc - gc->alloc_last) / dt;
+	gc->alloc_last = gc->alloc;
+	gc->latency_last = gc->latency;
+	gc->latency = 0;
+	gc->last = now;
+	if (gc->policy != GC_AUTO)
+		return;
+	if (gc->mode == LUA_GCGEN) {
+		if (l->mem >= gc->heap) {
+			gc_setmode(L, gc, LUA_GCINC);
+		}
+		return;
+	}
+	if (l->mem < gc->heap / 2) {
+		// switch back (it runs a full collection, but the heap is small now)
+		gc->stepsize = GC_STEPSIZE_DEFAULT;
+		gc_setmode(L, gc, LUA_GCGEN);
+		return;
+	}
+	int stepsize = gc->stepsize;
+	if (gc->latency_last > GC_LATENCY_HIGH && stepsize > GC_STEPSIZE_MIN) {
+		--stepsize;
+	} else if (gc->latency_last < GC_LATENCY_LOW && stepsize < GC_STEPSIZE_DEFAULT) {
+		++stepsize;
+	}
+	if (stepsize != gc->stepsize) {
+		gc->stepsize = stepsize;
+		gc_setmode(L, gc, LUA_GCINC);
+	}
+}
+
+// the collector is running a cycle, or it would start soon (see luaC_step)
+static inline int
+gc_near(lua_State *L) {
+	global_State *g = G(L);
+	return g->GCdebt > -(l_mem)(gettotalbytes(g) / GC_IDLE_AHEAD);
+}
+
 static int
 lua_resumeX(lua_State *L, lua_State *from, int nargs, int *nresults) {
 	void *ud = NULL;
 	lua_getallocf(L, &ud);
 	struct snlua *l = (struct snlua *)ud;
+	int top = l->gc.depth++ == 0;
+	double start = top && l->gc.policy == GC_AUTO ? monotonic_time() : 0;
 	switchL(L, l);
 	int err = lua_resume(L, from, nargs, nresults);
+	--l->gc.depth;
 	if (ATOM_LOAD(&l->trap)) {
 		// wait for lua_sethook. (l->trap == -1)
 		while (ATOM_LOAD(&l->trap) >= 0) ;
 	}
 	switchL(from, l);
+	if (top) {
+		// the latency is measured only in auto policy, the allocation rate is always sampled
+		if (start > 0) {
+			double ti = monotonic_time() - start;
+			if (ti > l->gc.latency) {
+				l->gc.latency = ti;
+			}
+		}
+		gc_tune(from, l);
+		if (l->gc.idle_budget > 0 && l->gc.mode == LUA_GCINC && gc_near(from)) {
+			// do the gc work in the idle time of the workers, see lgc_idle
+			skynet_idle(l->ctx);
+		}
+	}
 	return err;
 }
 
+static const char *
+gc_modename(int mode) {
+	return mode == LUA_GCINC ? "incremental" : "generational";
+}
+
+static int
+lgc_stat(lua_State *L) {
+	void *ud = NULL;
+	lua_getallocf(L, &ud);
+	struct snlua *l = (struct snlua *)ud;
+	struct gc_tune *gc = &l->gc;
+	lua_createtable(L, 0, 9);
+	lua_pushstring(L, gc->policy == GC_AUTO ? "auto" : "fixed");
+	lua_setfield(L, -2, "policy");
+	lua_pushstring(L, gc_modename(gc->mode));
+	lua_setfield(L, -2, "mode");
+	lua_pushinteger(L, gc->stepsize);
+	lua_setfield(L, -2, "stepsize");
+	lua_pushinteger(L, gc->switches);
+	lua_setfield(L, -2, "switches");
+	lua_pushinteger(L, l->mem);
+	lua_setfield(L, -2, "mem");
+	lua_pushinteger(L, gc->heap);
+	lua_setfield(L, -2, "heap");
+	lua_pushinteger(L, gc->alloc);
+	lua_setfield(L, -2, "alloc");
+	lua_pushnumber(L, gc->alloc_rate);
+	lua_setfield(L, -2, "alloc_rate");
+	lua_pushnumber(L, gc->latency_last > gc->latency ? gc->latency_last : gc->latency);
+	lua_setfield(L, -2, "latency");
+	lua_pushnumber(L, gc->idle_budget);
+	lua_setfield(L, -2, "idle_budget");
+	lua_pushnumber(L, gc->idle_time);
+	lua_setfield(L, -2, "idle_time");
+	lua_pushinteger(L, gc->idle_slices);
+	lua_setfield(L, -2, "idle_slices");
+	lua_pushinteger(L, gc->idle_steps);
+	lua_setfield(L, -2, "idle_steps");
+	lua_pushinteger(L, gc->idle_cycles);
+	lua_setfield(L, -2, "idle_cycles");
+	return 1;
+}
+
+/*
+	Run a gc slice for the PTYPE_IDLE message (read skynet_context_idle in skynet_server.c),
+	the basic steps run until the collector is far from its next step, or the slice runs
+	out of the budget. The rest is left to the next idle message.
+	Only in incremental mode, a minor collection of generational mode can't be bounded.
+ */
+static int
+lgc_idle(lua_State *L) {
+	void *ud = NULL;
+	lua_getallocf(L, &ud);
+	struct snlua *l = (struct snlua *)ud;
+	struct gc_tune *gc = &l->gc;
+	if (gc->idle_budget <= 0 || gc->mode != LUA_GCINC || !lua_gc(L, LUA_GCISRUNNING))
+		return 0;
+	double start = monotonic_time();
+	double now = start;
+	int near;
+	while ((near = gc_near(L))) {
+		++gc->idle_steps;
+		if (lua_gc(L, LUA_GCSTEP, 0)) {
+			++gc->idle_cycles;
+		}
+		now = monotonic_time();
+		if (now - start >= gc->idle_budget)
+			break;
+	}
+	if (now > start) {
+		++gc->idle_slices;
+		gc->idle_time += now - start;
+	}
+	if (near && gc_near(L)) {
+		skynet_idle(l->ctx);
+	}
+	return 0;
+}
+
+/*
+	string policy : "auto", "generational" or "incremental" (fixed mode)
+	integer heap (optional) : the heap size to switch to incremental mode in auto policy
+
+	return the previous policy
+ */
+static int
+lgc_tune(lua_State *L) {
+	static const char * const opts[] = { "auto", "generational", "incremental", NULL };
+	int op = luaL_checkoption(L, 1, NULL, opts);
+	void *ud = NULL;
+	lua_getallocf(L, &ud);
+	struct snlua *l = (struct snlua *)ud;
+	struct gc_tune *gc = &l->gc;
+	lua_pushstring(L, gc->policy == GC_AUTO ? "auto" : gc_modename(gc->mode));
+	if (op == 0) {
+		gc->policy = GC_AUTO;
+		if (!lua_isnoneornil(L, 2)) {
+			gc->heap = (size_t)luaL_checkinteger(L, 2);
+		}
+		gc->last = skynet_now();
+		gc->alloc_last = gc->alloc;
+	} else {
+		gc->policy = GC_FIXED;
+		gc->stepsize = GC_STEPSIZE_DEFAULT;
+		gc_setmode(L, gc, op == 1 ? LUA_GCGEN : LUA_GCINC);
+	}
+	return 1;
+}
+
+static int
+init_gc(lua_State *L) {
+	luaL_Reg l[] = {
+		{ "stat", lgc_stat },
+		{ "tune", lgc_tune },
+		{ "idle", lgc_idle },
+		{ NULL, NULL },
+	};
+	luaL_newlib(L,l);
+	return 1;
+}
+
 static double
 get_time() {
 #if  !defined(__APPLE__)
@@ -403,8 +792,21 @@ init_cb(struct snlua *l, struct skynet_context *ctx, const char * args, size_t s
 	lua_setfield(L, LUA_REGISTRYINDEX, "skynet_context");
 	luaL_requiref(L, "skynet.codecache", codecache , 0);
 	lua_pop(L,1);
+	luaL_requiref(L, "skynet.template", init_template, 0);
+	lua_pop(L,1);
+	luaL_requiref(L, "skynet.gc", init_gc, 0);
+	lua_pop(L,1);
 
 	lua_gc(L, LUA_GCGEN, 0, 0);
+	l->gc.mode = LUA_GCGEN;
+	l->gc.stepsize = GC_STEPSIZE_DEFAULT;
+	l->gc.heap = GC_INCREMENTAL_HEAP;
+	l->gc.last = skynet_now();
+	if (strcmp(optstring(ctx, "lua_gc", "generational"), "auto") == 0) {
+		l->gc.policy = GC_AUTO;
+	}
+	// the budget of an idle gc slice in microseconds
+	l->gc.idle_budget = (double)strtol(optstring(ctx, "lua_gc_idle", "0"), NULL, 10) / 1000000;
 
 	const char *path = optstring(ctx, "lua_path","./lualib/?.lua;./lualib/?/init.lua");
 	lua_pushstring(L, path);
@@ -465,19 +867,184 @@ launch_cb(struct skynet_context * context, void *ud, int type, int session, uint
 	return 0;
 }
 
-int
-snlua_init(struct snlua *l, struct skynet_context *ctx, const char * args) {
-	int sz = strlen(args);
-	char * tmp = skynet_malloc(sz);
-	memcpy(tmp, args, sz);
-	skynet_callback(ctx, l , launch_cb);
-	const char * self = skynet_command(ctx, "REG", NULL);
-	uint32_t handle_id = strtoul(self+1, NULL, 16);
-	// it must be first message
-	skynet_send(ctx, 0, handle_id, PTYPE_TAG_DONTCOPY,0, tmp, sz);
+static inline void
+page_unlink(struct slab_page **head, struct slab_page *p) {
+	if (p->prev) {
+		p->prev->next = p->next;
+	} else {
+		*head = p->next;
+	}
+	if (p->next) {
+		p->next->prev = p->prev;
+	}
+	p->prev = p->next = NULL;
+}
+
+static inline void
+page_link(struct slab_page **head, struct slab_page *p) {
+	p->prev = NULL;
+	p->next = *head;
+	if (p->next) {
+		p->next->prev = p;
+	}
+	*head = p;
+}
+
+static int
+slab_newchunk(struct slab *s) {
+	struct slab_chunk *c = skynet_malloc(sizeof(*c));
+	if (c == NULL)
+		return 1;
+	// posix_memalign is portable, memalign is not declared on macosx (NOUSE_JEMALLOC)
+	void *base;
+	if (skynet_posix_memalign(&base, SLAB_PAGE, SLAB_PAGE * SLAB_CHUNK) != 0) {
+		skynet_free(c);
+		return 1;
+	}
+	c->base = base;
+	c->empty = SLAB_CHUNK;
+	c->prev = NULL;
+	c->next = s->chunks;
+	if (c->next) {
+		c->next->prev = c;
+	}
+	s->chunks = c;
+	int i;
+	for (i=0;i<SLAB_CHUNK;i++) {
+		struct slab_page *p = (struct slab_page *)(c->base + i * SLAB_PAGE);
+		p->chunk = c;
+		page_link(&s->empty, p);
+	}
+	s->empty_n += SLAB_CHUNK;
+	s->pages += SLAB_CHUNK;
 	return 0;
 }
 
+static void
+slab_freechunk(struct slab *s, struct slab_chunk *c) {
+	int i;
+	for (i=0;i<SLAB_CHUNK;i++) {
+		page_unlink(&s->empty, (struct slab_page *)(c->base + i * SLAB_PAGE));
+	}
+	s->empty_n -= SLAB_CHUNK;
+	s->pages -= SLAB_CHUNK;
+	if (c->prev) {
+		c->prev->next = c->next;
+	} else {
+		s->chunks = c->next;
+	}
+	if (c->next) {
+		c->next->prev = c->prev;
+	}
+	skynet_free(c->base);
+	skynet_free(c);
+}
+
+static struct slab_page *
+slab_newpage(struct slab *s, int cls) {
+	if (s->empty == NULL && slab_newchunk(s)) {
+		return NULL;
+	}
+	struct slab_page *p = s->empty;
+	page_unlink(&s->empty, p);
+	--s->empty_n;
+	--p->chunk->empty;
+	p->freelist = NULL;
+	p->inuse = 0;
+	p->carved = 0;
+	p->size = (cls + 1) * SLAB_ALIGN;
+	p->total = (SLAB_PAGE - SLAB_HEADER) / p->size;
+	page_link(&s->partial[cls], p);
+	return p;
+}
+
+static void *
+slab_alloc(struct slab *s, int cls) {
+	struct slab_page *p = s->partial[cls];
+	if (p == NULL) {
+		p = slab_newpage(s, cls);
+		if (p == NULL)
+			return NULL;
+	}
+	void *b = p->freelist;
+	if (b) {
+		p->freelist = *(void **)b;
+	} else {
+		b = (char *)p + SLAB_HEADER + p->carved * p->size;
+		++p->carved;
+	}
+	if (++p->inuse == p->total) {
+		// the full page leaves the partial list, it comes back when a block is freed
+		page_unlink(&s->partial[cls], p);
+	}
+	return b;
+}
+
+static void
+slab_free(struct slab *s, int cls, void *b) {
+	struct slab_page *p = (struct slab_page *)((uintptr_t)b & ~(uintptr_t)(SLAB_PAGE - 1));
+	if (p->inuse == p->total) {
+		page_link(&s->partial[cls], p);
+	}
+	*(void **)b = p->freelist;
+	p->freelist = b;
+	if (--p->inuse == 0) {
+		page_unlink(&s->partial[cls], p);
+		page_link(&s->empty, p);
+		++s->empty_n;
+		struct slab_chunk *c = p->chunk;
+		// keep a chunk of empty pages to avoid thrashing
+		if (++c->empty == SLAB_CHUNK && s->empty_n > SLAB_CHUNK) {
+			slab_freechunk(s, c);
+		}
+	}
+}
+
+static void
+slab_release(struct slab *s) {
+	while (s->chunks) {
+		struct slab_chunk *c = s->chunks;
+		s->chunks = c->next;
+		skynet_free(c->base);
+		skynet_free(c);
+	}
+	memset(s, 0, sizeof(*s));
+}
+
+#define SLAB_SIZECLASS(sz) ((int)(((sz) - 1) / SLAB_ALIGN))
+
+static void *
+slab_realloc(struct slab *s, void *ptr, size_t osize, size_t nsize) {
+	if (ptr == NULL) {
+		osize = 0;	// osize is the type of object
+	}
+	if (osize > SLAB_MAX && nsize > SLAB_MAX) {
+		return skynet_lalloc(ptr, osize, nsize);
+	}
+	if (nsize == 0) {
+		if (osize > SLAB_MAX) {
+			skynet_lalloc(ptr, osize, 0);
+		} else if (ptr) {
+			slab_free(s, SLAB_SIZECLASS(osize), ptr);
+		}
+		return NULL;
+	}
+	if (ptr && osize <= SLAB_MAX && nsize <= SLAB_MAX && SLAB_SIZECLASS(osize) == SLAB_SIZECLASS(nsize)) {
+		return ptr;
+	}
+	void *nptr = nsize <= SLAB_MAX ? slab_alloc(s, SLAB_SIZECLASS(nsize)) : skynet_lalloc(NULL, 0, nsize);
+	if (nptr == NULL || ptr == NULL) {
+		return nptr;
+	}
+	memcpy(nptr, ptr, osize < nsize ? osize : nsize);
+	if (osize > SLAB_MAX) {
+		skynet_lalloc(ptr, osize, 0);
+	} else {
+		slab_free(s, SLAB_SIZECLASS(osize), ptr);
+	}
+	return nptr;
+}
+
 static void *
 lalloc(void * ud, void *ptr, size_t osize, size_t nsize) {
 	struct snlua *l = ud;
@@ -485,6 +1052,8 @@ lalloc(void * ud, void *ptr, size_t osize, size_t nsize) {
 	l->mem += nsize;
 	if (ptr)
 		l->mem -= osize;
+	if (ptr == NULL || nsize > osize)
+		l->gc.alloc += ptr ? nsize - osize : nsize;
 	if (l->mem_limit != 0 && l->mem > l->mem_limit) {
 		if (ptr == NULL || nsize > osize) {
 			l->mem = mem;
@@ -495,16 +1064,38 @@ lalloc(void * ud, void *ptr, size_t osize, size_t nsize) {
 		l->mem_report *= 2;
 		skynet_error(l->ctx, "Memory warning %.2f M", (float)l->mem / (1024 * 1024));
 	}
+	if (l->use_slab) {
+		return slab_realloc(&l->slab, ptr, osize, nsize);
+	}
 	return skynet_lalloc(ptr, osize, nsize);
 }
 
+int
+snlua_init(struct snlua *l, struct skynet_context *ctx, const char * args) {
+	// the allocator must be chosen before the lua state is created
+	l->use_slab = strcmp(optstring(ctx, "lua_slab", "false"), "true") == 0;
+	l->L = lua_newstate(lalloc, l);
+	if (l->L == NULL) {
+		return 1;
+	}
+	int sz = strlen(args);
+	char * tmp = skynet_malloc(sz);
+	memcpy(tmp, args, sz);
+	skynet_callback(ctx, l , launch_cb);
+	const char * self = skynet_command(ctx, "REG", NULL);
+	uint32_t handle_id = strtoul(self+1, NULL, 16);
+	// it must be first message
+	skynet_send(ctx, 0, handle_id, PTYPE_TAG_DONTCOPY,0, tmp, sz);
+	return 0;
+}
+
 struct snlua *
 snlua_create(void) {
 	struct snlua * l = skynet_malloc(sizeof(*l));
 	memset(l,0,sizeof(*l));
 	l->mem_report = MEMORY_WARNING_REPORT;
 	l->mem_limit = 0;
-	l->L = lua_newstate(lalloc, l);
+	l->L = NULL;
 	l->activeL = NULL;
 	ATOM_INIT(&l->trap , 0);
 	return l;
@@ -512,7 +1103,12 @@ snlua_create(void) {
 
 void
 snlua_release(struct snlua *l) {
-	lua_close(l->L);
+	if (l->L) {
+		lua_close(l->L);
+	}
+	if (l->use_slab) {
+		slab_release(&l->slab);
+	}
 	skynet_free(l);
 }
 
@@ -530,5 +1126,8 @@ snlua_signal(struct snlua *l, int signal) {
 		}
 	} else if (signal == 1) {
 		skynet_error(l->ctx, "Current Memory %.3fK", (float)l->mem / 1024);
+		if (l->use_slab) {
+			skynet_error(l->ctx, "Slab pages %.3fK", (float)l->slab.pages * SLAB_PAGE / 1024);
+		}
 	}
 }
@@ -1,5 +1,6 @@
 local skynet = require "skynet"
 local codecache = require "skynet.codecache"
+local template = require "skynet.template"
 local core = require "skynet.core"
 local socket = require "skynet.socket"
 local snax = require "skynet.snax"
@@ -144,9 +145,11 @@ function COMMAND.help()
 		kill = "kill address : kill service",
 		mem = "mem : show memory status",
 		gc = "gc : force every lua service do garbage collect",
+		gcstat = "gcstat address : show gc mode and metrics of a lua service",
+		gctune = "gctune address auto|generational|incremental [heap] : set gc policy of a lua service",
 		start = "lanuch a new lua service",
 		snax = "lanuch a new snax service",
-		clearcache = "clear lua code cache",
+		clearcache = "clear lua code cache and service templates",
 		service = "List unique service",
 		task = "task address : show service task detail",
 		uniqtask = "task address : show service unique task detail",
@@ -171,6 +174,7 @@ end
 
 function COMMAND.clearcache()
 	codecache.clear()
+	template.clear()
 end
 
 function COMMAND.start(...)
@@ -295,6 +299,14 @@ function COMMAND.info(address, ...)
 	return COMMAND.dbgcmd(address, "INFO", ...)
 end
 
+function COMMAND.gcstat(address)
+	return COMMAND.dbgcmd(address, "GCSTAT")
+end
+
+function COMMAND.gctune(address, policy, heap)
+	return COMMAND.dbgcmd(address, "GCTUNE", policy, tonumber(heap))
+end
+
 function COMMANDX.debug(cmd)
 	local address = adjust_address(cmd[2])
 	local agent = skynet.newservice "debug_agent"
@@ -440,6 +452,11 @@ local function convert_stat(info)
 		return string.format("%s%d:%.2gs",hour == 0 and "" or (hour .. ":"),min,sec)
 	end
 
+	if info.type == "SERVER" then
+		info.wbuffer = bytes(info.wbuffer)
+		info.wlimit = bytes(info.wlimit)
+		return
+	end
 	info.address = skynet.address(info.address)
 	info.read = bytes(info.read)
 	info.write = bytes(info.write)
@@ -84,6 +84,17 @@ function CMD.accept(source, fd)
 	gateserver.openclient(fd)
 end
 
+-- agents send packets to many clients here, the gate queues them by one socket request
+function CMD.broadcast(source, fds, msg)
+	local list = {}
+	for _, fd in ipairs(fds) do
+		if connection[fd] then
+			table.insert(list, fd)
+		end
+	end
+	gateserver.broadcast(list, msg)
+end
+
 function CMD.kick(source, fd)
 	gateserver.closeclient(fd)
 end
@@ -20,6 +20,8 @@
 #define PTYPE_RESERVED_DEBUG 9
 #define PTYPE_RESERVED_LUA 10
 #define PTYPE_RESERVED_SNAX 11
+// read lualib/skynet.lua service-src/service_snlua.c
+#define PTYPE_IDLE 13
 
 #define PTYPE_TAG_DONTCOPY 0x10000
 #define PTYPE_TAG_ALLOCSESSION 0x20000
@@ -38,6 +40,14 @@ uint32_t skynet_queryname(struct skynet_context * context, const char * name);
 // 节点内发送服务消息
 int skynet_send(struct skynet_context * context, uint32_t source, uint32_t destination , int type, int session, void * msg, size_t sz);
 
+// 分配 n 个连续的 session 返回第一个 配合 skynet_send 指定 session 发送批量请求
+int skynet_newsessions(struct skynet_context * context, int n);
+
+// 给一个已发出的请求 (session) 设置超时 ti (1/100秒)
+// 到期还没有回应时 服务会收到 source 为 0 的 PTYPE_ERROR 消息 之后迟到的回应会被丢弃
+// ti 为负数时取消还在等待的超时 (调用已经因为其它错误结束)
+void skynet_deadline(struct skynet_context * context, int session, int ti);
+
 // 根据目标服务实例的名字发送服务消息
 int skynet_sendname(struct skynet_context * context, uint32_t source, const char * destination , int type, int session, void * msg, size_t sz);
 
@@ -56,6 +66,9 @@ uint32_t skynet_current_handle(void);
 // 获取当前进程启动到现在的时间差值
 uint64_t skynet_now(void);
 
+// 请求一次空闲通知 工作线程空闲时会给服务发送一条 PTYPE_IDLE 消息 (通知送达前重复请求只算一次)
+void skynet_idle(struct skynet_context * context);
+
 // 统计当前服务占用的内存
 void skynet_debug_memory(const char *info);	// for debug use, output current service memory to stderr
 
@@ -56,6 +56,8 @@ struct skynet_context {
 	bool init; // 标志服务是否初始化完毕
 	bool endless; // 标志服务是否出现死循环
 	bool profile;   // 是否开启性能分析
+	ATOM_INT idle;	// 已经请求了空闲通知 还没有送达
+	ATOM_POINTER deadline;	// struct deadline_set * 设置了超时的调用 (skynet_deadline) 第一次使用时创建 定时器线程也会读
 
 	CHECKCALLING_DECL
 };
@@ -70,6 +72,43 @@ struct skynet_node {
 
 static struct skynet_node G_NODE;
 
+// 请求了空闲通知的服务句柄 环形队列
+struct idle_queue {
+	struct spinlock lock;
+	int cap;
+	int head;
+	int n;
+	uint32_t *handle;
+};
+
+static struct idle_queue G_IDLE;
+
+// 调用超时表的状态
+#define DEADLINE_PENDING 1	// 等待回应
+#define DEADLINE_EXPIRED 2	// 已经超时 丢弃迟到的回应
+
+// 定时器事件 (见 skynet_timeout_deadline)
+#define DEADLINE_EXPIRE 1	// 调用超时
+#define DEADLINE_PURGE 2	// 清除超时的记录
+
+// 超时的记录保留的时间 (1/100秒) 之后迟到的回应不再丢弃
+#define DEADLINE_LATE 6000
+
+struct deadline_slot {
+	int session;	// 0 表示空位
+	int state;
+};
+
+// 设置了超时的调用 session -> 状态 开放地址的哈希表
+// 服务自己登记和消费回应 定时器线程检查超时 所以要加锁
+struct deadline_set {
+	struct spinlock lock;
+	int bits;	// 容量是 2^bits
+	int cap;
+	int n;
+	struct deadline_slot *slot;
+};
+
 // 获取节点总服务实例数量
 int 
 skynet_context_total() {
@@ -160,6 +199,8 @@ skynet_context_new(const char * name, const char *param) {
 
 	ctx->init = false;
 	ctx->endless = false;
+	ATOM_INIT(&ctx->idle, 0);
+	ATOM_INIT(&ctx->deadline, (uintptr_t)NULL);
 
 	ctx->cpu_cost = 0;
 	ctx->cpu_start = 0;
@@ -215,6 +256,19 @@ skynet_context_newsession(struct skynet_context *ctx) {
 	return session;
 }
 
+// 从服务实例内获取 n 个连续的 session_id 返回第一个 (批量请求 skynet.callmulti 使用)
+int
+skynet_newsessions(struct skynet_context *ctx, int n) {
+	assert(n > 0);
+	int session = ctx->session_id;
+	// 剩余的正数不够 n 个时 重新从1开始
+	if (session < 0 || session > 0x7fffffff - n) {
+		session = 0;
+	}
+	ctx->session_id = session + n;
+	return session + 1;
+}
+
 // 将服务实例的引用计数 + 1
 void 
 skynet_context_grab(struct skynet_context *ctx) {
@@ -244,6 +298,12 @@ delete_context(struct skynet_context *ctx) {
 	skynet_module_instance_release(ctx->mod, ctx->instance);
     // 标记服务实例消息队列可释放
 	skynet_mq_mark_release(ctx->queue);
+	struct deadline_set *ds = (struct deadline_set *)ATOM_LOAD(&ctx->deadline);
+	if (ds) {
+		spinlock_destroy(&ds->lock);
+		skynet_free(ds->slot);
+		skynet_free(ds);
+	}
 	CHECKCALLING_DESTROY(ctx)
     // 释放服务实例
 	skynet_free(ctx);
@@ -291,6 +351,226 @@ skynet_context_endless(uint32_t handle) {
 	skynet_context_release(ctx);
 }
 
+void
+skynet_idle(struct skynet_context * ctx) {
+	if (ATOM_LOAD(&ctx->idle) || !ATOM_CAS(&ctx->idle, 0, 1))
+		return;
+	struct idle_queue *q = &G_IDLE;
+	spinlock_lock(&q->lock);
+	if (q->n == q->cap) {
+		// 扩容 按顺序搬到新数组的开头
+		int cap = q->cap ? q->cap * 2 : 64;
+		uint32_t *handle = skynet_malloc(cap * sizeof(uint32_t));
+		int i;
+		for (i=0;i<q->n;i++) {
+			handle[i] = q->handle[(q->head + i) % q->cap];
+		}
+		skynet_free(q->handle);
+		q->handle = handle;
+		q->cap = cap;
+		q->head = 0;
+	}
+	q->handle[(q->head + q->n) % q->cap] = ctx->handle;
+	++q->n;
+	spinlock_unlock(&q->lock);
+}
+
+int
+skynet_context_idle(void) {
+	struct idle_queue *q = &G_IDLE;
+	spinlock_lock(&q->lock);
+	if (q->n == 0) {
+		spinlock_unlock(&q->lock);
+		return 0;
+	}
+	uint32_t handle = q->handle[q->head];
+	q->head = (q->head + 1) % q->cap;
+	--q->n;
+	spinlock_unlock(&q->lock);
+
+	struct skynet_context * ctx = skynet_handle_grab(handle);
+	if (ctx) {
+		// 先清除标记 处理消息时可以再次请求
+		ATOM_STORE(&ctx->idle, 0);
+		struct skynet_message msg;
+		msg.source = 0;
+		msg.session = 0;
+		msg.data = NULL;
+		msg.sz = (size_t)PTYPE_IDLE << MESSAGE_TYPE_SHIFT;
+		skynet_mq_push(ctx->queue, &msg);
+		skynet_context_release(ctx);
+	}
+	return 1;
+}
+
+// session 是连续分配的 用斐波那契哈希打散 否则连续的记录会连成一簇 查找和删除都要扫描整簇
+static inline int
+deadline_hash(struct deadline_set *ds, int session) {
+	return (int)(((uint32_t)session * 2654435769u) >> (32 - ds->bits));
+}
+
+static struct deadline_slot *
+deadline_find(struct deadline_set *ds, int session) {
+	int mask = ds->cap - 1;
+	int i = deadline_hash(ds, session);
+	for (;;) {
+		struct deadline_slot *slot = &ds->slot[i];
+		if (slot->session == session)
+			return slot;
+		if (slot->session == 0)
+			return NULL;
+		i = (i + 1) & mask;
+	}
+}
+
+static void
+deadline_insert(struct deadline_set *ds, int session, int state) {
+	if (ds->n * 2 >= ds->cap) {
+		// 扩容 重新插入所有的记录
+		struct deadline_slot *old = ds->slot;
+		int cap = ds->cap;
+		++ds->bits;
+		ds->cap = cap * 2;
+		ds->slot = skynet_malloc(ds->cap * sizeof(struct deadline_slot));
+		memset(ds->slot, 0, ds->cap * sizeof(struct deadline_slot));
+		ds->n = 0;
+		int i;
+		for (i=0;i<cap;i++) {
+			if (old[i].session) {
+				deadline_insert(ds, old[i].session, old[i].state);
+			}
+		}
+		skynet_free(old);
+	}
+	int mask = ds->cap - 1;
+	int i = deadline_hash(ds, session);
+	while (ds->slot[i].session != 0 && ds->slot[i].session != session) {
+		i = (i + 1) & mask;
+	}
+	if (ds->slot[i].session == 0) {
+		ds->slot[i].session = session;
+		++ds->n;
+	}
+	ds->slot[i].state = state;
+}
+
+// 删除后把后面同一簇的记录往前移 不需要墓碑
+static void
+deadline_remove(struct deadline_set *ds, struct deadline_slot *slot) {
+	int mask = ds->cap - 1;
+	int i = slot - ds->slot;
+	int j = i;
+	for (;;) {
+		j = (j + 1) & mask;
+		struct deadline_slot *next = &ds->slot[j];
+		if (next->session == 0)
+			break;
+		int k = deadline_hash(ds, next->session);
+		// k 不在 (i, j] 之间时 这条记录可以移到 i
+		if (i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+			ds->slot[i] = *next;
+			i = j;
+		}
+	}
+	ds->slot[i].session = 0;
+	--ds->n;
+}
+
+void
+skynet_deadline(struct skynet_context * ctx, int session, int ti) {
+	struct deadline_set *ds = (struct deadline_set *)ATOM_LOAD(&ctx->deadline);
+	if (ti < 0) {
+		// 调用已经因为其它错误结束了 (如被调用的服务退出) 删除等待中的记录 超时的记录要留着丢弃迟到的回应
+		if (ds) {
+			spinlock_lock(&ds->lock);
+			struct deadline_slot *slot = deadline_find(ds, session);
+			if (slot && slot->state == DEADLINE_PENDING) {
+				deadline_remove(ds, slot);
+			}
+			spinlock_unlock(&ds->lock);
+		}
+		return;
+	}
+	if (ds == NULL) {
+		ds = skynet_malloc(sizeof(*ds));
+		spinlock_init(&ds->lock);
+		ds->bits = 6;
+		ds->cap = 1 << ds->bits;
+		ds->n = 0;
+		ds->slot = skynet_malloc(ds->cap * sizeof(struct deadline_slot));
+		memset(ds->slot, 0, ds->cap * sizeof(struct deadline_slot));
+		// 初始化完成以后才发布 定时器线程可以看到
+		ATOM_STORE(&ctx->deadline, (uintptr_t)ds);
+	}
+	spinlock_lock(&ds->lock);
+	deadline_insert(ds, session, DEADLINE_PENDING);
+	spinlock_unlock(&ds->lock);
+	skynet_timeout_deadline(ctx->handle, ti, session, DEADLINE_EXPIRE);
+}
+
+void
+skynet_context_expire(uint32_t handle, int session, int event) {
+	struct skynet_context * ctx = skynet_handle_grab(handle);
+	if (ctx == NULL) {
+		return;
+	}
+	struct deadline_set *ds = (struct deadline_set *)ATOM_LOAD(&ctx->deadline);
+	if (ds == NULL) {
+		skynet_context_release(ctx);
+		return;
+	}
+	int expired = 0;
+	spinlock_lock(&ds->lock);
+	struct deadline_slot *slot = deadline_find(ds, session);
+	if (slot) {
+		if (event == DEADLINE_EXPIRE) {
+			// 已经回应的调用不在表里
+			if (slot->state == DEADLINE_PENDING) {
+				slot->state = DEADLINE_EXPIRED;
+				expired = 1;
+			}
+		} else if (slot->state == DEADLINE_EXPIRED) {
+			deadline_remove(ds, slot);
+		}
+	}
+	spinlock_unlock(&ds->lock);
+	if (expired) {
+		// source 为 0 的 PTYPE_ERROR 表示超时
+		struct skynet_message msg;
+		msg.source = 0;
+		msg.session = session;
+		msg.data = NULL;
+		msg.sz = (size_t)PTYPE_ERROR << MESSAGE_TYPE_SHIFT;
+		skynet_mq_push(ctx->queue, &msg);
+		skynet_timeout_deadline(handle, DEADLINE_LATE, session, DEADLINE_PURGE);
+	}
+	skynet_context_release(ctx);
+}
+
+// 回应到达时消费超时表 返回 1 表示是超时以后迟到的回应 丢弃
+static int
+deadline_filter(struct skynet_context *ctx, int type, struct skynet_message *msg) {
+	if (type != PTYPE_RESPONSE && type != PTYPE_ERROR)
+		return 0;
+	struct deadline_set *ds = (struct deadline_set *)ATOM_LOAD(&ctx->deadline);
+	if (ds == NULL)
+		return 0;
+	int drop = 0;
+	spinlock_lock(&ds->lock);
+	struct deadline_slot *slot = ds->n ? deadline_find(ds, msg->session) : NULL;
+	if (slot) {
+		if (slot->state == DEADLINE_PENDING) {
+			deadline_remove(ds, slot);
+		} else if (type != PTYPE_ERROR || msg->source != 0) {
+			// 超时通知之外的消息是迟到的回应
+			deadline_remove(ds, slot);
+			drop = 1;
+		}
+	}
+	spinlock_unlock(&ds->lock);
+	return drop;
+}
+
 // 判断目标服务句柄是不是远程节点的服务
 // 将harborID写回harbor字段
 int 
@@ -310,6 +590,11 @@ dispatch_message(struct skynet_context *ctx, struct skynet_message *msg) {
 	pthread_setspecific(G_NODE.handle_key, (void *)(uintptr_t)(ctx->handle));
 	int type = msg->sz >> MESSAGE_TYPE_SHIFT;
 	size_t sz = msg->sz & MESSAGE_TYPE_MASK;
+	if (deadline_filter(ctx, type, msg)) {
+		skynet_free(msg->data);
+		CHECKCALLING_END(ctx)
+		return;
+	}
     // 如果服务实例有单独的日志文件 打印消息日志
 	FILE *f = (FILE *)ATOM_LOAD(&ctx->logfile);
 	if (f) {
@@ -939,6 +1224,7 @@ skynet_globalinit(void) {
 	ATOM_INIT(&G_NODE.total , 0);
 	G_NODE.monitor_exit = 0;
 	G_NODE.init = 1;
+	spinlock_init(&G_IDLE.lock);
 
     // 该函数有两个参数，第一个参数就是声明的pthread_key_t变量，
     // 第二个参数是一个清理函数，用来在线程释放该线程存储的时候被调用。该函数指针可以设成NULL，这样系统将调用默认的清理函数。
@@ -955,6 +1241,8 @@ skynet_globalexit(void) {
     //注销一个TSD，这个函数并不检查当前是否有线程正使用该TSD，也不会调用清理函数（destr_function），
     // 而只是将TSD释放以供下一次调用pthread_key_create()使用。
 	pthread_key_delete(G_NODE.handle_key);
+	spinlock_destroy(&G_IDLE.lock);
+	skynet_free(G_IDLE.handle);
 }
 
 void
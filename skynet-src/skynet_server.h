@@ -41,6 +41,12 @@ int skynet_context_total();
 // 这个函数主要在启动的时候如果启动服务（bootstrap）创建失败 则将logger服务的消息都处理掉 保证日志能打印出来
 void skynet_context_dispatchall(struct skynet_context * context);	// for skynet_error output before exit
 
+// 工作线程空闲时调用 给一个请求了空闲通知的服务发送 PTYPE_IDLE 消息 没有请求时返回0
+int skynet_context_idle(void);
+
+// 定时器线程调用 处理服务实例调用超时的事件 (见 skynet_deadline)
+void skynet_context_expire(uint32_t handle, int session, int event);
+
 // 设置服务实例处于死循环
 void skynet_context_endless(uint32_t handle);	// for monitor
 
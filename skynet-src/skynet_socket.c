@@ -5,6 +5,7 @@
 #include "skynet_server.h"
 #include "skynet_mq.h"
 #include "skynet_harbor.h"
+#include "atomic.h"
 
 #include <assert.h>
 #include <stdlib.h>
@@ -13,9 +14,76 @@
 
 static struct socket_server * SOCKET_SERVER = NULL;
 
+struct skynet_socket_sharedbuffer {
+	ATOM_INT ref;
+	size_t sz;
+	char data[1];
+};
+
+struct skynet_socket_sharedbuffer *
+skynet_socket_sharedbuffer_new(const void *data, size_t sz) {
+	struct skynet_socket_sharedbuffer *sb = skynet_malloc(sizeof(*sb) + sz);
+	ATOM_INIT(&sb->ref, 1);
+	sb->sz = sz;
+	memcpy(sb->data, data, sz);
+	return sb;
+}
+
+struct skynet_socket_sharedbuffer *
+skynet_socket_sharedbuffer_grab(struct skynet_socket_sharedbuffer *sb) {
+	ATOM_FINC(&sb->ref);
+	return sb;
+}
+
+void
+skynet_socket_sharedbuffer_release(struct skynet_socket_sharedbuffer *sb) {
+	if (ATOM_FDEC(&sb->ref) == 1) {
+		skynet_free(sb);
+	}
+}
+
+size_t
+skynet_socket_sharedbuffer_size(struct skynet_socket_sharedbuffer *sb) {
+	return sb->sz;
+}
+
+int
+skynet_socket_multicast(struct skynet_context *ctx, struct skynet_socket_sharedbuffer *sb, int header, const int *ids, int n) {
+	if (n <= 0) {
+		return 0;
+	}
+	// one reference for each socket
+	ATOM_FADD(&sb->ref, n);
+	return socket_server_multicast(SOCKET_SERVER, sb, header, ids, n);
+}
+
+static const void *
+sharedbuffer_buffer(const void *object) {
+	const struct skynet_socket_sharedbuffer *sb = object;
+	return sb->data;
+}
+
+static size_t
+sharedbuffer_size(const void *object) {
+	const struct skynet_socket_sharedbuffer *sb = object;
+	return sb->sz;
+}
+
+static void
+sharedbuffer_free(void *object) {
+	skynet_socket_sharedbuffer_release(object);
+}
+
 void 
 skynet_socket_init() {
 	SOCKET_SERVER = socket_server_create(skynet_now());
+	// SOCKET_BUFFER_OBJECT is always a skynet_socket_sharedbuffer
+	struct socket_object_interface soi = {
+		sharedbuffer_buffer,
+		sharedbuffer_size,
+		sharedbuffer_free,
+	};
+	socket_server_userobject(SOCKET_SERVER, &soi);
 }
 
 void
@@ -75,6 +143,13 @@ forward_message(int type, bool padding, struct socket_message * result) {
 		skynet_free(sm->buffer);
 		skynet_free(sm);
 	}
+	if ((type == SKYNET_SOCKET_TYPE_CLOSE || type == SKYNET_SOCKET_TYPE_ERROR)
+		&& result->observer && result->observer != result->opaque) {
+		// the observer (gate after handoff) also needs close/error for bookkeeping
+		result->opaque = result->observer;
+		result->observer = 0;
+		forward_message(type, padding, result);
+	}
 }
 
 int 
@@ -105,6 +180,9 @@ skynet_socket_poll() {
 	case SOCKET_UDP:
 		forward_message(SKYNET_SOCKET_TYPE_UDP, false, &result);
 		break;
+	case SOCKET_UDP_BATCH:
+		forward_message(SKYNET_SOCKET_TYPE_UDP_BATCH, false, &result);
+		break;
 	case SOCKET_WARNING:
 		forward_message(SKYNET_SOCKET_TYPE_WARNING, false, &result);
 		break;
@@ -134,6 +212,12 @@ skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int
 	return socket_server_listen(SOCKET_SERVER, source, host, port, backlog);
 }
 
+int 
+skynet_socket_listen_reuseport(struct skynet_context *ctx, const char *host, int port, int backlog) {
+	uint32_t source = skynet_context_handle(ctx);
+	return socket_server_listen_reuseport(SOCKET_SERVER, source, host, port, backlog);
+}
+
 int 
 skynet_socket_connect(struct skynet_context *ctx, const char *host, int port) {
 	uint32_t source = skynet_context_handle(ctx);
@@ -164,6 +248,23 @@ skynet_socket_start(struct skynet_context *ctx, int id) {
 	socket_server_start(SOCKET_SERVER, source, id);
 }
 
+void
+skynet_socket_recycle(void *buffer, int sz) {
+	socket_server_recycle(SOCKET_SERVER, buffer, sz);
+}
+
+int
+skynet_socket_start_framing(struct skynet_context *ctx, int id, int header, int little, int max) {
+	uint32_t source = skynet_context_handle(ctx);
+	return socket_server_start_framing(SOCKET_SERVER, source, id, header, little, max);
+}
+
+int
+skynet_socket_handoff(struct skynet_context *ctx, int id, uint32_t agent, int header) {
+	uint32_t source = skynet_context_handle(ctx);
+	return socket_server_handoff(SOCKET_SERVER, agent, id, source, header);
+}
+
 void
 skynet_socket_pause(struct skynet_context *ctx, int id) {
 	uint32_t source = skynet_context_handle(ctx);
@@ -176,6 +277,11 @@ skynet_socket_nodelay(struct skynet_context *ctx, int id) {
 	socket_server_nodelay(SOCKET_SERVER, id);
 }
 
+void
+skynet_socket_coalesce(struct skynet_context *ctx, int id, int usec) {
+	socket_server_coalesce(SOCKET_SERVER, id, usec);
+}
+
 int 
 skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port) {
 	uint32_t source = skynet_context_handle(ctx);
@@ -205,6 +311,16 @@ skynet_socket_udp_address(struct skynet_socket_message *msg, int *addrsz) {
 	return (const char *)socket_server_udp_address(SOCKET_SERVER, &sm, addrsz);
 }
 
+void
+skynet_socket_limit(struct skynet_context *ctx, int id, int64_t limit, int policy) {
+	socket_server_limit(SOCKET_SERVER, id, limit, policy);
+}
+
+void
+skynet_socket_limit_global(int64_t limit, int policy) {
+	socket_server_limit_global(SOCKET_SERVER, limit, policy);
+}
+
 struct socket_info *
 skynet_socket_info() {
 	return socket_server_info(SOCKET_SERVER);
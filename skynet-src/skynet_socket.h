@@ -16,6 +16,8 @@ struct skynet_context;
 #define SKYNET_SOCKET_TYPE_ERROR 5
 #define SKYNET_SOCKET_TYPE_UDP 6
 #define SKYNET_SOCKET_TYPE_WARNING 7
+// buffer is a sequence of (uint16 size, data, address), ud is the total size
+#define SKYNET_SOCKET_TYPE_UDP_BATCH 8
 
 struct skynet_socket_message {
 	int type;
@@ -33,13 +35,25 @@ void skynet_socket_updatetime();
 int skynet_socket_sendbuffer(struct skynet_context *ctx, struct socket_sendbuffer *buffer);
 int skynet_socket_sendbuffer_lowpriority(struct skynet_context *ctx, struct socket_sendbuffer *buffer);
 int skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int backlog);
+int skynet_socket_listen_reuseport(struct skynet_context *ctx, const char *host, int port, int backlog);
 int skynet_socket_connect(struct skynet_context *ctx, const char *host, int port);
 int skynet_socket_bind(struct skynet_context *ctx, int fd);
 void skynet_socket_close(struct skynet_context *ctx, int id);
 void skynet_socket_shutdown(struct skynet_context *ctx, int id);
 void skynet_socket_start(struct skynet_context *ctx, int id);
+// SKYNET_SOCKET_TYPE_DATA of this socket always contains one or more complete packets (with their headers)
+// give the buffer of SKYNET_SOCKET_TYPE_DATA (sz is the bytes in it) back to the receive pool instead of skynet_free
+void skynet_socket_recycle(void *buffer, int sz);
+#define SKYNET_SOCKET_FRAME_WEBSOCKET 1
+int skynet_socket_start_framing(struct skynet_context *ctx, int id, int header, int little, int max);
+// start the socket framed for agent, ctx still gets SKYNET_SOCKET_TYPE_CLOSE/ERROR of it
+int skynet_socket_handoff(struct skynet_context *ctx, int id, uint32_t agent, int header);
 void skynet_socket_pause(struct skynet_context *ctx, int id);
 void skynet_socket_nodelay(struct skynet_context *ctx, int id);
+void skynet_socket_coalesce(struct skynet_context *ctx, int id, int usec);
+// policy : SOCKET_LIMIT_* in socket_server.h
+void skynet_socket_limit(struct skynet_context *ctx, int id, int64_t limit, int policy);
+void skynet_socket_limit_global(int64_t limit, int policy);
 
 int skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port);
 int skynet_socket_udp_connect(struct skynet_context *ctx, int id, const char * addr, int port);
@@ -48,6 +62,18 @@ const char * skynet_socket_udp_address(struct skynet_socket_message *, int *addr
 
 struct socket_info * skynet_socket_info();
 
+// refcounted immutable buffer, send it to many sockets as SOCKET_BUFFER_OBJECT without copy.
+// each send takes one reference, and the socket server releases it when the write is done.
+struct skynet_socket_sharedbuffer;
+
+struct skynet_socket_sharedbuffer * skynet_socket_sharedbuffer_new(const void *data, size_t sz);
+struct skynet_socket_sharedbuffer * skynet_socket_sharedbuffer_grab(struct skynet_socket_sharedbuffer *);
+void skynet_socket_sharedbuffer_release(struct skynet_socket_sharedbuffer *);
+size_t skynet_socket_sharedbuffer_size(struct skynet_socket_sharedbuffer *);
+// send sb to n sockets in one request, header (0, 2 or 4) is the size of big-endian length prefix.
+// returns the number of sockets queued, -1 for error
+int skynet_socket_multicast(struct skynet_context *ctx, struct skynet_socket_sharedbuffer *sb, int header, const int *ids, int n);
+
 // legacy APIs
 
 static inline void sendbuffer_init_(struct socket_sendbuffer *buf, int id, const void *buffer, int sz) {
@@ -176,6 +176,9 @@ thread_worker(void *p) {
 	while (!m->quit) {
 		q = skynet_context_message_dispatch(sm, q, weight);
 		if (q == NULL) {  // 全局队列是空的
+			// 先把空闲时间交给请求了空闲通知的服务 (如 lua 服务的增量 GC)
+			if (skynet_context_idle())
+				continue;
 			if (pthread_mutex_lock(&m->mutex) == 0) { // 获取 监控锁
 				++ m->sleep;
 				// "spurious wakeup" is harmless,
@@ -26,6 +26,7 @@ typedef void (*timer_execute_func)(void *ud,void *arg);
 struct timer_event {
 	uint32_t handle; // 定时器事件触发的服务实例句柄
 	int session;
+	int deadline;	// 0 : 普通定时器 否则是调用超时的事件 交给 skynet_context_expire 处理
 };
 
 // 链表的节点 节点内存储了过期时间
@@ -180,15 +181,20 @@ dispatch_list(struct timer_node *current) {
         // 拿出定时器事件对象（直接从node内存后面偏移获取）
 		struct timer_event * event = (struct timer_event *)(current+1);
 
-        // 构建定时器触发的消息
-		struct skynet_message message;
-		message.source = 0;
-		message.session = event->session;
-		message.data = NULL;
-		message.sz = (size_t)PTYPE_RESPONSE << MESSAGE_TYPE_SHIFT;
-
-        // 以消息的形式通知服务相应回调
-		skynet_context_push(event->handle, &message);
+		if (event->deadline) {
+			// 调用超时 由服务实例检查回应是否已经到达
+			skynet_context_expire(event->handle, event->session, event->deadline);
+		} else {
+			// 构建定时器触发的消息
+			struct skynet_message message;
+			message.source = 0;
+			message.session = event->session;
+			message.data = NULL;
+			message.sz = (size_t)PTYPE_RESPONSE << MESSAGE_TYPE_SHIFT;
+
+			// 以消息的形式通知服务相应回调
+			skynet_context_push(event->handle, &message);
+		}
 
 		struct timer_node * temp = current;
 		current=current->next;
@@ -276,12 +282,27 @@ skynet_timeout(uint32_t handle, int time, int session) {
 		struct timer_event event;
 		event.handle = handle;
 		event.session = session;
+		event.deadline = 0;
 		timer_add(TI, &event, sizeof(event), time);
 	}
 
 	return session;
 }
 
+// 添加调用超时的定时器 到期时调用 skynet_context_expire
+void
+skynet_timeout_deadline(uint32_t handle, int time, int session, int deadline) {
+	if (time <= 0) {
+		skynet_context_expire(handle, session, deadline);
+	} else {
+		struct timer_event event;
+		event.handle = handle;
+		event.session = session;
+		event.deadline = deadline;
+		timer_add(TI, &event, sizeof(event), time);
+	}
+}
+
 // centisecond: 1/100 second
 static void
 systime(uint32_t *sec, uint32_t *cs) {
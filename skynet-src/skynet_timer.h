@@ -16,6 +16,12 @@
  * */
 int skynet_timeout(uint32_t handle, int time, int session);
 
+/*
+ * 添加调用超时的定时器 (见 skynet_deadline)
+ * 参数 deadline ： 超时的事件 到期时交给 skynet_context_expire 处理
+ * */
+void skynet_timeout_deadline(uint32_t handle, int time, int session, int deadline);
+
 /*
  * 定时器tick驱动相应接口
  * */
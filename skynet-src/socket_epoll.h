@@ -81,9 +81,9 @@ sp_enable(int efd, int sock, void *ud, bool read_enable, bool write_enable) {
     return 0;
 }
 
-// 获取可相应的网络事件
+// 获取可相应的网络事件 timeout单位为毫秒 -1表示一直等待
 static int
-sp_wait(int efd, struct event *e, int max) {
+sp_wait(int efd, struct event *e, int max, int timeout) {
     struct epoll_event ev[max];
     /*
      * epoll_wait是Linux中epoll机制的一个系统调用，用于等待文件描述符上的事件发生。
@@ -96,7 +96,7 @@ sp_wait(int efd, struct event *e, int max) {
      * epoll_wait系统调用返回一个整数，表示发生事件的文件描述符数量。在epoll_event结构体数组中，
      * 可以通过events[i].data.fd获取文件描述符，通过events[i].events获取事件类型和相关的标志。
      * */
-    int n = epoll_wait(efd, ev, max, -1);
+    int n = epoll_wait(efd, ev, max, timeout);
     int i;
     for (i = 0; i < n; i++) {
         e[i].s = ev[i].data.ptr;
@@ -7,6 +7,7 @@
 #define SOCKET_INFO_UDP 3
 #define SOCKET_INFO_BIND 4
 #define SOCKET_INFO_CLOSING 5
+#define SOCKET_INFO_SERVER 6	// summary of all sockets : wbuffer is the total bytes of write buffers
 
 #include <stdint.h>
 
@@ -19,6 +20,7 @@ struct socket_info {
 	uint64_t rtime;
 	uint64_t wtime;
 	int64_t wbuffer;
+	int64_t wlimit;
 	uint8_t reading;
 	uint8_t writing;
 	char name[128];
@@ -97,11 +97,17 @@ sp_enable(int kfd, int sock, void *ud, bool read_enable, bool write_enable) {
 
 // 获取可相应的网络事件
 static int
-sp_wait(int kfd, struct event *e, int max) {
+sp_wait(int kfd, struct event *e, int max, int timeout) {
     struct kevent ev[max];
+    struct timespec ts, *pts = NULL;
+    if (timeout >= 0) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000;
+        pts = &ts;
+    }
     // 相应事件
     // ev 返回的是触发的事件队列， max是触发的事件数量
-    int n = kevent(kfd, NULL, 0, ev, max, NULL);
+    int n = kevent(kfd, NULL, 0, ev, max, pts);
 
     int i;
     // 遍历返回的可相应事件
@@ -1,12 +1,19 @@
+#ifdef __linux__
+// for recvmmsg/sendmmsg
+#define _GNU_SOURCE
+#endif
+
 #include "skynet.h"
 
 #include "socket_server.h"
 #include "socket_poll.h"
 #include "atomic.h"
 #include "spinlock.h"
+#include "websocket_mask.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/tcp.h>
 #include <unistd.h>
 #include <errno.h>
@@ -16,6 +23,7 @@
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <time.h>
 
 #define MAX_INFO 128
 // MAX_SOCKET will be 2^MAX_SOCKET_P
@@ -50,6 +58,14 @@
 
 #define MAX_UDP_PACKAGE 65535
 
+#ifdef __linux__
+// read/write at most UDP_BATCH datagrams by one recvmmsg/sendmmsg
+#define USE_MMSG
+#define UDP_BATCH 16
+#endif
+
+#define ACCEPT_BATCH 64	// max connections accepted per listen event before polling others
+
 // EAGAIN and EWOULDBLOCK may be not the same value.
 #if (EAGAIN != EWOULDBLOCK)
 #define AGAIN_WOULDBLOCK EAGAIN : case EWOULDBLOCK
@@ -58,6 +74,16 @@
 #endif
 
 #define WARNING_SIZE (1024*1024)
+#define FRAME_MAX_DEFAULT 0xffffff	// default max packet size of 4 bytes header and websocket
+#define FRAME_HEAD_MAX 14	// websocket : 2 + 8 (payload length) + 4 (masking key)
+
+#define RECV_POOL_CLASS 11	// read buffer size MIN_READ_BUFFER << [0, 10] : 64 bytes ~ 64K
+#define RECV_POOL_SIZE 64	// max buffers kept in each class
+
+// max buffers gathered into one writev
+#define MAX_IOVEC 64
+#define COALESCE_DISABLE (-1)
+#define COALESCE_MAX 1000000000	// usec
 
 #define USEROBJECT ((size_t)(-1))
 
@@ -70,6 +96,9 @@ struct write_buffer {
 	char *ptr;  // ？？？
 	size_t sz;
 	bool userobject;
+	uint8_t head_sz;	// multicast : framing header written before buffer (scatter-gather)
+	uint8_t head_off;
+	uint8_t head[4];
 };
 
 struct write_buffer_udp {
@@ -85,6 +114,21 @@ struct wb_list {
 	struct write_buffer * tail; // 尾指针
 };
 
+/*
+ * 分包模式下未收完整的包
+ * 包头未收完时暂存在head里, 包头收完后按包长分配pack (包含包头)
+ * */
+struct socket_frame {
+	uint8_t header;	// 0 : no framing, 2 or 4 bytes length header, or SOCKET_FRAME_WEBSOCKET
+	bool little;	// byte order of header
+	uint8_t head_n;
+	uint8_t head[FRAME_HEAD_MAX];
+	int max;	// max packet size (not include header)
+	char * pack;
+	int need;	// header + packet size
+	int read;
+};
+
 struct socket_stat {
 	uint64_t rtime;
 	uint64_t wtime;
@@ -97,6 +141,7 @@ struct socket_stat {
  * */
 struct socket {
 	uintptr_t opaque;  // 用来存储用户透传的数据 一般是服务的句柄ID
+	uintptr_t observer;	// handoff 以后原来的服务仍然收到 close/error 消息
 	struct wb_list high;    // 高优先级的写缓冲队列
 	struct wb_list low;     // 低优先级的写缓冲队列
 	int64_t wb_size;
@@ -111,6 +156,13 @@ struct socket {
 	bool closing;
 	ATOM_INT udpconnecting;
 	int64_t warn_size;
+	int64_t wb_limit;	// 0 : no limit of this socket
+	uint8_t wb_policy;
+	bool wb_overflow;	// SOCKET_WARNING raised for wb_limit, raise again after drained
+	int coalesce_window;	// usec, COALESCE_DISABLE for direct write
+	bool coalesce_pending;
+	struct wb_list coalesce;	// buffers appended by worker threads, guarded by dw_lock
+	struct socket_frame frame;
 	union {
 		int size;
 		uint8_t udp_address[UDP_ADDRESS_SIZE];
@@ -125,6 +177,24 @@ struct socket {
     //********************************
 };
 
+/*
+ * 开启合并发送的socket 等待socket线程flush的记录
+ * */
+struct coalesce_flush {
+	int id;
+	uint64_t deadline;	// usec
+};
+
+/*
+ * 读缓冲池 : 服务读完数据后把缓冲还回来, socket线程下次read直接复用, 省掉一对跨线程的malloc/free
+ * 按2的幂分级, 只有确定容量不小于级别大小的缓冲才会放进对应级别
+ * */
+struct recv_pool {
+	struct spinlock lock;
+	int n[RECV_POOL_CLASS];
+	void * buffer[RECV_POOL_CLASS][RECV_POOL_SIZE];
+};
+
 struct socket_server {
 	volatile uint64_t time;
 	int reserve_fd;	// for EMFILE
@@ -135,11 +205,21 @@ struct socket_server {
 	ATOM_INT alloc_id;     // 自增id
 	int event_n;        // 当前可处理的事件数量
 	int event_index;    // 当前已处理的事件数量
+	int accept_n;       // 当前监听事件上已连续accept的连接数
 	struct socket_object_interface soi;
 	struct event ev[MAX_EVENT];     // 可相应的事件列表
 	struct socket slot[MAX_SOCKET];     // socket 数据槽
+	struct coalesce_flush *flush;	// 待flush的合并发送socket
+	int flush_n;
+	int flush_cap;
+	int64_t wb_total;	// 所有socket写缓冲队列的字节数
+	int64_t wb_limit;	// 全局写缓冲上限 0表示不限制
+	int wb_policy;
 	char buffer[MAX_INFO];
 	uint8_t udpbuffer[MAX_UDP_PACKAGE];
+	uint8_t *udpbatch;	// UDP_BATCH * MAX_UDP_PACKAGE bytes for recvmmsg, alloc at first use
+	struct recv_pool rpool;
+	struct multicast *multicast;	// multicast in progress, finish it before other requests
 	fd_set rfds;
 };
 
@@ -191,10 +271,21 @@ struct request_bind {
 	uintptr_t opaque;
 };
 
+// 设置写缓冲上限 管道消息请求包
+struct request_limit {
+	int id;
+	int policy;
+	int64_t limit;
+};
+
 // 控制可读事件开关 管道消息请求包
 struct request_resumepause {
 	int id;
 	uintptr_t opaque;
+	uintptr_t observer;	// start only, also gets close/error of the socket
+	uint8_t header;	// start only, 0 : keep the framing mode
+	uint8_t little;
+	int max;
 };
 
 // 设置tcp参数 管道消息请求包
@@ -204,6 +295,20 @@ struct request_setopt {
 	int value;
 };
 
+// 一个请求把同一个userobject发给多个socket, 每个socket持有一个引用, 包头单独存放不拷贝数据
+struct multicast {
+	const void * object;
+	int header;	// 0, 2 or 4 bytes big-endian size before object
+	uint8_t head[4];
+	int n;
+	int i;	// next socket to send, a multicast may be interrupted by a result (error/warning)
+	int id[1];
+};
+
+struct request_multicast {
+	struct multicast *m;
+};
+
 struct request_udp {
 	int id;
 	int fd;
@@ -224,9 +329,13 @@ struct request_udp {
 	P Send package (low)
 	A Send UDP package
 	T Set opt
+	M Set write buffer limit
+	Q Set global write buffer limit
+	G Set coalesce window
+	F Flush coalesced buffers
+	N Multicast a userobject to many sockets
 	U Create UDP socket
 	C set udp address
-	Q query info
  */
 
 /*
@@ -246,6 +355,8 @@ struct request_package {
 		struct request_setopt setopt;
 		struct request_udp udp;
 		struct request_setudp set_udp;
+		struct request_limit limit;
+		struct request_multicast multicast;
 	} u;
 	uint8_t dummy[256];
 };
@@ -351,6 +462,13 @@ send_object_init_from_sendbuffer(struct socket_server *ss, struct send_object *s
 	}
 }
 
+// 所有wb_size的增减都经过这里 同时维护全局计数
+static inline void
+wb_size_add(struct socket_server *ss, struct socket *s, int64_t sz) {
+	s->wb_size += sz;
+	ss->wb_total += sz;
+}
+
 static inline void
 write_buffer_free(struct socket_server *ss, struct write_buffer *wb) {
 	if (wb->userobject) {
@@ -450,11 +568,24 @@ socket_server_create(uint64_t time) {
 		ATOM_INIT(&s->type, SOCKET_TYPE_INVALID);
 		clear_wb_list(&s->high);
 		clear_wb_list(&s->low);
+		clear_wb_list(&s->coalesce);
+		s->coalesce_window = COALESCE_DISABLE;
 		spinlock_init(&s->dw_lock);
 	}
+	ss->flush = NULL;
+	ss->flush_n = 0;
+	ss->multicast = NULL;
+	ss->flush_cap = 0;
+	ss->udpbatch = NULL;
+	ss->wb_total = 0;
+	ss->wb_limit = 0;
+	ss->wb_policy = SOCKET_LIMIT_CLOSE;
+	spinlock_init(&ss->rpool.lock);
+	memset(ss->rpool.n, 0, sizeof(ss->rpool.n));
 	ATOM_INIT(&ss->alloc_id , 0);
 	ss->event_n = 0;    // poll出来的事件数量
 	ss->event_index = 0;    // 当前已处理的数量
+	ss->accept_n = 0;
 	memset(&ss->soi, 0, sizeof(ss->soi));
 	FD_ZERO(&ss->rfds);
 	assert(ss->recvctrl_fd < FD_SETSIZE);
@@ -522,6 +653,7 @@ force_close(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 	result->ud = 0;
 	result->data = NULL;
 	result->opaque = s->opaque;
+	result->observer = s->observer;
 	uint8_t type = ATOM_LOAD(&s->type);
 	if (type == SOCKET_TYPE_INVALID) {
 		return;
@@ -529,6 +661,7 @@ force_close(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 	assert(type != SOCKET_TYPE_RESERVE);
 	free_wb_list(ss,&s->high);
 	free_wb_list(ss,&s->low);
+	wb_size_add(ss, s, -s->wb_size);
 	sp_del(ss->event_fd, s->fd);
 	socket_lock(l);
 	if (type != SOCKET_TYPE_BIND) {
@@ -537,6 +670,10 @@ force_close(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 		}
 	}
 	ATOM_STORE(&s->type, SOCKET_TYPE_INVALID);
+	free_wb_list(ss,&s->coalesce);
+	s->coalesce_window = COALESCE_DISABLE;
+	FREE(s->frame.pack);
+	memset(&s->frame, 0, sizeof(s->frame));
 	if (s->dw_buffer) {
 		struct socket_sendbuffer tmp;
 		tmp.buffer = s->dw_buffer;
@@ -568,6 +705,22 @@ socket_server_release(struct socket_server *ss) {
 	sp_release(ss->event_fd);  // 释放IO文件描述符
 	if (ss->reserve_fd >= 0)
 		close(ss->reserve_fd);
+	FREE(ss->flush);
+	FREE(ss->udpbatch);
+	if (ss->multicast) {
+		struct multicast *m = ss->multicast;
+		for (;m->i < m->n; m->i++) {
+			ss->soi.free((void *)m->object);
+		}
+		FREE(m);
+	}
+	for (i=0;i<RECV_POOL_CLASS;i++) {
+		int j;
+		for (j=0;j<ss->rpool.n[i];j++) {
+			FREE(ss->rpool.buffer[i][j]);
+		}
+	}
+	spinlock_destroy(&ss->rpool.lock);
 	FREE(ss);
 }
 
@@ -621,10 +774,18 @@ new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque,
 	s->protocol = protocol;
 	s->p.size = MIN_READ_BUFFER;
 	s->opaque = opaque;
+	s->observer = 0;
 	s->wb_size = 0;
 	s->warn_size = 0;
+	s->wb_limit = 0;
+	s->wb_policy = SOCKET_LIMIT_CLOSE;
+	s->wb_overflow = false;
+	s->coalesce_window = COALESCE_DISABLE;
+	s->coalesce_pending = false;
+	memset(&s->frame, 0, sizeof(s->frame));
 	check_wb_list(&s->high);
 	check_wb_list(&s->low);
+	check_wb_list(&s->coalesce);
 	s->dw_buffer = NULL;
 	s->dw_size = 0;
 	memset(&s->stat, 0, sizeof(s->stat));
@@ -779,10 +940,27 @@ close_write(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
  * */
 static int
 send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
+	struct iovec iov[MAX_IOVEC];
 	while (list->head) { // 遍历链表
+		// gather the head buffers, send them by one writev
 		struct write_buffer * tmp = list->head;
+		int n = 0;
+		int nb = 0;
+		while (tmp && n + 2 <= MAX_IOVEC) {
+			if (tmp->head_off < tmp->head_sz) {
+				iov[n].iov_base = tmp->head + tmp->head_off;
+				iov[n].iov_len = tmp->head_sz - tmp->head_off;
+				++n;
+			}
+			iov[n].iov_base = tmp->ptr;
+			iov[n].iov_len = tmp->sz;
+			++n;
+			++nb;
+			tmp = tmp->next;
+		}
+		ssize_t sz;
 		for (;;) {
-			ssize_t sz = write(s->fd, tmp->ptr, tmp->sz);
+			sz = (n == 1) ? write(s->fd, iov[0].iov_base, iov[0].iov_len) : writev(s->fd, iov, n);
 			if (sz < 0) { // 写数据失败
 				switch(errno) {
 				case EINTR:
@@ -792,17 +970,29 @@ send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list,
 				}
 				return close_write(ss, s, l, result);
 			}
-			stat_write(ss,s,(int)sz); // 统计socket写数据数量
-			s->wb_size -= sz;
-			if (sz != tmp->sz) {
-				tmp->ptr += sz;
-				tmp->sz -= sz;
+			break;
+		}
+		stat_write(ss,s,(int)sz); // 统计socket写数据数量
+		wb_size_add(ss, s, -sz);
+		int i;
+		for (i=0;i<nb;i++) {
+			tmp = list->head;
+			size_t head = tmp->head_sz - tmp->head_off;
+			if ((size_t)sz < head + tmp->sz) {
+				if ((size_t)sz < head) {
+					tmp->head_off += sz;
+				} else {
+					tmp->head_off = tmp->head_sz;
+					sz -= head;
+					tmp->ptr += sz;
+					tmp->sz -= sz;
+				}
 				return -1;
 			}
-			break;
+			sz -= head + tmp->sz;
+			list->head = tmp->next; // 指向下个链表节点
+			write_buffer_free(ss,tmp); // 释放掉已写成功的buffer节点
 		}
-		list->head = tmp->next; // 指向下个链表节点
-		write_buffer_free(ss,tmp); // 释放掉已写成功的buffer节点
 	}
 	list->tail = NULL;
 
@@ -835,13 +1025,77 @@ udp_socket_address(struct socket *s, const uint8_t udp_address[UDP_ADDRESS_SIZE]
 
 static void
 drop_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct write_buffer *tmp) {
-	s->wb_size -= tmp->sz;
+	wb_size_add(ss, s, -(int64_t)tmp->sz);
 	list->head = tmp->next;
 	if (list->head == NULL)
 		list->tail = NULL;
 	write_buffer_free(ss,tmp);
 }
 
+#ifdef USE_MMSG
+
+/*
+ * 用sendmmsg批量发送写缓冲队列的udp数据
+ * */
+static int
+send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_message *result) {
+	struct mmsghdr msgs[UDP_BATCH];
+	struct iovec iov[UDP_BATCH];
+	union sockaddr_all sa[UDP_BATCH];
+	while (list->head) {
+		struct write_buffer * tmp = list->head;
+		int n = 0;
+		while (tmp && n < UDP_BATCH) {
+			struct write_buffer_udp * udp = (struct write_buffer_udp *)tmp;
+			socklen_t sasz = udp_socket_address(s, udp->udp_address, &sa[n]);
+			if (sasz == 0)
+				break;
+			iov[n].iov_base = tmp->ptr;
+			iov[n].iov_len = tmp->sz;
+			memset(&msgs[n].msg_hdr, 0, sizeof(msgs[n].msg_hdr));
+			msgs[n].msg_hdr.msg_name = &sa[n];
+			msgs[n].msg_hdr.msg_namelen = sasz;
+			msgs[n].msg_hdr.msg_iov = &iov[n];
+			msgs[n].msg_hdr.msg_iovlen = 1;
+			++n;
+			tmp = tmp->next;
+		}
+		if (n == 0) {
+			skynet_error(NULL, "socket-server : udp (%d) type mismatch.", s->id);
+			drop_udp(ss, s, list, list->head);
+			return -1;
+		}
+		int r = sendmmsg(s->fd, msgs, n, 0);
+		if (r < 0) {
+			switch(errno) {
+			case EINTR:
+			case AGAIN_WOULDBLOCK:
+				return -1;
+			}
+			skynet_error(NULL, "socket-server : udp (%d) sendmmsg error %s.",s->id, strerror(errno));
+			drop_udp(ss, s, list, list->head);
+			return -1;
+		}
+		int i;
+		for (i=0;i<r;i++) {
+			tmp = list->head;
+			stat_write(ss,s,tmp->sz);
+			wb_size_add(ss, s, -(int64_t)tmp->sz);
+			list->head = tmp->next;
+			write_buffer_free(ss,tmp);
+		}
+		if (r < n) {
+			// the rest (or the error of the next one) will be reported next time
+			return -1;
+		}
+	}
+	list->tail = NULL;
+
+	return -1;
+}
+
+#else
+
 static int
 send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_message *result) {
 	while (list->head) {
@@ -866,7 +1120,7 @@ send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list,
 			return -1;
 		}
 		stat_write(ss,s,tmp->sz);
-		s->wb_size -= tmp->sz;
+		wb_size_add(ss, s, -(int64_t)tmp->sz);
 		list->head = tmp->next;
 		write_buffer_free(ss,tmp);
 	}
@@ -875,6 +1129,8 @@ send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list,
 	return -1;
 }
 
+#endif
+
 /*
  * 发送写缓冲队列的数据
  * */
@@ -896,7 +1152,7 @@ list_uncomplete(struct wb_list *s) {
 	if (wb == NULL)
 		return 0;
 	
-	return (void *)wb->ptr != wb->buffer;
+	return (void *)wb->ptr != wb->buffer || wb->head_off != 0;
 }
 
 /*
@@ -980,8 +1236,9 @@ send_buffer_(struct socket_server *ss, struct socket *s, struct socket_lock *l,
 			return report_error(s, result, "disable write failed");
 		}
 
-		if(s->warn_size > 0){
+		if(s->warn_size > 0 || s->wb_overflow){
 			s->warn_size = 0;
+			s->wb_overflow = false;
 			result->opaque = s->opaque;
 			result->id = s->id;
 			result->ud = 0;
@@ -998,11 +1255,12 @@ send_buffer_(struct socket_server *ss, struct socket *s, struct socket_lock *l,
  * 1. 先看看dw_buffer缓存区是否有数据，如果有则把数据移到高优先级缓冲队列来
  * 2.依优先级高低发送高低优先缓冲队列的数据
  * */
-static int
-send_buffer(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
-	if (!socket_trylock(l))
-		return -1;	// blocked by direct write, send later.
-	if (s->dw_buffer) {  // 1. 缓冲区内有数据待写 将数据移到high缓冲队列里面去
+/*
+ * 把直接写剩下的数据(dw_buffer)移到high缓冲队列头部 计入写缓冲 需要持有socket锁
+ * */
+static void
+merge_dw_buffer(struct socket_server *ss, struct socket *s) {
+	if (s->dw_buffer) {
 		// add direct write buffer before high.head
 		struct write_buffer * buf = MALLOC(sizeof(*buf));
 		struct send_object so;
@@ -1010,7 +1268,8 @@ send_buffer(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 		buf->ptr = (char*)so.buffer+s->dw_offset;
 		buf->sz = so.sz - s->dw_offset;
 		buf->buffer = (void *)s->dw_buffer;
-		s->wb_size+=buf->sz;
+		buf->head_sz = buf->head_off = 0;
+		wb_size_add(ss, s, buf->sz);
         // 将buf插入高优先级缓冲队列
 		if (s->high.head == NULL) {
 			s->high.head = s->high.tail = buf;
@@ -1021,6 +1280,14 @@ send_buffer(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 		}
 		s->dw_buffer = NULL;
 	}
+}
+
+static int
+send_buffer(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
+	if (!socket_trylock(l))
+		return -1;	// blocked by direct write, send later.
+    // 1. 缓冲区内有数据待写 将数据移到high缓冲队列里面去
+	merge_dw_buffer(ss, s);
     // 2. 发送high和low缓冲队列的数据
 	int r = send_buffer_(ss,s,l,result);
 	socket_unlock(l);
@@ -1039,6 +1306,7 @@ append_sendbuffer_(struct socket_server *ss, struct wb_list *s, struct request_s
 	buf->ptr = (char*)so.buffer;
 	buf->sz = so.sz;
 	buf->buffer = request->buffer;
+	buf->head_sz = buf->head_off = 0;
 	buf->next = NULL;
 	if (s->head == NULL) {
 		s->head = s->tail = buf;
@@ -1056,7 +1324,7 @@ append_sendbuffer_udp(struct socket_server *ss, struct socket *s, int priority,
 	struct wb_list *wl = (priority == PRIORITY_HIGH) ? &s->high : &s->low;
 	struct write_buffer_udp *buf = (struct write_buffer_udp *)append_sendbuffer_(ss, wl, request, sizeof(*buf));
 	memcpy(buf->udp_address, udp_address, UDP_ADDRESS_SIZE);
-	s->wb_size += buf->buffer.sz;
+	wb_size_add(ss, s, buf->buffer.sz);
 }
 
 /*
@@ -1065,7 +1333,7 @@ append_sendbuffer_udp(struct socket_server *ss, struct socket *s, int priority,
 static inline void
 append_sendbuffer(struct socket_server *ss, struct socket *s, struct request_send * request) {
 	struct write_buffer *buf = append_sendbuffer_(ss, &s->high, request, sizeof(*buf));
-	s->wb_size += buf->sz;
+	wb_size_add(ss, s, buf->sz);
 }
 
 /*
@@ -1074,21 +1342,103 @@ append_sendbuffer(struct socket_server *ss, struct socket *s, struct request_sen
 static inline void
 append_sendbuffer_low(struct socket_server *ss,struct socket *s, struct request_send * request) {
 	struct write_buffer *buf = append_sendbuffer_(ss, &s->low, request, sizeof(*buf));
-	s->wb_size += buf->sz;
+	wb_size_add(ss, s, buf->sz);
 }
 
 /*
  * 开启socket的可写事件监听
  * */
+static int check_wb(struct socket_server *ss, struct socket *s, struct socket_message *result);
+
 static int
 trigger_write(struct socket_server *ss, struct request_send * request, struct socket_message *result) {
 	int id = request->id;
 	struct socket * s = &ss->slot[HASH_ID(id)];
 	if (socket_invalid(s, id))
 		return -1;
+	// 直接写剩下的数据计入写缓冲 再检查上限
+	struct socket_lock l;
+	socket_lock_init(s, &l);
+	socket_lock(&l);
+	merge_dw_buffer(ss, s);
+	socket_unlock(&l);
 	if (enable_write(ss, s, true)) {
 		return report_error(s, result, "enable write failed");
 	}
+	return check_wb(ss, s, result);
+}
+
+static inline int
+report_overflow(struct socket *s, struct socket_message *result) {
+	result->opaque = s->opaque;
+	result->id = s->id;
+	result->ud = s->wb_size%1024 == 0 ? s->wb_size/1024 : s->wb_size/1024 + 1;
+	result->data = NULL;
+	return SOCKET_WARNING;
+}
+
+/*
+ * 检查写缓冲是否超过上限 (先看socket自身的上限 再看全局上限) 超过时按策略处理
+ * SOCKET_LIMIT_NOTIFY : 通知owner服务(SOCKET_WARNING) 写缓冲清空后再通知一次 ud为0
+ * SOCKET_LIMIT_DROP : 丢弃低优先级缓冲队列 仍然超限则通知owner服务
+ * SOCKET_LIMIT_CLOSE : 关闭连接 返回SOCKET_ERR
+ * */
+static int
+check_wb_limit(struct socket_server *ss, struct socket *s, struct socket_message *result) {
+	int policy;
+	if (s->wb_limit > 0 && s->wb_size > s->wb_limit) {
+		policy = s->wb_policy;
+	} else if (ss->wb_limit > 0 && ss->wb_total > ss->wb_limit && s->wb_size > 0) {
+		policy = ss->wb_policy;
+	} else {
+		return -1;
+	}
+	switch (policy) {
+	case SOCKET_LIMIT_CLOSE: {
+		struct socket_lock l;
+		socket_lock_init(s, &l);
+		skynet_error(NULL, "socket-server: write buffer of socket %d overflow (%lld bytes), close it.", s->id, (long long)s->wb_size);
+		force_close(ss, s, &l, result);
+		result->data = "write buffer overflow";
+		return SOCKET_ERR;
+	}
+	case SOCKET_LIMIT_DROP: {
+		struct write_buffer *wb;
+		int64_t sz = 0;
+		for (wb = s->low.head; wb; wb = wb->next) {
+			sz += wb->sz;
+		}
+		free_wb_list(ss, &s->low);
+		wb_size_add(ss, s, -sz);
+		if (!(s->wb_limit > 0 && s->wb_size > s->wb_limit)
+			&& !(ss->wb_limit > 0 && ss->wb_total > ss->wb_limit)) {
+			return -1;
+		}
+		break;
+	}
+	}
+	// SOCKET_LIMIT_NOTIFY
+	if (s->wb_overflow) {
+		return -1;
+	}
+	s->wb_overflow = true;
+	return report_overflow(s, result);
+}
+
+/*
+ * 写缓冲增加后检查 先按上限处理 再每到WARNING_SIZE的倍数告警一次
+ * */
+static int
+check_wb(struct socket_server *ss, struct socket *s, struct socket_message *result) {
+	int overflow = check_wb_limit(ss, s, result);
+	if (overflow != -1) {
+		return overflow;
+	}
+    // 返回一些操作的信息放到result消息里面
+	if (s->wb_size >= WARNING_SIZE && s->wb_size >= s->warn_size) {
+		s->warn_size = s->warn_size == 0 ? WARNING_SIZE *2 : s->warn_size*2;
+		return report_overflow(s, result);
+	}
 	return -1;
 }
 
@@ -1161,16 +1511,7 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 			append_sendbuffer_udp(ss,s,priority,request,udp_address);
 		}
 	}
-    // 返回一些操作的信息放到result消息里面
-	if (s->wb_size >= WARNING_SIZE && s->wb_size >= s->warn_size) {
-		s->warn_size = s->warn_size == 0 ? WARNING_SIZE *2 : s->warn_size*2;
-		result->opaque = s->opaque;
-		result->id = s->id;
-		result->ud = s->wb_size%1024 == 0 ? s->wb_size/1024 : s->wb_size/1024 + 1;
-		result->data = NULL;
-		return SOCKET_WARNING;
-	}
-	return -1;
+	return check_wb(ss, s, result);
 }
 
 /*
@@ -1224,7 +1565,7 @@ _failed:
 // 检查是否无数据可写
 static inline int
 nomore_sending_data(struct socket *s) {
-	return (send_buffer_empty(s) && s->dw_buffer == NULL && (ATOM_LOAD(&s->sending) & 0xffff) == 0)
+	return (send_buffer_empty(s) && s->dw_buffer == NULL && s->coalesce.head == NULL && (ATOM_LOAD(&s->sending) & 0xffff) == 0)
 		|| (ATOM_LOAD(&s->type) == SOCKET_TYPE_HALFCLOSE_WRITE);
 }
 
@@ -1240,6 +1581,7 @@ close_read(struct socket_server *ss, struct socket * s, struct socket_message *r
 	result->ud = 0;
 	result->data = NULL;
 	result->opaque = s->opaque;
+	result->observer = s->observer;
 }
 
 static inline int
@@ -1321,6 +1663,11 @@ resume_socket(struct socket_server *ss, struct request_resumepause *request, str
 	}
 	struct socket_lock l;
 	socket_lock_init(s, &l);
+	if (request->header) {
+		s->frame.header = request->header;
+		s->frame.little = request->little;
+		s->frame.max = request->max;
+	}
     // 监听读事件
 	if (enable_read(ss, s, true)) {
 		result->data = "enable read failed";
@@ -1330,11 +1677,13 @@ resume_socket(struct socket_server *ss, struct request_resumepause *request, str
 	if (type == SOCKET_TYPE_PACCEPT || type == SOCKET_TYPE_PLISTEN) {
 		ATOM_STORE(&s->type , (type == SOCKET_TYPE_PACCEPT) ? SOCKET_TYPE_CONNECTED : SOCKET_TYPE_LISTEN);
 		s->opaque = request->opaque;
+		s->observer = request->observer;
 		result->data = "start";
 		return SOCKET_OPEN;
 	} else if (type == SOCKET_TYPE_CONNECTED) {
 		// todo: maybe we should send a message SOCKET_TRANSFER to s->opaque
 		s->opaque = request->opaque;
+		s->observer = request->observer;
 		result->data = "transfer";
 		return SOCKET_OPEN;
 	}
@@ -1372,6 +1721,200 @@ setopt_socket(struct socket_server *ss, struct request_setopt *request) {
 	setsockopt(s->fd, IPPROTO_TCP, request->what, &v, sizeof(v));
 }
 
+static inline uint64_t
+clock_usec() {
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+	return (uint64_t)ti.tv_sec * 1000000 + (uint64_t)ti.tv_nsec / 1000;
+}
+
+/*
+ * 把工作线程追加到coalesce队列的数据合并到高优先级缓冲队列的末尾
+ * return false if nothing is merged
+ * */
+static bool
+merge_coalesce(struct socket_server *ss, struct socket *s) {
+	struct socket_lock l;
+	socket_lock_init(s, &l);
+	socket_lock(&l);
+	struct write_buffer *head = s->coalesce.head;
+	struct write_buffer *tail = s->coalesce.tail;
+	clear_wb_list(&s->coalesce);
+	socket_unlock(&l);
+	if (head == NULL)
+		return false;
+	if (ATOM_LOAD(&s->type) == SOCKET_TYPE_HALFCLOSE_WRITE) {
+		struct wb_list tmp = { head, tail };
+		free_wb_list(ss, &tmp);
+		return false;
+	}
+	struct write_buffer *wb;
+	for (wb = head; wb; wb = wb->next) {
+		wb_size_add(ss, s, wb->sz);
+	}
+	if (s->high.head == NULL) {
+		s->high.head = head;
+	} else {
+		s->high.tail->next = head;
+	}
+	s->high.tail = tail;
+	return true;
+}
+
+/*
+ * 把工作线程追加到coalesce队列的数据合并到高优先级缓冲队列 然后尝试一次性写出
+ * */
+static int
+flush_coalesce(struct socket_server *ss, struct socket *s, struct socket_message *result) {
+	if (!merge_coalesce(ss, s))
+		return -1;
+	struct socket_lock l;
+	socket_lock_init(s, &l);
+	int overflow = check_wb_limit(ss, s, result);
+	if (overflow == SOCKET_ERR) {
+		return overflow;
+	}
+	if (s->writing) {
+		// wait for the writable event
+		return overflow;
+	}
+	int id = s->id;
+	if (overflow != -1) {
+		// raise SOCKET_WARNING, the buffer will be sent at writable event
+		if (enable_write(ss, s, true)) {
+			return report_error(s, result, "enable write failed");
+		}
+		return overflow;
+	}
+	int type = send_buffer(ss, s, &l, result);
+	if (type == -1 && !socket_invalid(s, id) && !send_buffer_empty(s)) {
+		if (enable_write(ss, s, true)) {
+			return report_error(s, result, "enable write failed");
+		}
+	}
+	return type;
+}
+
+static void
+add_flush(struct socket_server *ss, int id, uint64_t deadline) {
+	if (ss->flush_n >= ss->flush_cap) {
+		ss->flush_cap = ss->flush_cap == 0 ? 16 : ss->flush_cap * 2;
+		ss->flush = skynet_realloc(ss->flush, ss->flush_cap * sizeof(struct coalesce_flush));
+	}
+	struct coalesce_flush *f = &ss->flush[ss->flush_n++];
+	f->id = id;
+	f->deadline = deadline;
+}
+
+/*
+ * 工作线程在coalesce队列由空变为非空时投递 'F' 请求
+ * 合并窗口为0时立即写出 否则等窗口时间到了再写出
+ * */
+static int
+coalesce_socket(struct socket_server *ss, struct request_send *request, struct socket_message *result) {
+	int id = request->id;
+	struct socket *s = &ss->slot[HASH_ID(id)];
+	if (socket_invalid(s, id) || s->coalesce_pending) {
+		return -1;
+	}
+	if (s->coalesce_window <= 0) {
+		return flush_coalesce(ss, s, result);
+	}
+	s->coalesce_pending = true;
+	add_flush(ss, id, clock_usec() + s->coalesce_window);
+	return -1;
+}
+
+/*
+ * 写出所有到期的合并发送socket timeout返回下一个到期时间(毫秒) 没有则为-1
+ * */
+static int
+flush_coalesced(struct socket_server *ss, struct socket_message *result, int *timeout) {
+	uint64_t now = clock_usec();
+	int i = 0;
+	*timeout = -1;
+	while (i < ss->flush_n) {
+		struct coalesce_flush *f = &ss->flush[i];
+		if (f->deadline > now) {
+			int ms = (int)((f->deadline - now + 999) / 1000);
+			if (*timeout < 0 || ms < *timeout) {
+				*timeout = ms;
+			}
+			++i;
+			continue;
+		}
+		int id = f->id;
+		*f = ss->flush[--ss->flush_n];
+		struct socket *s = &ss->slot[HASH_ID(id)];
+		if (socket_invalid(s, id)) {
+			continue;
+		}
+		s->coalesce_pending = false;
+		int type = flush_coalesce(ss, s, result);
+		if (type != -1) {
+			return type;
+		}
+	}
+	return -1;
+}
+
+/*
+ * 设置socket的写缓冲上限
+ * */
+static int
+setlimit_socket(struct socket_server *ss, struct request_limit *request, struct socket_message *result) {
+	int id = request->id;
+	struct socket *s = &ss->slot[HASH_ID(id)];
+	if (socket_invalid(s, id)) {
+		return -1;
+	}
+	s->wb_limit = request->limit;
+	s->wb_policy = request->policy;
+	return check_wb_limit(ss, s, result);
+}
+
+/*
+ * 设置全局的写缓冲上限 只在socket线程读写
+ * */
+static void
+setlimit_global(struct socket_server *ss, struct request_limit *request) {
+	ss->wb_limit = request->limit;
+	ss->wb_policy = request->policy;
+}
+
+/*
+ * sp_wait 的超时以毫秒计 窗口的精度是 1 毫秒 所以向上取整到整毫秒
+ * */
+static int
+coalesce_window(int usec) {
+	if (usec < 0)
+		return COALESCE_DISABLE;
+	if (usec > COALESCE_MAX)
+		usec = COALESCE_MAX;
+	return (usec + 999) / 1000 * 1000;
+}
+
+/*
+ * 设置socket的合并发送窗口 关闭时立即写出已合并的数据
+ * */
+static int
+setcoalesce_socket(struct socket_server *ss, struct request_setopt *request, struct socket_message *result) {
+	int id = request->id;
+	struct socket *s = &ss->slot[HASH_ID(id)];
+	if (socket_invalid(s, id) || s->protocol != PROTOCOL_TCP) {
+		return -1;
+	}
+	struct socket_lock l;
+	socket_lock_init(s, &l);
+	socket_lock(&l);
+	s->coalesce_window = coalesce_window(request->value);
+	socket_unlock(&l);
+	if (s->coalesce_window == COALESCE_DISABLE) {
+		return flush_coalesce(ss, s, result);
+	}
+	return -1;
+}
+
 /*
  * 从管道的数据接收端读取数据
  * */
@@ -1477,6 +2020,59 @@ dec_sending_ref(struct socket_server *ss, int id) {
 	}
 }
 
+/*
+ * 把multicast的数据追加到一个socket的高优先级缓冲队列, 包头放在write_buffer里 发送时用writev一起写出
+ * */
+static int
+multicast_socket(struct socket_server *ss, struct multicast *m, int id, struct socket_message *result) {
+	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct request_send request;
+	request.id = id;
+	request.sz = USEROBJECT;
+	request.buffer = m->object;
+	uint8_t type = ATOM_LOAD(&s->type);
+	if (type == SOCKET_TYPE_INVALID || s->id != id
+		|| type == SOCKET_TYPE_HALFCLOSE_WRITE
+		|| type == SOCKET_TYPE_PACCEPT
+		|| type == SOCKET_TYPE_PLISTEN
+		|| type == SOCKET_TYPE_LISTEN
+		|| s->protocol != PROTOCOL_TCP
+		|| s->closing) {
+		ss->soi.free((void *)m->object);
+		return -1;
+	}
+	int empty = send_buffer_empty(s);
+	// the data written before (in the coalesce window) goes first
+	merge_coalesce(ss, s);
+	struct write_buffer *buf = append_sendbuffer_(ss, &s->high, &request, sizeof(*buf));
+	memcpy(buf->head, m->head, m->header);
+	buf->head_sz = (uint8_t)m->header;
+	wb_size_add(ss, s, buf->sz + buf->head_sz);
+	if (empty && enable_write(ss, s, true)) {
+		return report_error(s, result, "enable write failed");
+	}
+	return check_wb(ss, s, result);
+}
+
+/*
+ * 继续处理进行中的multicast, 某个socket产生了消息(出错/警告)就先返回, 下次poll接着发剩下的socket
+ * */
+static int
+multicast_continue(struct socket_server *ss, struct socket_message *result) {
+	struct multicast *m = ss->multicast;
+	while (m->i < m->n) {
+		int id = m->id[m->i++];
+		int type = multicast_socket(ss, m, id, result);
+		dec_sending_ref(ss, id);
+		if (type != -1) {
+			return type;
+		}
+	}
+	ss->multicast = NULL;
+	FREE(m);
+	return -1;
+}
+
 // return type
 static int
 ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
@@ -1538,6 +2134,18 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 	case 'T':
 		setopt_socket(ss, (struct request_setopt *)buffer);
 		return -1;
+	case 'M':
+		return setlimit_socket(ss, (struct request_limit *)buffer, result);
+	case 'Q':
+		setlimit_global(ss, (struct request_limit *)buffer);
+		return -1;
+	case 'G':
+		return setcoalesce_socket(ss, (struct request_setopt *)buffer, result);
+	case 'N':
+		ss->multicast = ((struct request_multicast *)buffer)->m;
+		return multicast_continue(ss, result);
+	case 'F':
+		return coalesce_socket(ss, (struct request_send *)buffer, result);
 	case 'U':
 		add_udp_socket(ss, (struct request_udp *)buffer);
 		return -1;
@@ -1549,11 +2157,260 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 	return -1;
 }
 
+// parse the header at h (sz bytes), set *size (not include header) and return the size of header,
+// 0 when the header is uncomplete, -1 when the packet is too large
+static inline int
+frame_header(struct socket_frame *f, const uint8_t *h, int sz, int *size) {
+	uint64_t n;
+	int header;
+	if (f->header == SOCKET_FRAME_WEBSOCKET) {
+		// RFC 6455 5.2 : 2 bytes, extended payload length (0/2/8 bytes), masking key (0/4 bytes)
+		if (sz < 2) {
+			return 0;
+		}
+		int len = h[1] & 0x7f;
+		int ext = (len == 126) ? 2 : (len == 127) ? 8 : 0;
+		header = 2 + ext + ((h[1] & 0x80) ? 4 : 0);
+		if (sz < header) {
+			return 0;
+		}
+		n = len;
+		int i;
+		if (ext) {
+			n = 0;
+			for (i=0;i<ext;i++) {
+				n = n << 8 | h[2+i];
+			}
+		}
+	} else {
+		header = f->header;
+		if (sz < header) {
+			return 0;
+		}
+		if (header == 2) {
+			n = f->little ? (h[0] | h[1] << 8) : (h[0] << 8 | h[1]);
+		} else {
+			n = f->little ?
+				(h[0] | h[1] << 8 | h[2] << 16 | (uint32_t)h[3] << 24) :
+				((uint32_t)h[0] << 24 | h[1] << 16 | h[2] << 8 | h[3]);
+		}
+	}
+	if (n > (uint64_t)f->max) {
+		return -1;
+	}
+	*size = (int)n;
+	return header;
+}
+
+// the socket thread unmasks the websocket frames from client, and clears the masking key (xor 0 is nop)
+static void
+frame_unmask(struct socket_frame *f, uint8_t *buffer, int sz) {
+	if (f->header != SOCKET_FRAME_WEBSOCKET) {
+		return;
+	}
+	int offset = 0;
+	while (offset < sz) {
+		int size;
+		int header = frame_header(f, buffer + offset, sz - offset, &size);
+		assert(header > 0 && offset + header + size <= sz);
+		if (buffer[offset+1] & 0x80) {
+			uint8_t * key = buffer + offset + header - 4;
+			websocket_mask(key + 4, key + 4, size, key, 0);
+			memset(key, 0, 4);
+		}
+		offset += header + size;
+	}
+}
+
+// return the bytes of complete packets at the beginning of buffer, or -1 when a packet is too large
+static int
+frame_scan(struct socket_frame *f, const uint8_t *buffer, int sz) {
+	int offset = 0;
+	for (;;) {
+		int size;
+		int header = frame_header(f, buffer + offset, sz - offset, &size);
+		if (header < 0) {
+			return -1;
+		}
+		if (header == 0 || sz - offset - header < size) {
+			break;
+		}
+		offset += header + size;
+	}
+	return offset;
+}
+
+// keep the uncomplete tail (already checked by frame_scan)
+static void
+frame_save(struct socket_frame *f, const uint8_t *buffer, int sz) {
+	int size;
+	int header = frame_header(f, buffer, sz, &size);
+	if (header <= 0) {
+		// header < 0 (too large) is rejected by frame_scan before
+		memcpy(f->head, buffer, sz);
+		f->head_n = sz;
+		return;
+	}
+	f->need = header + size;
+	f->pack = MALLOC(f->need);
+	memcpy(f->pack, buffer, sz);
+	f->read = sz;
+}
+
+// fill the uncomplete packet, return the bytes used, or -1 when the packet is too large
+static int
+frame_fill(struct socket_frame *f, const uint8_t *buffer, int sz) {
+	int used = 0;
+	if (f->pack == NULL) {
+		// the size of header may be unknown (websocket), copy as much as possible then give back the extra bytes
+		int head_n = f->head_n;
+		used = FRAME_HEAD_MAX - head_n;
+		if (used > sz) {
+			used = sz;
+		}
+		memcpy(f->head + head_n, buffer, used);
+		f->head_n += used;
+		int size;
+		int header = frame_header(f, f->head, f->head_n, &size);
+		if (header < 0) {
+			return -1;
+		}
+		if (header == 0) {
+			return used;
+		}
+		used = header - head_n;
+		f->need = header + size;
+		f->pack = MALLOC(f->need);
+		memcpy(f->pack, f->head, header);
+		f->read = header;
+		f->head_n = 0;
+	}
+	int n = f->need - f->read;
+	if (n > sz - used) {
+		n = sz - used;
+	}
+	memcpy(f->pack + f->read, buffer + used, n);
+	f->read += n;
+	return used + n;
+}
+
+/*
+ * 分包模式 : 只投递完整的包 (保留原始包头), 一个消息里可以有多个包
+ * 不完整的部分留在socket_frame里, 等后续数据拼完整
+ * 收到的数据恰好都是完整包时 (最常见的情况) 直接投递读缓冲区, 不做拷贝
+ * return -1 when no complete packet
+ * */
+static int
+frame_message(struct socket_server *ss, struct socket *s, struct socket_lock *l, char *buffer, int n, struct socket_message *result) {
+	struct socket_frame *f = &s->frame;
+	char * pack = NULL;
+	int pack_sz = 0;
+	int offset = 0;
+	if (f->pack || f->head_n > 0) {
+		offset = frame_fill(f, (const uint8_t *)buffer, n);
+		if (offset < 0) {
+			goto _toolarge;
+		}
+		if (f->pack == NULL || f->read < f->need) {
+			FREE(buffer);
+			return -1;
+		}
+		pack = f->pack;
+		pack_sz = f->need;
+		f->pack = NULL;
+	}
+	int sz = frame_scan(f, (const uint8_t *)buffer + offset, n - offset);
+	if (sz < 0) {
+		FREE(pack);
+		goto _toolarge;
+	}
+	if (offset + sz < n) {
+		frame_save(f, (const uint8_t *)buffer + offset + sz, n - offset - sz);
+	}
+	frame_unmask(f, (uint8_t *)buffer + offset, sz);
+	if (pack) {
+		frame_unmask(f, (uint8_t *)pack, pack_sz);
+	}
+	if (pack == NULL) {
+		if (sz == 0) {
+			FREE(buffer);
+			return -1;
+		}
+		result->ud = sz;
+	} else if (sz == 0) {
+		FREE(buffer);
+		result->data = pack;
+		result->ud = pack_sz;
+	} else {
+		char * tmp = MALLOC(pack_sz + sz);
+		memcpy(tmp, pack, pack_sz);
+		memcpy(tmp + pack_sz, buffer + offset, sz);
+		FREE(pack);
+		FREE(buffer);
+		result->data = tmp;
+		result->ud = pack_sz + sz;
+	}
+	return SOCKET_DATA;
+_toolarge:
+	FREE(buffer);
+	skynet_error(NULL, "socket-server: packet of socket %d is too large, close it.", s->id);
+	force_close(ss, s, l, result);
+	result->data = "packet too large";
+	return SOCKET_ERR;
+}
+
+// the largest class whose size <= sz
+static inline int
+recv_class(int sz) {
+	int c = 0;
+	while (c < RECV_POOL_CLASS - 1 && (MIN_READ_BUFFER << (c+1)) <= sz) {
+		++c;
+	}
+	return c;
+}
+
+// sz is always power of 2 (s->p.size)
+static char *
+recv_alloc(struct socket_server *ss, int sz) {
+	if (sz <= (MIN_READ_BUFFER << (RECV_POOL_CLASS - 1))) {
+		int c = recv_class(sz);
+		if ((MIN_READ_BUFFER << c) == sz) {
+			struct recv_pool *p = &ss->rpool;
+			char * buffer = NULL;
+			spinlock_lock(&p->lock);
+			if (p->n[c] > 0) {
+				buffer = p->buffer[c][--p->n[c]];
+			}
+			spinlock_unlock(&p->lock);
+			if (buffer) {
+				return buffer;
+			}
+		}
+	}
+	return MALLOC(sz);
+}
+
+// The capacity of buffer is unknown, but it's at least sz (the bytes read into it).
+void
+socket_server_recycle(struct socket_server *ss, void *buffer, int sz) {
+	if (sz >= MIN_READ_BUFFER) {
+		int c = recv_class(sz);
+		struct recv_pool *p = &ss->rpool;
+		spinlock_lock(&p->lock);
+		if (p->n[c] < RECV_POOL_SIZE) {
+			p->buffer[c][p->n[c]++] = buffer;
+			buffer = NULL;
+		}
+		spinlock_unlock(&p->lock);
+	}
+	FREE(buffer);
+}
+
 // return -1 (ignore) when error
 static int
 forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
 	int sz = s->p.size;
-	char * buffer = MALLOC(sz);
+	char * buffer = recv_alloc(ss, sz);
     // 相应可读事件 从socket中的缓冲区读数据
 	int n = (int)read(s->fd, buffer, sz);
 	if (n<0) {
@@ -1603,14 +2460,21 @@ forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lo
 	result->ud = n;
 	result->data = buffer;
 
+	int type = SOCKET_DATA;
 	if (n == sz) {
 		s->p.size *= 2;
-		return SOCKET_MORE;
+		type = SOCKET_MORE;
 	} else if (sz > MIN_READ_BUFFER && n*2 < sz) {
 		s->p.size /= 2;
 	}
+	if (s->frame.header) {
+		int t = frame_message(ss, s, l, buffer, n, result);
+		if (t != SOCKET_DATA) {
+			return t;
+		}
+	}
 
-	return SOCKET_DATA;
+	return type;
 }
 
 static int
@@ -1631,6 +2495,102 @@ gen_udp_address(int protocol, union sockaddr_all *sa, uint8_t * udp_address) {
 	return addrsz;
 }
 
+#ifdef USE_MMSG
+
+/*
+ * 用recvmmsg一次读取多个udp包
+ * 只读到一个包时按SOCKET_UDP投递 (data + address)
+ * 读到多个包时合并成一个SOCKET_UDP_BATCH消息投递, 每个包的格式为 : uint16 size , data , address
+ * address的第一个字节是协议类型, 长度由协议决定
+ * */
+static int
+forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
+	struct mmsghdr msgs[UDP_BATCH];
+	struct iovec iov[UDP_BATCH];
+	union sockaddr_all sa[UDP_BATCH];
+	if (ss->udpbatch == NULL) {
+		ss->udpbatch = MALLOC(UDP_BATCH * MAX_UDP_PACKAGE);
+	}
+	int i;
+	for (i=0;i<UDP_BATCH;i++) {
+		iov[i].iov_base = ss->udpbatch + i * MAX_UDP_PACKAGE;
+		iov[i].iov_len = MAX_UDP_PACKAGE;
+		memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+		msgs[i].msg_hdr.msg_name = &sa[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(sa[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	int n = recvmmsg(s->fd, msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+	if (n<0) {
+		switch(errno) {
+		case EINTR:
+		case AGAIN_WOULDBLOCK:
+			return -1;
+		}
+		int error = errno;
+		// close when error
+		force_close(ss, s, l, result);
+		result->data = strerror(error);
+		return SOCKET_ERR;
+	}
+	socklen_t slen;
+	int addrsz;
+	if (s->protocol == PROTOCOL_UDP) {
+		slen = sizeof(sa[0].v4);
+		addrsz = 1+2+4;
+	} else {
+		slen = sizeof(sa[0].v6);
+		addrsz = 1+2+16;
+	}
+	int count = 0;
+	int last = 0;
+	size_t total = 0;
+	for (i=0;i<n;i++) {
+		stat_read(ss,s,msgs[i].msg_len);
+		if (msgs[i].msg_hdr.msg_namelen != slen) {
+			// protocol mismatch, drop it
+			msgs[i].msg_hdr.msg_namelen = 0;
+			continue;
+		}
+		++count;
+		last = i;
+		total += sizeof(uint16_t) + msgs[i].msg_len + addrsz;
+	}
+	if (count == 0) {
+		return -1;
+	}
+	uint8_t * data;
+	result->opaque = s->opaque;
+	result->id = s->id;
+	if (count == 1) {
+		int sz = msgs[last].msg_len;
+		data = MALLOC(sz + addrsz);
+		memcpy(data, iov[last].iov_base, sz);
+		gen_udp_address(s->protocol, &sa[last], data + sz);
+		result->ud = sz;
+		result->data = (char *)data;
+		return SOCKET_UDP;
+	}
+	data = MALLOC(total);
+	uint8_t * ptr = data;
+	for (i=0;i<n;i++) {
+		if (msgs[i].msg_hdr.msg_namelen == 0)
+			continue;
+		uint16_t sz = (uint16_t)msgs[i].msg_len;
+		memcpy(ptr, &sz, sizeof(sz));
+		ptr += sizeof(sz);
+		memcpy(ptr, iov[i].iov_base, sz);
+		ptr += sz;
+		ptr += gen_udp_address(s->protocol, &sa[i], ptr);
+	}
+	result->ud = (int)total;
+	result->data = (char *)data;
+	return SOCKET_UDP_BATCH;
+}
+
+#else
+
 static int
 forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
 	union sockaddr_all sa;
@@ -1672,6 +2632,8 @@ forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_lo
 	return SOCKET_UDP;
 }
 
+#endif
+
 /*
  * 发起socket连接 返回消息包，里面是连接的一些状态和信息
  * */
@@ -1810,7 +2772,15 @@ clear_closed_event(struct socket_server *ss, struct socket_message * result, int
 // return type
 int 
 socket_server_poll(struct socket_server *ss, struct socket_message * result, int * more) {
+	result->observer = 0;
 	for (;;) {
+		if (ss->multicast) {
+			int type = multicast_continue(ss, result);
+			if (type != -1) {
+				clear_closed_event(ss, result, type);
+				return type;
+			}
+		}
         // 处理管道的事件
 		if (ss->checkctrl) {
             // 通过select 轮询管道fd事件
@@ -1827,23 +2797,31 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 		}
         // wait 获取新的IO相应事件
 		if (ss->event_index == ss->event_n) {
+			int timeout = -1;
+			if (ss->flush_n > 0) {
+				// flush the coalesced sockets whose window expired
+				int type = flush_coalesced(ss, result, &timeout);
+				if (type != -1) {
+					return type;
+				}
+			}
             /*
              * wait 获取IO相应事件
              * ev 是本次可处理的事件列表
              * event_n 是可处理事件的数量
              * */
-			ss->event_n = sp_wait(ss->event_fd, ss->ev, MAX_EVENT);
+			ss->event_n = sp_wait(ss->event_fd, ss->ev, MAX_EVENT, timeout);
 			ss->checkctrl = 1;
 			if (more) {
 				*more = 0;
 			}
 			ss->event_index = 0;
 			if (ss->event_n <= 0) {
-				ss->event_n = 0;
 				int err = errno;
-				if (err != EINTR) {
+				if (ss->event_n < 0 && err != EINTR) {
 					skynet_error(NULL, "socket-server: %s", strerror(err));
 				}
+				ss->event_n = 0;
 				continue;
 			}
 		}
@@ -1861,8 +2839,16 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 		case SOCKET_TYPE_LISTEN: {
 			int ok = report_accept(ss, s, result);
 			if (ok > 0) {
+				// 同一个监听事件上继续accept直到EAGAIN, 连接风暴时不必每个连接都等一轮sp_wait
+				if (++ss->accept_n < ACCEPT_BATCH) {
+					--ss->event_index;
+				} else {
+					ss->accept_n = 0;
+				}
 				return SOCKET_ACCEPT;
-			} if (ok < 0 ) {
+			}
+			ss->accept_n = 0;
+			if (ok < 0 ) {
 				return SOCKET_ERR;
 			}
 			// when ok == 0, retry
@@ -1882,10 +2868,10 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 					}
 				} else {
 					type = forward_message_udp(ss, s, &l, result);
-					if (type == SOCKET_UDP) {
+					if (type == SOCKET_UDP || type == SOCKET_UDP_BATCH) {
 						// try read again
 						--ss->event_index;
-						return SOCKET_UDP;
+						return type;
 					}
 				}
 				if (e->write && type != SOCKET_CLOSE && type != SOCKET_ERR) {
@@ -1990,6 +2976,50 @@ can_direct_write(struct socket *s, int id) {
 	return s->id == id && nomore_sending_data(s) && ATOM_LOAD(&s->type) == SOCKET_TYPE_CONNECTED && ATOM_LOAD(&s->udpconnecting) == 0;
 }
 
+/*
+ * 合并发送模式下 工作线程只把数据追加到socket的coalesce队列 由socket线程统一写出
+ * 队列由空变为非空时才通过管道通知socket线程
+ * return false if the socket is not in coalesce mode
+ * */
+static bool
+append_coalesce(struct socket_server *ss, struct socket *s, struct socket_sendbuffer *buf) {
+	int id = buf->id;
+	struct socket_lock l;
+	socket_lock_init(s, &l);
+	socket_lock(&l);
+	if (s->id != id || s->coalesce_window == COALESCE_DISABLE || ATOM_LOAD(&s->type) != SOCKET_TYPE_CONNECTED) {
+		socket_unlock(&l);
+		return false;
+	}
+	struct write_buffer *wb = MALLOC(sizeof(*wb));
+	struct send_object so;
+	size_t sz;
+	const void *buffer = clone_buffer(buf, &sz);
+	wb->userobject = send_object_init(ss, &so, buffer, sz);
+	wb->ptr = (char *)so.buffer;
+	wb->sz = so.sz;
+	wb->buffer = buffer;
+	wb->head_sz = wb->head_off = 0;
+	wb->next = NULL;
+	bool first = (s->coalesce.head == NULL);
+	if (first) {
+		s->coalesce.head = s->coalesce.tail = wb;
+	} else {
+		s->coalesce.tail->next = wb;
+		s->coalesce.tail = wb;
+	}
+	socket_unlock(&l);
+
+	if (first) {
+		struct request_package request;
+		request.u.send.id = id;
+		request.u.send.sz = 0;
+		request.u.send.buffer = NULL;
+		send_request(ss, &request, 'F', sizeof(request.u.send));
+	}
+	return true;
+}
+
 // return -1 when error, 0 when success
 int 
 socket_server_send(struct socket_server *ss, struct socket_sendbuffer *buf) {
@@ -2000,6 +3030,10 @@ socket_server_send(struct socket_server *ss, struct socket_sendbuffer *buf) {
 		return -1;
 	}
 
+	if (s->coalesce_window != COALESCE_DISABLE && append_coalesce(ss, s, buf)) {
+		return 0;
+	}
+
 	struct socket_lock l;
 	socket_lock_init(s, &l);
 
@@ -2063,6 +3097,50 @@ socket_server_send(struct socket_server *ss, struct socket_sendbuffer *buf) {
 	return 0;
 }
 
+// 一次投递把userobject发给ids里的所有socket, 调用者给每个id持有一个object的引用
+// header为2或4时, 每个socket先写大端的数据长度
+// return the number of sockets queued, -1 when error
+int
+socket_server_multicast(struct socket_server *ss, const void *object, int header, const int *ids, int n) {
+	size_t sz = ss->soi.size(object);
+	int i;
+	if ((header != 0 && header != 2 && header != 4)
+		|| (header == 2 && sz > 0xffff)
+		|| (header == 4 && sz > 0xffffffff)) {
+		for (i=0;i<n;i++) {
+			ss->soi.free((void *)object);
+		}
+		return -1;
+	}
+	struct multicast *m = MALLOC(sizeof(*m) + (n > 0 ? n - 1 : 0) * sizeof(int));
+	m->object = object;
+	m->header = header;
+	for (i=0;i<header;i++) {
+		m->head[i] = (uint8_t)(sz >> ((header - 1 - i) * 8));
+	}
+	m->n = 0;
+	m->i = 0;
+	for (i=0;i<n;i++) {
+		int id = ids[i];
+		struct socket * s = &ss->slot[HASH_ID(id)];
+		if (socket_invalid(s, id) || s->closing) {
+			ss->soi.free((void *)object);
+			continue;
+		}
+		inc_sending_ref(s, id);
+		m->id[m->n++] = id;
+	}
+	if (m->n == 0) {
+		FREE(m);
+		return 0;
+	}
+	int count = m->n;
+	struct request_package request;
+	request.u.multicast.m = m;
+	send_request(ss, &request, 'N', sizeof(request.u.multicast));
+	return count;
+}
+
 // return -1 when error, 0 when success
 int 
 socket_server_send_lowpriority(struct socket_server *ss, struct socket_sendbuffer *buf) {
@@ -2113,7 +3191,7 @@ socket_server_shutdown(struct socket_server *ss, uintptr_t opaque, int id) {
 // return -1 means failed
 // or return AF_INET or AF_INET6
 static int
-do_bind(const char *host, int port, int protocol, int *family) {
+do_bind(const char *host, int port, int protocol, int *family, int reuseport) {
 	int fd;
 	int status;
 	int reuse = 1;
@@ -2146,6 +3224,16 @@ do_bind(const char *host, int port, int protocol, int *family) {
 	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void *)&reuse, sizeof(int))==-1) {
 		goto _failed;
 	}
+	if (reuseport) {
+#ifdef SO_REUSEPORT
+		// 多个监听socket绑定同一端口, 由内核在它们之间分配新连接
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (void *)&reuse, sizeof(int))==-1) {
+			goto _failed;
+		}
+#else
+		goto _failed;
+#endif
+	}
 	status = bind(fd, (struct sockaddr *)ai_list->ai_addr, ai_list->ai_addrlen);
 	if (status != 0)
 		goto _failed;
@@ -2161,10 +3249,10 @@ _failed_fd:
 
 // 处理tcp的绑定和监听
 static int
-do_listen(const char * host, int port, int backlog) {
+do_listen(const char * host, int port, int backlog, int reuseport) {
 	int family = 0;
 
-	int listen_fd = do_bind(host, port, IPPROTO_TCP, &family);
+	int listen_fd = do_bind(host, port, IPPROTO_TCP, &family, reuseport);
 	if (listen_fd < 0) {
 		return -1;
 	}
@@ -2172,13 +3260,15 @@ do_listen(const char * host, int port, int backlog) {
 		close(listen_fd);
 		return -1;
 	}
+	// accept is retried until EAGAIN, so the listen fd must not block
+	sp_nonblocking(listen_fd);
 	return listen_fd;
 }
 
-int 
-socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog) {
+static int
+listen_request(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog, int reuseport) {
     // 绑定和监听tcp端口 返回监听的socket
-	int fd = do_listen(addr, port, backlog);
+	int fd = do_listen(addr, port, backlog, reuseport);
 	if (fd < 0) {
 		return -1;
 	}
@@ -2196,6 +3286,17 @@ socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * ad
 	return id;
 }
 
+int 
+socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog) {
+	return listen_request(ss, opaque, addr, port, backlog, 0);
+}
+
+// 以SO_REUSEPORT方式监听, 多个服务可以各自监听同一端口, 由内核分摊连接
+int
+socket_server_listen_reuseport(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog) {
+	return listen_request(ss, opaque, addr, port, backlog, 1);
+}
+
 // 通过管道给socket线程投递bind请求包
 int
 socket_server_bind(struct socket_server *ss, uintptr_t opaque, int fd) {
@@ -2216,9 +3317,43 @@ socket_server_start(struct socket_server *ss, uintptr_t opaque, int id) {
 	struct request_package request;
 	request.u.resumepause.id = id;
 	request.u.resumepause.opaque = opaque;
+	request.u.resumepause.observer = 0;
+	request.u.resumepause.header = 0;
 	send_request(ss, &request, 'R', sizeof(request.u.resumepause));
 }
 
+static int
+start_framing(struct socket_server *ss, uintptr_t opaque, int id, uintptr_t observer, int header, int little, int max) {
+	if (header != 2 && header != 4 && header != SOCKET_FRAME_WEBSOCKET) {
+		return -1;
+	}
+	int limit = (header == 2) ? 0xffff : FRAME_MAX_DEFAULT;
+	if (max <= 0 || max > limit) {
+		max = limit;
+	}
+	struct request_package request;
+	request.u.resumepause.id = id;
+	request.u.resumepause.opaque = opaque;
+	request.u.resumepause.observer = observer;
+	request.u.resumepause.header = (uint8_t)header;
+	request.u.resumepause.little = little ? 1 : 0;
+	request.u.resumepause.max = max;
+	send_request(ss, &request, 'R', sizeof(request.u.resumepause));
+	return 0;
+}
+
+// start时设置分包模式, socket线程按包头拆包, 只投递完整的包
+int
+socket_server_start_framing(struct socket_server *ss, uintptr_t opaque, int id, int header, int little, int max) {
+	return start_framing(ss, opaque, id, 0, header, little, max);
+}
+
+// 把连接直接交给 opaque (agent) 读, 包按大端包头拆分; observer (gate) 仍然收到 close/error
+int
+socket_server_handoff(struct socket_server *ss, uintptr_t opaque, int id, uintptr_t observer, int header) {
+	return start_framing(ss, opaque, id, observer, header, 0, 0);
+}
+
 // 通过管道给socket线程投递pause请求包
 void
 socket_server_pause(struct socket_server *ss, uintptr_t opaque, int id) {
@@ -2238,6 +3373,36 @@ socket_server_nodelay(struct socket_server *ss, int id) {
 	send_request(ss, &request, 'T', sizeof(request.u.setopt));
 }
 
+// 通过管道给socket线程投递设置写缓冲上限的请求包
+void
+socket_server_limit(struct socket_server *ss, int id, int64_t limit, int policy) {
+	struct request_package request;
+	request.u.limit.id = id;
+	request.u.limit.policy = policy;
+	request.u.limit.limit = limit;
+	send_request(ss, &request, 'M', sizeof(request.u.limit));
+}
+
+// 全局上限由socket线程使用 通过管道投递请求包设置
+void
+socket_server_limit_global(struct socket_server *ss, int64_t limit, int policy) {
+	struct request_package request;
+	request.u.limit.id = 0;
+	request.u.limit.policy = policy;
+	request.u.limit.limit = limit;
+	send_request(ss, &request, 'Q', sizeof(request.u.limit));
+}
+
+// 通过管道给socket线程投递设置合并发送窗口的请求包 usec < 0 表示关闭
+void
+socket_server_coalesce(struct socket_server *ss, int id, int usec) {
+	struct request_package request;
+	request.u.setopt.id = id;
+	request.u.setopt.what = 0;
+	request.u.setopt.value = usec;
+	send_request(ss, &request, 'G', sizeof(request.u.setopt));
+}
+
 void 
 socket_server_userobject(struct socket_server *ss, struct socket_object_interface *soi) {
 	ss->soi = *soi;
@@ -2251,7 +3416,7 @@ socket_server_udp(struct socket_server *ss, uintptr_t opaque, const char * addr,
 	int family;
 	if (port != 0 || addr != NULL) {
 		// bind
-		fd = do_bind(addr, port, IPPROTO_UDP, &family);
+		fd = do_bind(addr, port, IPPROTO_UDP, &family, 0);
 		if (fd < 0) {
 			return -1;
 		}
@@ -2470,6 +3635,7 @@ query_info(struct socket *s, struct socket_info *si) {
 	si->rtime = s->stat.rtime;
 	si->wtime = s->stat.wtime;
 	si->wbuffer = s->wb_size;
+	si->wlimit = s->wb_limit;
 	si->reading = s->reading;
 	si->writing = s->writing;
 
@@ -2494,5 +3660,10 @@ socket_server_info(struct socket_server *ss) {
 			*si = temp;
 		}
 	}
+	// the first one is the summary of socket server
+	si = socket_info_create(si);
+	si->type = SOCKET_INFO_SERVER;
+	si->wbuffer = ss->wb_total;
+	si->wlimit = ss->wb_limit;
 	return si;
 }
@@ -21,6 +21,9 @@
 #define SOCKET_RST 8
 #define SOCKET_MORE 9
 
+// Some udp packages in one message, see forward_message_udp
+#define SOCKET_UDP_BATCH 10
+
 struct socket_server;
 
 struct socket_message {
@@ -28,6 +31,7 @@ struct socket_message {
 	uintptr_t opaque;
 	int ud;	// for accept, ud is new connection id ; for data, ud is size of data 
 	char * data;
+	uintptr_t observer;	// for close/error, the service observes the socket (see socket_server_handoff), 0 for none
 };
 
 // 创建socket_server对象
@@ -51,6 +55,13 @@ void socket_server_shutdown(struct socket_server *, uintptr_t opaque, int id);
 
 // socket启动监听读事件  工作线程发起请求包给socket线程处理
 void socket_server_start(struct socket_server *, uintptr_t opaque, int id);
+// start with framing : only complete packets (header size 2 or 4, max <= 0 means the default) are forwarded
+// return the read buffer (sz bytes used) to the receive pool, it's thread safe
+void socket_server_recycle(struct socket_server *, void *buffer, int sz);
+// header : 2 or 4 bytes length, or SOCKET_FRAME_WEBSOCKET (frames from client are unmasked, the masking key is set to 0)
+#define SOCKET_FRAME_WEBSOCKET 1
+int socket_server_start_framing(struct socket_server *, uintptr_t opaque, int id, int header, int little, int max);
+int socket_server_handoff(struct socket_server *, uintptr_t opaque, int id, uintptr_t observer, int header);
 
 // socket启动监听读事件  工作线程发起请求包给socket线程处理
 void socket_server_pause(struct socket_server *, uintptr_t opaque, int id);
@@ -63,14 +74,21 @@ void socket_server_pause(struct socket_server *, uintptr_t opaque, int id);
  * */
 int socket_server_send(struct socket_server *, struct socket_sendbuffer *buffer);
 int socket_server_send_lowpriority(struct socket_server *, struct socket_sendbuffer *buffer);
+// send a userobject to n sockets by one request, it takes n references of object.
+// header (0, 2 or 4) : big-endian size written before object. returns the number of sockets queued, -1 for error
+int socket_server_multicast(struct socket_server *, const void *object, int header, const int *ids, int n);
 
 // ctrl command below returns id
 int socket_server_listen(struct socket_server *, uintptr_t opaque, const char * addr, int port, int backlog);
+int socket_server_listen_reuseport(struct socket_server *, uintptr_t opaque, const char * addr, int port, int backlog);
 int socket_server_connect(struct socket_server *, uintptr_t opaque, const char * addr, int port);
 int socket_server_bind(struct socket_server *, uintptr_t opaque, int fd);
 
 // for tcp
 void socket_server_nodelay(struct socket_server *, int id);
+// coalesce the sends of a tcp socket within usec (0 : flush once per batch), usec < 0 turn it off
+// the resolution is 1 ms (the timeout of the poll), usec is rounded up to whole milliseconds
+void socket_server_coalesce(struct socket_server *, int id, int usec);
 
 struct socket_udp_address;
 
@@ -96,4 +114,13 @@ void socket_server_userobject(struct socket_server *, struct socket_object_inter
 
 struct socket_info * socket_server_info(struct socket_server *);
 
+// policy when the write buffer exceeds the limit
+#define SOCKET_LIMIT_NOTIFY 0	// raise SOCKET_WARNING, and raise again (ud = 0) after drained
+#define SOCKET_LIMIT_DROP 1	// drop low priority buffers, notify if it still exceeds
+#define SOCKET_LIMIT_CLOSE 2	// close the socket and raise SOCKET_ERR
+
+// limit == 0 means no limit
+void socket_server_limit(struct socket_server *, int id, int64_t limit, int policy);
+void socket_server_limit_global(struct socket_server *, int64_t limit, int policy);
+
 #endif
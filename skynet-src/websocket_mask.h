@@ -0,0 +1,51 @@
+#ifndef skynet_websocket_mask_h
+#define skynet_websocket_mask_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// xor the payload with the 4 bytes masking key of websocket (RFC 6455 5.3), dst can be src.
+// offset is the position of src[0] in the payload, for the payload masked by pieces.
+static inline void
+websocket_mask(uint8_t *dst, const uint8_t *src, size_t sz, const uint8_t key[4], size_t offset) {
+	uint8_t k[4];
+	int i;
+	for (i=0;i<4;i++) {
+		k[i] = key[(offset + i) & 3];
+	}
+	uint32_t k32;
+	memcpy(&k32, k, 4);
+	size_t n = 0;
+#if defined(__AVX2__)
+	__m256i m = _mm256_set1_epi32((int)k32);
+	for (; n + 32 <= sz; n += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + n));
+		_mm256_storeu_si256((__m256i *)(dst + n), _mm256_xor_si256(v, m));
+	}
+#elif defined(__SSE2__)
+	__m128i m = _mm_set1_epi32((int)k32);
+	for (; n + 16 <= sz; n += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + n));
+		_mm_storeu_si128((__m128i *)(dst + n), _mm_xor_si128(v, m));
+	}
+#endif
+	uint64_t k64 = (uint64_t)k32 << 32 | k32;
+	for (; n + 8 <= sz; n += 8) {
+		uint64_t v;
+		memcpy(&v, src + n, 8);
+		v ^= k64;
+		memcpy(dst + n, &v, 8);
+	}
+	for (; n < sz; n++) {
+		dst[n] = src[n] ^ k[n & 3];
+	}
+}
+
+#endif
@@ -0,0 +1,149 @@
+local skynet = require "skynet"
+local blob = require "skynet.blob"
+local mc = require "skynet.multicast"
+
+local mode = ...
+local N = 1000
+
+if mode == "slave" then
+
+local hold
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, data, echo)
+		if data == "subscribe" then
+			local c = mc.new {
+				channel = echo,
+				dispatch = function(_, _, b)
+					hold = b:tostring()
+					b:release()
+				end,
+			}
+			c:subscribe()
+			skynet.ret()
+		elseif data == "gc" then
+			-- the unpacked blobs are released by __gc
+			collectgarbage()
+			skynet.ret()
+		elseif data == "published" then
+			skynet.ret(skynet.pack(hold))
+		elseif echo then
+			-- send the blob back
+			skynet.ret(skynet.pack(data))
+		else
+			skynet.ret(skynet.pack(#data))
+		end
+	end)
+end)
+
+else
+
+local function test(slave)
+	local b = blob.new("hello world")
+	assert(#b == 11 and b:tostring() == "hello world")
+	assert(b:tostring(7) == "world" and b:tostring(-5, -1) == "world" and b:tostring(20) == "")
+
+	-- the same bytes come back
+	local r = skynet.call(slave, "lua", b, true)
+	assert(tostring(r) == tostring(b), "not the same blob")
+	assert(r:tostring() == "hello world")
+
+	-- the message owns its references, each unpack grabs new ones
+	local msg, sz = skynet.pack({ b, b })
+	local t = skynet.unpack(msg, sz)
+	assert(tostring(t[1]) == tostring(b) and tostring(t[2]) == tostring(b))
+	local t2 = skynet.unpack(msg, sz)
+	assert(tostring(t2[1]) == tostring(b))
+	t2[1]:release()
+	t2[2]:release()
+	-- a string copy doesn't own them
+	local ok, err = pcall(skynet.unpack, skynet.tostring(msg, sz))
+	assert(not ok and err:find "string copy", err)
+	skynet.trash(msg, sz, skynet.PTYPE_LUA)
+
+	-- packstring packs the bytes
+	local str = skynet.packstring(b)
+	assert(skynet.unpack(str) == "hello world")
+
+	b:release()
+	assert(not pcall(b.tostring, b))
+	-- the other references are still alive
+	assert(r:tostring() == "hello world" and t[1]:tostring() == "hello world")
+
+	-- from a buffer alloc by skynet_malloc
+	local b2 = blob.new(skynet.pack("take"))
+	assert(skynet.unpack(b2:tostring()) == "take")
+	r:release()
+	t[1]:release()
+	t[2]:release()
+	b2:release()
+	print("blob check ok")
+end
+
+-- every reference is released once : no blob is left alive
+local function test_release(slave)
+	skynet.call(slave, "lua", "gc")
+	collectgarbage()
+	local live = blob.count()
+	local b = blob.new "x"
+
+	-- the pack fails after the blob
+	local ok = pcall(skynet.pack, b, print)
+	assert(not ok)
+
+	-- the request and the response are released after the dispatch
+	local r = skynet.call(slave, "lua", b, true)
+	r:release()
+	-- no session, skynet.ret trashes the response
+	skynet.send(slave, "lua", b)
+
+	local msg, sz = skynet.pack(b)
+	skynet.trash(msg, sz, skynet.PTYPE_LUA)
+
+	-- the subscribers of a local multicast share the message
+	local channel = mc.new()
+	local subs = {}
+	for i = 1, 3 do
+		subs[i] = skynet.newservice(SERVICE_NAME, "slave")
+		skynet.call(subs[i], "lua", "subscribe", channel.channel)
+	end
+	channel:publish(b)
+	skynet.sleep(10)
+	for i = 1, 3 do
+		assert(skynet.call(subs[i], "lua", "published") == "x")
+	end
+	channel:delete()
+
+	b:release()
+	skynet.sleep(10)
+	skynet.call(slave, "lua", "gc")
+	collectgarbage()
+	assert(blob.count() == live, "blob leak")
+	print("blob release ok")
+end
+
+local function bench(slave)
+	local data = string.rep("x", 1024 * 1024)
+	local b = blob.new(data)
+	local t = skynet.hpc()
+	for i = 1, N do
+		assert(skynet.call(slave, "lua", data) == #data)
+	end
+	local str = (skynet.hpc() - t) / N / 1000
+	t = skynet.hpc()
+	for i = 1, N do
+		assert(skynet.call(slave, "lua", b) == #data)
+	end
+	local ref = (skynet.hpc() - t) / N / 1000
+	print(string.format("call with 1M payload : string %.1f us, blob %.1f us", str, ref))
+end
+
+skynet.start(function()
+	local slave = skynet.newservice(SERVICE_NAME, "slave")
+	test(slave)
+	test_release(slave)
+	bench(slave)
+	skynet.exit()
+end)
+
+end
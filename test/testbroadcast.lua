@@ -0,0 +1,42 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+local N = 100
+
+skynet.start(function()
+	local clients = {}
+	local listen, addr, port = socket.listen("127.0.0.1", 0)
+	socket.start(listen, function(id)
+		socket.start(id)
+		table.insert(clients, id)
+	end)
+	local c = {}
+	for i = 1, N do
+		c[i] = assert(socket.open(addr, port))
+	end
+	while #clients < N do
+		skynet.sleep(1)
+	end
+
+	local data = string.rep("x", 2048) .. "\n"
+	-- string is copied once for all the sockets
+	print("broadcast", socket.broadcast(clients, data))
+	-- sharedbuffer can be reused
+	local sb = socket.sharedbuffer("hello\n")
+	print("broadcast sharedbuffer", #sb, socket.broadcast(clients, sb))
+	socket.write(clients[1], sb)
+
+	for i = 1, N do
+		assert(socket.readline(c[i]) == string.rep("x", 2048))
+		assert(socket.readline(c[i]) == "hello")
+	end
+	assert(socket.readline(c[1]) == "hello")
+	print("all clients received")
+
+	for i = 1, N do
+		socket.close(c[i])
+		socket.close(clients[i])
+	end
+	socket.close(listen)
+	skynet.exit()
+end)
@@ -0,0 +1,57 @@
+local skynet = require "skynet"
+
+local mode = ...
+local N = 200000
+
+if mode == "slave" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, n)
+		if n == "cpu" then
+			skynet.ret(skynet.pack(skynet.stat "cpu"))
+		else
+			skynet.ret(skynet.pack(n))
+		end
+	end)
+end)
+
+else
+
+local function bench(slave, concurrent)
+	local n = N // concurrent
+	local done = 0
+	local cpu = skynet.stat "cpu"
+	local slave_cpu = skynet.call(slave, "lua", "cpu")
+	local t = skynet.hpc()
+	for i = 1, concurrent do
+		skynet.fork(function()
+			for j = 1, n do
+				skynet.call(slave, "lua", j)
+			end
+			done = done + 1
+			if done == concurrent then
+				skynet.wakeup(bench)
+			end
+		end)
+	end
+	skynet.wait(bench)
+	local ti = (skynet.hpc() - t) / 1e9
+	-- the cpu time (profile = true) is less noisy than the wall time
+	cpu = (skynet.stat "cpu" - cpu) / (n * concurrent) * 1e6
+	slave_cpu = (skynet.call(slave, "lua", "cpu") - slave_cpu) / (n * concurrent) * 1e6
+	local co = skynet.stat "coroutine"
+	print(string.format("skynet.call x %d (%d concurrent) : %.0f calls/sec, cpu %.2f us caller %.2f us callee, mem %.1fK, coroutine %d peak %d pool %d",
+		n * concurrent, concurrent, n * concurrent / ti, cpu, slave_cpu, collectgarbage "count", co.count, co.peak, co.pool))
+end
+
+skynet.start(function()
+	local slave = skynet.newservice(SERVICE_NAME, "slave")
+	bench(slave, 1)
+	bench(slave, 100)
+	-- the pool is smaller than the concurrent calls
+	skynet.coroutine_pool(16)
+	bench(slave, 100)
+	skynet.exit()
+end)
+
+end
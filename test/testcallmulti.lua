@@ -0,0 +1,119 @@
+local skynet = require "skynet"
+
+local mode = ...
+local SHARD = 50
+local N = 1000
+
+if mode == "shard" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, cmd, ...)
+		if cmd == "get" then
+			skynet.ret(skynet.pack(skynet.self(), ...))
+		elseif cmd == "sleep" then
+			skynet.sleep(...)
+			skynet.ret(skynet.pack "wakeup")
+		elseif cmd == "error" then
+			error "shard error"
+		end
+	end)
+end)
+
+else
+
+local function test(shards)
+	local reqs = {}
+	for i = 1, SHARD do
+		reqs[i] = { shards[i], "lua", "get", i, "x" }
+	end
+	local results = skynet.callmulti(reqs)
+	assert(#results == SHARD)
+	for i = 1, SHARD do
+		local r = results[i]
+		assert(r[1] == true and r[2] == shards[i] and r[3] == i and r[4] == "x" and r.n == 4)
+	end
+
+	-- an error, a timeout and an invalid address
+	results = skynet.callmulti({
+		{ shards[1], "lua", "get", 1 },
+		{ shards[2], "lua", "error" },
+		{ shards[3], "lua", "sleep", 100 },
+		{ 0x7fffff, "lua", "get" },
+		{ shards[4], "lua", "get", 4 },
+	}, 10)
+	assert(results[1][1] == true and results[1][3] == 1)
+	assert(results[2][1] == false and results[2][2] == "error")
+	assert(results[3][1] == false and results[3][2] == "timeout")
+	assert(results[4][1] == false and results[4][2] == "error")
+	assert(results[5][1] == true and results[5][3] == 4)
+	-- the late response of the timeout is dropped
+	skynet.sleep(100)
+
+	assert(#skynet.callmulti {} == 0)
+	print("callmulti check ok")
+end
+
+local function bench(shards)
+	local function sequential()
+		for i = 1, SHARD do
+			skynet.call(shards[i], "lua", "get", i)
+		end
+	end
+
+	local function fork()
+		local n = SHARD
+		local co = coroutine.running()
+		for i = 1, SHARD do
+			skynet.fork(function()
+				skynet.call(shards[i], "lua", "get", i)
+				n = n - 1
+				if n == 0 then
+					skynet.wakeup(co)
+				end
+			end)
+		end
+		skynet.wait(co)
+	end
+
+	local function request()
+		local req = skynet.request()
+		for i = 1, SHARD do
+			req:add { shards[i], "lua", "get", i }
+		end
+		for _ in req:select() do
+		end
+	end
+
+	local function callmulti()
+		local reqs = {}
+		for i = 1, SHARD do
+			reqs[i] = { shards[i], "lua", "get", i }
+		end
+		skynet.callmulti(reqs)
+	end
+
+	for _, f in ipairs { { "sequential", sequential }, { "fork", fork }, { "request", request }, { "callmulti", callmulti } } do
+		local name, func = f[1], f[2]
+		func()
+		local cpu = skynet.stat "cpu"
+		local t = skynet.hpc()
+		for i = 1, N do
+			func()
+		end
+		t = (skynet.hpc() - t) / N / 1000
+		cpu = (skynet.stat "cpu" - cpu) / N * 1e6
+		print(string.format("fan-out to %d services, %-10s : %.1f us, caller cpu %.1f us", SHARD, name, t, cpu))
+	end
+end
+
+skynet.start(function()
+	local shards = {}
+	for i = 1, SHARD do
+		shards[i] = skynet.newservice(SERVICE_NAME, "shard")
+	end
+	test(shards)
+	bench(shards)
+	skynet.exit()
+end)
+
+end
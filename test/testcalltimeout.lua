@@ -0,0 +1,131 @@
+local skynet = require "skynet"
+
+local mode = ...
+local N = 100000	-- the concurrent calls
+
+if mode == "slave" then
+
+local hold = {}
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, cmd, ...)
+		if cmd == "echo" then
+			skynet.ret(skynet.pack(...))
+		elseif cmd == "hold" then
+			hold[#hold+1] = skynet.response()
+		elseif cmd == "release" then
+			-- the late responses
+			local n = #hold
+			for i = 1, n do
+				hold[i](true, "late")
+			end
+			hold = {}
+			skynet.ret(skynet.pack(n))
+		elseif cmd == "exit" then
+			skynet.exit()
+		end
+	end)
+end)
+
+else
+
+-- the timeout emulated by skynet.timeout (sleep) + skynet.wakeup : a timer, a session and a coroutine more per call
+local function lua_calltimeout(ti, addr, typename, ...)
+	local co = coroutine.running()
+	local ret
+	skynet.fork(function(...)
+		ret = table.pack(pcall(skynet.call, addr, typename, ...))
+		if co then
+			skynet.wakeup(co)
+		end
+	end, ...)
+	skynet.sleep(ti, co)
+	co = nil
+	if ret == nil then
+		error "call timeout"
+	end
+	assert(ret[1], ret[2])
+	return table.unpack(ret, 2, ret.n)
+end
+
+local function test(slave)
+	assert(skynet.calltimeout(100, slave, "lua", "echo", 1, 2) == 1)
+	local t = skynet.now()
+	local ok, err = pcall(skynet.calltimeout, 10, slave, "lua", "hold")
+	assert(not ok and err:find "call timeout", err)
+	assert(skynet.now() - t >= 10)
+	-- the late response is dropped by the core
+	assert(skynet.call(slave, "lua", "release") == 1)
+	-- the timeout 0
+	ok, err = pcall(skynet.calltimeout, 0, slave, "lua", "hold")
+	assert(not ok and err:find "call timeout", err)
+	skynet.call(slave, "lua", "release")
+	-- the service exits before timeout
+	local tmp = skynet.newservice(SERVICE_NAME, "slave")
+	skynet.fork(function()
+		skynet.sleep(10)
+		skynet.send(tmp, "lua", "exit")
+	end)
+	ok, err = pcall(skynet.calltimeout, 1000, tmp, "lua", "hold")
+	assert(not ok and err:find "call failed", err)
+	-- the service is reported down (skynet.term), the deadline is canceled
+	tmp = skynet.newservice(SERVICE_NAME, "slave")
+	skynet.fork(function()
+		skynet.sleep(10)
+		skynet.term(tmp)
+	end)
+	ok, err = pcall(skynet.calltimeout, 50, tmp, "lua", "hold")
+	assert(not ok and err:find "call failed", err)
+	-- no error from address 0 after the timeout, only the wakeup of sleep
+	local messages = skynet.stat "message"
+	skynet.sleep(60)
+	assert(skynet.stat "message" - messages == 1, "the deadline is not canceled")
+	skynet.send(tmp, "lua", "exit")
+	print("calltimeout check ok")
+end
+
+local function bench(slave, name, calltimeout, cmd, ti)
+	collectgarbage "collect"
+	local done = 0
+	local timeout = 0
+	local mem = 0
+	local co = coroutine.running()
+	local cpu = skynet.stat "cpu"
+	local t = skynet.hpc()
+	for i = 1, N do
+		skynet.fork(function()
+			local ok, err = pcall(calltimeout, ti, slave, "lua", cmd, i)
+			if not ok then
+				assert(err:find "call timeout", err)
+				timeout = timeout + 1
+			end
+			mem = math.max(mem, collectgarbage "count")
+			done = done + 1
+			if done == N then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	t = (skynet.hpc() - t) / 1e9
+	if cmd == "hold" then
+		-- the late responses
+		skynet.call(slave, "lua", "release")
+		skynet.sleep(50)
+	end
+	cpu = skynet.stat "cpu" - cpu
+	print(string.format("%-4s %-5s %d calls with deadline %d : %.2fs, %d timeout, caller cpu %.2fs, mem peak %.1fM",
+		name, cmd, N, ti, t, timeout, cpu, mem / 1024))
+end
+
+skynet.start(function()
+	local slave = skynet.newservice(SERVICE_NAME, "slave")
+	test(slave)
+	bench(slave, "core", skynet.calltimeout, "echo", 500)
+	bench(slave, "lua", lua_calltimeout, "echo", 500)
+	bench(slave, "core", skynet.calltimeout, "hold", 100)
+	bench(slave, "lua", lua_calltimeout, "hold", 100)
+	skynet.exit()
+end)
+
+end
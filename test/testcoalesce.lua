@@ -0,0 +1,49 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+local mode, window = ...
+local N = 10000
+
+if mode == "writer" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, id, usec)
+		socket.start(id)
+		socket.coalesce(id, usec)
+		for i = 1, N do
+			socket.write(id, string.format("%d\n", i))
+		end
+		socket.coalesce(id, -1)	-- turn off and flush the rest
+		socket.write(id, "end\n")
+		skynet.ret()
+		socket.close(id)
+	end)
+end)
+
+else
+
+skynet.start(function()
+	local writer = skynet.newservice(SERVICE_NAME, "writer")
+	local id, addr, port = socket.listen("127.0.0.1", 0)
+	socket.start(id, function(fd)
+		skynet.fork(skynet.call, writer, "lua", fd, tonumber(window) or 0)
+	end)
+	local c = assert(socket.open(addr, port))
+	local start = skynet.now()
+	for i = 1, N do
+		local line = socket.readline(c)
+		assert(tonumber(line) == i, line)
+	end
+	assert(socket.readline(c) == "end")
+	print("coalesce", window or 0, "usec", N, "packets", (skynet.now() - start) * 10, "ms")
+	for _, v in ipairs(socket.netstat()) do
+		if v.id == c then
+			print("read bytes", v.read)
+		end
+	end
+	socket.close(c)
+	socket.close(id)
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,111 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+require "skynet.manager"
+
+-- the C gate starts connections with framing, the socket thread splits the packets
+local PORT = 8991
+local N = 10000
+
+skynet.register_protocol {
+	name = "text",
+	id = skynet.PTYPE_TEXT,
+	pack = function(m) return m end,
+	unpack = skynet.tostring,
+}
+
+skynet.register_protocol {
+	name = "client",
+	id = skynet.PTYPE_CLIENT,
+	unpack = skynet.tostring,
+}
+
+local gate
+local events = {}
+local fd
+local received = {}
+
+local function wait(cond)
+	while not cond() do
+		skynet.sleep(1)
+	end
+end
+
+local function packet(i)
+	return string.rep(string.char(i % 26 + 65), i % 100 + 1) .. i
+end
+
+skynet.start(function()
+	-- the gate uses session as the socket id
+	skynet.dispatch("text", function(_,_, msg)
+		skynet.ignoreret()
+		local id, cmd, data = msg:match("^(%d+) (%a+) ?(.*)")
+		if cmd == "data" then
+			table.insert(received, data)
+		else
+			fd = tonumber(id)
+			table.insert(events, cmd)
+		end
+	end)
+	skynet.dispatch("client", function(_,_, msg)
+		skynet.ignoreret()
+		table.insert(received, msg)
+	end)
+	local self = skynet.address(skynet.self())
+	gate = skynet.launch("gate", "S", self, "127.0.0.1:" .. PORT, 0, 16)
+
+	local c = assert(socket.open("127.0.0.1", PORT))
+	wait(function() return events[1] == "open" end)
+	skynet.send(gate, "text", "start " .. fd)
+
+	-- write the stream in random sized chunks, headers may be split
+	local stream = {}
+	for i = 1, N do
+		local p = packet(i)
+		stream[i] = string.pack(">s2", p)
+	end
+	stream = table.concat(stream)
+	local start = skynet.now()
+	local offset = 1
+	while offset <= #stream do
+		local n = math.random(1, 4096)
+		socket.write(c, stream:sub(offset, offset + n - 1))
+		offset = offset + n
+		if math.random(8) == 1 then
+			skynet.sleep(0)
+		end
+	end
+	wait(function() return #received >= N end)
+	print("framing", N, "packets", #stream, "bytes", (skynet.now() - start) * 10, "ms")
+	for i = 1, N do
+		assert(received[i] == packet(i), i)
+	end
+
+	-- forward to agent, then the packets arrive as PTYPE_CLIENT
+	received = {}
+	skynet.send(gate, "text", string.format("forward %d %s %s", fd, self, self))
+	socket.write(c, string.pack(">s2", "hello") .. string.pack(">s2", "") .. string.pack(">s2", "world"))
+	wait(function() return #received >= 2 end)
+	assert(received[1] == "hello" and received[2] == "world")
+
+	socket.close(c)
+	wait(function() return events[2] == "close" end)
+
+	-- little-endian 4 bytes header, packets larger than max close the connection
+	local listen, addr, port = socket.listen("127.0.0.1", 0)
+	local server
+	socket.start(listen, function(id)
+		socket.start(id, nil, 4, "little", 16)
+		server = id
+	end)
+	c = assert(socket.open(addr, port))
+	wait(function() return server end)
+	socket.write(c, string.pack("<s4", "small"))
+	assert(socket.read(server, 9) == string.pack("<s4", "small"))
+	socket.write(c, string.pack("<s4", string.rep("x", 17)))
+	assert(socket.read(server) == false)
+	socket.close(c)
+	socket.close(server)
+	socket.close(listen)
+	print("framing ok")
+	skynet.exit()
+end)
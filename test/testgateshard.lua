@@ -0,0 +1,114 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+require "skynet.manager"
+
+-- the C gate with shards : messages/sec vs shard count
+local mode = ...
+local PORT = 8994
+local CLIENTS = 64
+local BATCH = 100	-- packets per write
+local ROUND = 50	-- writes per client
+local AGENTS = 8
+
+if mode == "agent" then
+
+skynet.register_protocol {
+	name = "client",
+	id = skynet.PTYPE_CLIENT,
+	unpack = function() end,
+}
+
+skynet.start(function()
+	local count = 0
+	skynet.dispatch("client", function()
+		skynet.ignoreret()
+		count = count + 1
+	end)
+	skynet.dispatch("lua", function()
+		skynet.ret(skynet.pack(count))
+	end)
+end)
+
+else
+
+skynet.register_protocol {
+	name = "text",
+	id = skynet.PTYPE_TEXT,
+	pack = function(m) return m end,
+	unpack = skynet.tostring,
+}
+
+local agents = {}
+local gate
+local opened = 0
+local closed = 0
+
+local function wait(cond)
+	while not cond() do
+		skynet.sleep(1)
+	end
+end
+
+local function count()
+	local n = 0
+	for i = 1, AGENTS do
+		n = n + skynet.call(agents[i], "lua")
+	end
+	return n
+end
+
+local function bench(shards)
+	local base = count()
+	opened, closed = 0, 0
+	gate = skynet.launch("gate", "S", skynet.address(skynet.self()), "127.0.0.1:" .. PORT + shards, 0, CLIENTS, shards)
+	local c = {}
+	for i = 1, CLIENTS do
+		c[i] = assert(socket.open("127.0.0.1", PORT + shards))
+	end
+	wait(function() return opened == CLIENTS end)
+
+	local data = string.rep(string.pack(">s2", string.rep("x", 32)), BATCH)
+	local start = skynet.now()
+	for r = 1, ROUND do
+		for i = 1, CLIENTS do
+			socket.write(c[i], data)
+		end
+		skynet.sleep(0)
+	end
+	local total = CLIENTS * BATCH * ROUND
+	wait(function() return count() - base >= total end)
+	local ti = (skynet.now() - start) / 100
+	print(string.format("shards %d : %d messages %.2fs %.0f msgs/sec", shards, total, ti, total / ti))
+
+	for i = 1, CLIENTS do
+		socket.close(c[i])
+	end
+	wait(function() return closed == CLIENTS end)
+	skynet.kill(gate)
+end
+
+skynet.start(function()
+	for i = 1, AGENTS do
+		agents[i] = skynet.newservice(SERVICE_NAME, "agent")
+	end
+	local self = skynet.address(skynet.self())
+	skynet.dispatch("text", function(_,_, msg)
+		skynet.ignoreret()
+		local fd, cmd = msg:match("^(%d+) (%a+)")
+		if cmd == "open" then
+			opened = opened + 1
+			-- the master routes the commands to the shard owns fd
+			local agent = skynet.address(agents[opened % AGENTS + 1])
+			skynet.send(gate, "text", string.format("forward %s %s %s", fd, agent, self))
+			skynet.send(gate, "text", "start " .. fd)
+		elseif cmd == "close" then
+			closed = closed + 1
+		end
+	end)
+	for _, shards in ipairs { 1, 2, 4 } do
+		bench(shards)
+	end
+	skynet.exit()
+end)
+
+end
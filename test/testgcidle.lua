@@ -0,0 +1,69 @@
+local skynet = require "skynet"
+local gc = require "skynet.gc"
+
+-- Run it twice to compare : without lua_gc_idle, and with lua_gc_idle = 1000 in config.
+-- The idle slices work in incremental mode only.
+
+local mode = ...
+local N = 5000
+local HEAP = 1000000	-- objects of the data service
+
+if mode == "data" then
+
+local data = {}
+
+skynet.start(function()
+	for i = 1, HEAP do
+		data[i] = { id = i, name = "data" .. i }
+	end
+	skynet.dispatch("lua", function(_,_, cmd, ...)
+		if cmd == "tune" then
+			gc.tune(...)
+			collectgarbage "collect"
+			skynet.ret()
+		elseif cmd == "stat" then
+			skynet.ret(skynet.pack(skynet.stat "gc"))
+		else
+			-- a request makes some garbage
+			local t = {}
+			for i = 1, 1000 do
+				t[i] = { data[(cmd + i) % HEAP + 1].name }
+			end
+			skynet.ret(skynet.pack(#t))
+		end
+	end)
+end)
+
+else
+
+local function bench(data, policy)
+	skynet.call(data, "lua", "tune", policy)
+	local s1 = skynet.call(data, "lua", "stat")
+	local lat = {}
+	local cost = 0
+	for i = 1, N do
+		local t = skynet.hpc()
+		skynet.call(data, "lua", i)
+		lat[i] = skynet.hpc() - t
+		cost = cost + lat[i]
+		if i % 20 == 0 then
+			-- leave some idle time to the workers
+			skynet.sleep(1)
+		end
+	end
+	table.sort(lat)
+	local s2 = skynet.call(data, "lua", "stat")
+	print(string.format("%-12s : %d requests, avg %.3fms p99 %.2fms max %.2fms, idle budget %dus : %d slices %d steps %d cycles %.1fms",
+		policy, N, cost / N / 1e6, lat[N * 99 // 100] / 1e6, lat[N] / 1e6,
+		s2.idle_budget * 1e6, s2.idle_slices - s1.idle_slices, s2.idle_steps - s1.idle_steps,
+		s2.idle_cycles - s1.idle_cycles, (s2.idle_time - s1.idle_time) * 1000))
+end
+
+skynet.start(function()
+	local data = skynet.newservice(SERVICE_NAME, "data")
+	bench(data, "incremental")
+	bench(data, "generational")
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,63 @@
+local skynet = require "skynet"
+local gc = require "skynet.gc"
+
+local mode = ...
+local N = 20000
+local HEAP = 1000000	-- objects of the data service
+
+if mode == "data" then
+
+local data = {}
+
+skynet.start(function()
+	for i = 1, HEAP do
+		data[i] = { id = i, name = "data" .. i }
+	end
+	skynet.dispatch("lua", function(_,_, cmd, ...)
+		if cmd == "tune" then
+			gc.tune(...)
+			-- start from a full collected heap
+			collectgarbage "collect"
+			skynet.ret()
+		elseif cmd == "stat" then
+			skynet.ret(skynet.pack(skynet.stat "gc"))
+		else
+			-- a request makes some garbage
+			local t = {}
+			for i = 1, 200 do
+				t[i] = { data[(cmd + i) % HEAP + 1].name }
+			end
+			skynet.ret(skynet.pack(#t))
+		end
+	end)
+end)
+
+else
+
+local function bench(data, policy, heap)
+	skynet.call(data, "lua", "tune", policy, heap)
+	local lat = {}
+	local start = skynet.hpc()
+	for i = 1, N do
+		local t = skynet.hpc()
+		skynet.call(data, "lua", i)
+		lat[i] = skynet.hpc() - t
+	end
+	local total = (skynet.hpc() - start) / 1e9
+	table.sort(lat)
+	local stat = skynet.call(data, "lua", "stat")
+	print(string.format("%-12s : %d requests %.3fs, p99 %.2fms, p999 %.2fms, max %.2fms, mode %s(%d) stepsize %d mem %.1fM alloc %.1fM/s",
+		policy, N, total, lat[N * 99 // 100] / 1e6, lat[N * 999 // 1000] / 1e6, lat[N] / 1e6,
+		stat.mode, stat.switches, stat.stepsize, stat.mem / (1024 * 1024), stat.alloc_rate / (1024 * 1024)))
+end
+
+skynet.start(function()
+	local data = skynet.newservice(SERVICE_NAME, "data")
+	-- start from generational mode, switch to incremental above 32M
+	bench(data, "auto", 32 * 1024 * 1024)
+	bench(data, "generational")
+	bench(data, "incremental")
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,125 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+require "skynet.manager"
+
+-- the C gate hands off the connection to agent, packets skip the gate service
+local mode = ...
+local PORT = 8998
+local N = 100000
+
+if mode == "agent" then
+
+skynet.register_protocol {
+	name = "client",
+	id = skynet.PTYPE_CLIENT,
+	unpack = skynet.tostring,
+}
+
+skynet.start(function()
+	local count = 0
+	local last
+	local function packet(_, msg)
+		count = count + 1
+		last = msg
+	end
+	skynet.dispatch("client", function(_,_, msg)
+		skynet.ignoreret()
+		packet(nil, msg)
+	end)
+	skynet.dispatch("lua", function(_,_, cmd, fd)
+		if cmd == "handoff" then
+			socket.handoff(fd, function(id, msg)
+				packet(id, msg)
+				if msg == "echo" then
+					socket.write(id, string.pack(">s2", msg))
+				end
+			end)
+			skynet.ret()
+		else
+			skynet.ret(skynet.pack(count, last))
+		end
+	end)
+end)
+
+else
+
+skynet.register_protocol {
+	name = "text",
+	id = skynet.PTYPE_TEXT,
+	pack = function(m) return m end,
+	unpack = skynet.tostring,
+}
+
+local events = {}
+
+local function wait(cond)
+	while not cond() do
+		skynet.sleep(1)
+	end
+end
+
+local function bench(gate, agent, handoff)
+	local self = skynet.address(skynet.self())
+	local c = assert(socket.open("127.0.0.1", PORT))
+	wait(function() return events[#events] and events[#events].cmd == "open" end)
+	local fd = events[#events].fd
+	if handoff then
+		skynet.call(agent, "lua", "handoff", fd)
+		skynet.send(gate, "text", string.format("handoff %d %s", fd, skynet.address(agent)))
+	else
+		skynet.send(gate, "text", string.format("forward %d %s %s", fd, skynet.address(agent), self))
+		skynet.send(gate, "text", "start " .. fd)
+	end
+	local base = skynet.call(agent, "lua", "count")
+	local data = string.rep(string.pack(">s2", "hello"), 100)
+	local start = skynet.now()
+	for i = 1, N // 100 do
+		socket.write(c, data)
+		if i % 10 == 0 then
+			skynet.sleep(0)
+		end
+	end
+	wait(function() return skynet.call(agent, "lua", "count") - base >= N end)
+	print(handoff and "handoff" or "forward", N, "packets", (skynet.now() - start) * 10, "ms")
+	return c, fd
+end
+
+skynet.start(function()
+	skynet.dispatch("text", function(_,_, msg)
+		skynet.ignoreret()
+		local fd, cmd = msg:match("^(%d+) (%a+)")
+		table.insert(events, { fd = tonumber(fd), cmd = cmd })
+	end)
+	local agent = skynet.newservice(SERVICE_NAME, "agent")
+	local gate = skynet.launch("gate", "S", skynet.address(skynet.self()), "127.0.0.1:" .. PORT, 0, 16)
+
+	local c = bench(gate, agent, false)
+	socket.close(c)
+	wait(function() return events[#events].cmd == "close" end)
+
+	local fd
+	c, fd = bench(gate, agent, true)
+	-- agent writes to the client, the socket is not started by agent
+	socket.write(c, string.pack(">s2", "echo"))
+	assert(socket.read(c, 6) == string.pack(">s2", "echo"))
+	local _, last = skynet.call(agent, "lua", "count")
+	assert(last == "echo")
+	-- gate still gets close after handoff
+	socket.close(c)
+	wait(function() return events[#events].cmd == "close" end)
+	assert(events[#events].fd == fd)
+	-- and agent closes the connection
+	wait(function()
+		for _, v in ipairs(socket.netstat()) do
+			if v.id == fd then
+				return false
+			end
+		end
+		return true
+	end)
+	print("handoff ok")
+	skynet.kill(gate)
+	skynet.exit()
+end)
+
+end
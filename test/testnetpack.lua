@@ -0,0 +1,71 @@
+local skynet = require "skynet"
+
+-- pipelined small packets through gateserver : handler.message (one packet per call) vs handler.batch
+local mode = ...
+local N = 200000
+local PORT = 8993
+
+if mode == "message" or mode == "batch" then
+
+local gateserver = require "snax.gateserver"
+local netpack = require "skynet.netpack"
+
+local count = 0
+local handler = {}
+
+function handler.connect(fd)
+	gateserver.openclient(fd)
+end
+
+if mode == "message" then
+	function handler.message(fd, msg, sz)
+		count = count + 1
+		assert(netpack.tostring(msg, sz) == tostring(count))
+	end
+else
+	function handler.batch(fd, packets)
+		for i = 1, #packets, 2 do
+			count = count + 1
+			assert(skynet.tostring(packets[i], packets[i+1]) == tostring(count))
+		end
+	end
+end
+
+function handler.command()
+	return count
+end
+
+gateserver.start(handler)
+
+else
+
+local socket = require "skynet.socket"
+
+local function test(mode)
+	local gate = skynet.newservice(SERVICE_NAME, mode)
+	skynet.call(gate, "lua", "open", { address = "127.0.0.1", port = PORT })
+	local c = assert(socket.open("127.0.0.1", PORT))
+	local start = skynet.now()
+	local tmp = {}
+	for i = 1, N do
+		tmp[#tmp+1] = string.pack(">s2", tostring(i))
+		if #tmp == 1000 then
+			socket.write(c, table.concat(tmp))
+			tmp = {}
+		end
+	end
+	while skynet.call(gate, "lua", "count") < N do
+		skynet.sleep(1)
+	end
+	print(mode, N, "packets", (skynet.now() - start) * 10, "ms")
+	socket.close(c)
+	skynet.call(gate, "lua", "close")
+end
+
+skynet.start(function()
+	test "message"
+	test "batch"
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,89 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+local function connect()
+	local server
+	local listen, addr, port = socket.listen("127.0.0.1", 0)
+	socket.start(listen, function(id)
+		socket.start(id)
+		server = id
+	end)
+	local client = assert(socket.open(addr, port))
+	while not server do
+		skynet.sleep(1)
+	end
+	socket.close(listen)
+	return server, client
+end
+
+-- lines split at random points, even between \r and \n
+local function test_split(server, client)
+	local lines = {}
+	for i = 1, 2000 do
+		lines[i] = string.rep(string.char(i % 26 + 97), math.random(0, 300)) .. "\r" .. i
+	end
+	local stream = table.concat(lines, "\r\n") .. "\r\n"
+	skynet.fork(function()
+		local offset = 1
+		while offset <= #stream do
+			local n = math.random(1, 64)
+			socket.write(client, stream:sub(offset, offset + n - 1))
+			offset = offset + n
+			if math.random(4) == 1 then
+				skynet.sleep(0)
+			end
+		end
+	end)
+	for i = 1, #lines do
+		assert(socket.readline(server, "\r\n") == lines[i], i)
+	end
+	print("split lines ok")
+end
+
+-- pipelined redis bulk replies : $<len>\r\n<data>\r\n
+local function bench_redis(server, client)
+	local N = 100000
+	local data = string.rep("v", 100)
+	local reply = string.format("$%d\r\n%s\r\n", #data, data)
+	local batch = string.rep(reply, 1000)
+	skynet.fork(function()
+		for i = 1, N // 1000 do
+			socket.write(client, batch)
+		end
+	end)
+	local start = skynet.now()
+	for i = 1, N do
+		local line = socket.readline(server, "\r\n")
+		local sz = tonumber(line:sub(2))
+		assert(#socket.read(server, sz + 2) == sz + 2)
+	end
+	print("redis", N, "replies", (skynet.now() - start) * 10, "ms")
+end
+
+-- one long line arrives in small pieces, every piece triggers a check
+local function bench_longline(server, client)
+	local SIZE = 4 * 1024 * 1024
+	local piece = string.rep("x", 1024)
+	skynet.fork(function()
+		for i = 1, SIZE // 1024 do
+			socket.write(client, piece)
+			if i % 16 == 0 then
+				skynet.sleep(0)
+			end
+		end
+		socket.write(client, "\r\n")
+	end)
+	local start = skynet.now()
+	assert(#socket.readline(server, "\r\n") == SIZE)
+	print("long line", SIZE, "bytes", (skynet.now() - start) * 10, "ms")
+end
+
+skynet.start(function()
+	local server, client = connect()
+	test_split(server, client)
+	bench_redis(server, client)
+	bench_longline(server, client)
+	socket.close(client)
+	socket.close(server)
+	skynet.exit()
+end)
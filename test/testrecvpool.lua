@@ -0,0 +1,70 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- read buffers go back to the receive pool of socket server, buffer_nodes come from a C arena
+local SIZE = 64 * 1024 * 1024
+
+skynet.start(function()
+	local server
+	local listen, addr, port = socket.listen("127.0.0.1", 0)
+	socket.start(listen, function(id)
+		socket.start(id)
+		server = id
+	end)
+	local client = assert(socket.open(addr, port))
+	while not server do
+		skynet.sleep(1)
+	end
+
+	socket.write(client, string.rep("x", 10000))
+	socket.block(server)
+	skynet.sleep(10)
+	local info = socket.info(server)
+	print("buffered", info.rbuffer, "nodes", info.rnodes, "memory", info.memory)
+	assert(info.rbuffer == 10000 and info.memory >= 10000)
+	assert(socket.read(server, 10000))
+	assert(socket.info(server).rbuffer == 0)
+
+	local piece = string.rep("y", 64 * 1024)
+	skynet.fork(function()
+		for i = 1, SIZE // #piece do
+			socket.write(client, piece)
+			if i % 16 == 0 then
+				skynet.sleep(0)
+			end
+		end
+	end)
+	local start = skynet.now()
+	local n = 0
+	while n < SIZE do
+		n = n + #socket.read(server, 4096)
+	end
+	print("read", SIZE, "bytes", (skynet.now() - start) * 10, "ms")
+
+	socket.close(client)
+	socket.close(server)
+
+	-- the nodes of a socket closed with unread data go back to the arena
+	for i = 1, 100 do
+		server = nil
+		client = assert(socket.open(addr, port))
+		while not server do
+			skynet.sleep(1)
+		end
+		for j = 1, 8 do
+			socket.write(client, "unread")
+			skynet.sleep(0)
+		end
+		while socket.info(server).rbuffer < 48 do
+			skynet.sleep(1)
+		end
+		-- the arena counts the nodes in use of all the buffers
+		info = socket.info(server)
+		assert(info.pool == info.rnodes, "buffer nodes leak")
+		socket.close(client)
+		socket.close(server)
+	end
+
+	socket.close(listen)
+	skynet.exit()
+end)
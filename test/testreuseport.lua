@@ -0,0 +1,68 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- connection storm : N shards listen the same port with SO_REUSEPORT, CLIENTS connections at once
+local mode, port = ...
+local SHARD = 4
+local CLIENTS = 5000
+
+if mode == "shard" then
+
+skynet.start(function()
+	local count = 0
+	local id, addr, p = socket.listen("127.0.0.1", tonumber(port), 1024, true)
+	socket.start(id, function(fd)
+		count = count + 1
+		socket.close(fd)
+	end)
+	skynet.dispatch("lua", function(_,_, cmd)
+		if cmd == "port" then
+			skynet.ret(skynet.pack(p))
+		elseif cmd == "count" then
+			skynet.ret(skynet.pack(count))
+		else
+			socket.close(id)
+			skynet.ret()
+			skynet.exit()
+		end
+	end)
+end)
+
+else
+
+skynet.start(function()
+	local shards = { skynet.newservice(SERVICE_NAME, "shard", 0) }
+	local p = skynet.call(shards[1], "lua", "port")
+	for i = 2, SHARD do
+		shards[i] = skynet.newservice(SERVICE_NAME, "shard", p)
+	end
+
+	local start = skynet.now()
+	local c = {}
+	for i = 1, CLIENTS do
+		skynet.fork(function()
+			c[i] = socket.open("127.0.0.1", p)
+		end)
+	end
+	local total
+	repeat
+		skynet.sleep(1)
+		total = 0
+		for i = 1, SHARD do
+			total = total + skynet.call(shards[i], "lua", "count")
+		end
+	until total >= CLIENTS
+	print("accept", CLIENTS, "connections", (skynet.now() - start) * 10, "ms")
+	for i = 1, SHARD do
+		print("shard", i, skynet.call(shards[i], "lua", "count"))
+		skynet.call(shards[i], "lua", "exit")
+	end
+	for i = 1, CLIENTS do
+		if c[i] then
+			socket.close(c[i])
+		end
+	end
+	skynet.exit()
+end)
+
+end
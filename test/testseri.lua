@@ -0,0 +1,183 @@
+local skynet = require "skynet"
+
+local function equal(a, b)
+	if type(a) ~= "table" or type(b) ~= "table" then
+		return a == b or (a ~= a and b ~= b)
+	end
+	for k, v in pairs(a) do
+		if not equal(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+
+local function roundtrip(...)
+	local n = select("#", ...)
+	local r = table.pack(skynet.unpack(skynet.pack(...)))
+	assert(r.n == n, "count")
+	for i = 1, n do
+		assert(equal(select(i, ...), r[i]), "value " .. i)
+	end
+	-- the string version
+	r = table.pack(skynet.unpack(skynet.packstring(...)))
+	assert(r.n == n)
+end
+
+local function test()
+	roundtrip()
+	roundtrip(nil, true, false, 0, 1, -1, 255, 256, 65536, -65536, 1 << 40, 1.5, math.huge, 0/0)
+	roundtrip("", "a", string.rep("x", 31), string.rep("y", 32), string.rep("z", 70000))
+	roundtrip({}, { 1, 2, 3 }, { a = 1, b = 2 }, { 1, 2, x = { y = { z = "deep" } } })
+	local obj = setmetatable({}, { __pairs = function(t)
+		local i = 0
+		return function()
+			i = i + 1
+			if i <= 10 then
+				-- the keys are temporary strings
+				return "key" .. i, "value" .. i
+			end
+		end, t, nil
+	end })
+	local expect = {}
+	for i = 1, 10 do
+		expect["key" .. i] = "value" .. i
+	end
+	local r, key, value = skynet.unpack(skynet.pack(obj, "key1", "value10"))
+	assert(equal(r, expect) and key == "key1" and value == "value10", "__pairs")
+
+	-- the repeated strings are packed once
+	local list = {}
+	for i = 1, 100 do
+		list[i] = { name = "name", level = i, status = "online" }
+	end
+	roundtrip(list)
+	local sz = #skynet.packstring(list)
+	local sz1 = #skynet.packstring(list[1])
+	assert(sz < sz1 * 100 / 2, "stringref")
+
+	-- the references across 64K and 16M, with many different strings
+	local big = { "first string" }
+	for i = 1, 100000 do
+		big[#big+1] = "str" .. i
+		big[#big+1] = string.rep("p", 100)
+	end
+	big[#big+1] = "first string"
+	for i = 1, 100000, 7 do
+		big[#big+1] = "str" .. i
+	end
+	roundtrip(big)
+
+	-- the record arrays packed by columns
+	local records = {}
+	for i = 1, 20 do
+		records[i] = {
+			zero = 0, byte = i, word = i * 1000, dword = -i, qword = i << 40,
+			real = i / 3, flag = i % 2 == 0, name = "name" .. (i % 3),
+			mixed = i % 2 == 0 and i or tostring(i), sub = { i, { x = i } },
+		}
+	end
+	roundtrip(records, { list = records, records })
+	local row = {}
+	for i = 1, 20 do
+		row[i] = { id = i }
+	end
+	row[10] = { id = 10, extra = true }	-- not the same keys
+	roundtrip(row)
+	row[10] = setmetatable({ id = 10 }, {})
+	roundtrip(row)
+	row[10] = { id = 10, 1 }
+	roundtrip(row)
+	row[10] = { id = 10 }
+	row.n = 20
+	roundtrip(row)
+	-- the values in the array part after a hole
+	for _, extra in ipairs { 11, 13, 14 } do
+		local hole = {}
+		for i = 1, 8 do
+			hole[i] = { id = i }
+		end
+		hole[extra] = { id = extra }
+		roundtrip(hole)
+	end
+	local zero = {}
+	for i = 1, 20 do
+		zero[i] = { id = 0 }
+	end
+	roundtrip(zero)
+	-- a column of 16M records in a short stream
+	local bad = string.pack("<BBi4BBc1B", 0x4f, 0x22, 0xffffff, 1, 0x0c, "a", 0x0a)
+	local ok, err = pcall(skynet.unpack, bad)
+	assert(not ok and err:find "Invalid serialize stream", err)
+	print("seri check ok")
+end
+
+local function payloads()
+	local record = { id = 10001, name = "skynet", level = 42, exp = 123456789, online = true, pos = { x = 1.5, y = 2.5 } }
+	local list = {}
+	for i = 1, 100 do
+		list[i] = { id = i, name = "item" .. (i % 10), count = i * 3, bind = (i % 2 == 0), price = i * 1.5 }
+	end
+	-- one odd record makes the list packed by rows
+	local list_row = table.move(list, 1, #list, 1, {})
+	list_row[#list_row] = { id = 0 }
+	local pos = {}
+	for i = 1, 1000 do
+		pos[i] = { id = 10000 + i, x = i * 0.5, y = i * 0.25, dir = i % 360 }
+	end
+	local pos_row = table.move(pos, 1, #pos, 1, {})
+	pos_row[#pos_row] = { id = 0 }
+	local str = string.rep("x", 4096)
+	local map = {}
+	for i = 1, 100 do
+		map["key" .. i] = i
+	end
+	return {
+		{ "call", function() return "get", 12345 end },
+		{ "record", function() return "set", record end },
+		{ "list100", function() return list end },
+		{ "list100row", function() return list_row end },
+		{ "pos1000", function() return pos end },
+		{ "pos1000row", function() return pos_row end },
+		{ "map100", function() return map end },
+		{ "string4k", function() return str end },
+	}
+end
+
+local function bench()
+	for _, p in ipairs(payloads()) do
+		local name, f = p[1], p[2]
+		local msg, sz = skynet.pack(f())
+		skynet.trash(msg, sz)
+		local n = math.max(200, 1000000 // (sz + 100))
+		local pack, unpack = math.huge, math.huge
+		-- the best of 5 rounds
+		for _ = 1, 5 do
+			local t = skynet.hpc()
+			for i = 1, n do
+				msg, sz = skynet.pack(f())
+				skynet.trash(msg, sz)
+			end
+			pack = math.min(pack, (skynet.hpc() - t) / n)
+			msg, sz = skynet.pack(f())
+			t = skynet.hpc()
+			for i = 1, n do
+				skynet.unpack(msg, sz)
+			end
+			unpack = math.min(unpack, (skynet.hpc() - t) / n)
+			skynet.trash(msg, sz)
+		end
+		print(string.format("%-10s : %6d bytes, pack %8.0f ns, unpack %8.0f ns", name, sz, pack, unpack))
+	end
+end
+
+skynet.start(function()
+	test()
+	bench()
+	skynet.exit()
+end)
@@ -0,0 +1,68 @@
+local skynet = require "skynet"
+
+-- run it twice, with lua_slab = true and false in config
+local mode = ...
+local WORKER = 4
+local N = 50000
+local ROUND = 20
+
+local function rss()
+	local f = io.open "/proc/self/statm"
+	if not f then
+		return 0
+	end
+	local _, resident = f:read "n", f:read "n"
+	f:close()
+	return resident * 4096
+end
+
+if mode == "worker" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function()
+		local start = skynet.hpc()
+		local keep
+		for r = 1, ROUND do
+			local t = {}
+			for i = 1, N do
+				t[i] = { id = i, name = "name" .. i, f = function() return i end }
+			end
+			-- keep a part of the objects, so the pages are fragmented
+			keep = {}
+			for i = 1, N, 10 do
+				keep[#keep+1] = t[i]
+			end
+		end
+		skynet.ret(skynet.pack((skynet.hpc() - start) / 1e9, collectgarbage "count" * 1024, #keep))
+	end)
+end)
+
+else
+
+skynet.start(function()
+	local rss_start = rss()
+	local workers = {}
+	for i = 1, WORKER do
+		workers[i] = skynet.newservice(SERVICE_NAME, "worker")
+	end
+	local start = skynet.hpc()
+	local mem = 0
+	local co = {}
+	for i = 1, WORKER do
+		skynet.fork(function()
+			local _, m = skynet.call(workers[i], "lua")
+			mem = mem + m
+			co[#co+1] = i
+			if #co == WORKER then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	local wall = (skynet.hpc() - start) / 1e9
+	print(string.format("lua_slab = %s : %d objects, wall %.3fs, lua memory %.2fM, rss %.2fM",
+		skynet.getenv "lua_slab", WORKER * ROUND * N * 3, wall, mem / (1024 * 1024), (rss() - rss_start) / (1024 * 1024)))
+	skynet.exit()
+end)
+
+end
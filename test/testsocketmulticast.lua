@@ -0,0 +1,70 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- one socket request for many connections, the length header is written by writev without copy
+local N = 200
+local ROUND = 200
+
+local function bench(name, clients, c, send)
+	local msg = string.rep("m", 512)
+	local start = skynet.now()
+	for i = 1, ROUND do
+		send(clients, msg)
+	end
+	local expect = string.pack(">s2", msg):rep(ROUND)
+	for i = 1, N do
+		assert(socket.read(c[i], #expect) == expect)
+	end
+	print(name, N, "clients", ROUND, "messages", (skynet.now() - start) * 10, "ms")
+end
+
+skynet.start(function()
+	local clients = {}
+	local listen, addr, port = socket.listen("127.0.0.1", 0)
+	socket.start(listen, function(id)
+		socket.start(id)
+		table.insert(clients, id)
+	end)
+	local c = {}
+	for i = 1, N do
+		c[i] = assert(socket.open(addr, port))
+	end
+	while #clients < N do
+		skynet.sleep(1)
+	end
+
+	-- large payload with 4 bytes header, the kernel buffer is full and writes are partial
+	local big = string.rep("0123456789", 100000)
+	assert(socket.broadcast({ clients[1], clients[2] }, big, 4) == 2)
+	assert(socket.broadcast({ clients[1], clients[2] }, "", 2) == 2)
+	for i = 1, 2 do
+		assert(socket.read(c[i], 4 + #big) == string.pack(">s4", big))
+		assert(socket.read(c[i], 2) == "\0\0")
+	end
+	assert(not pcall(socket.broadcast, clients, string.rep("x", 0x10000), 2))
+
+	-- the writes in the coalesce window are sent before the broadcast
+	socket.coalesce(clients[1], 100000)
+	socket.write(clients[1], "first")
+	assert(socket.broadcast({ clients[1] }, "second", 2) == 1)
+	assert(socket.read(c[1], 5 + 8) == "first\0\6second")
+	socket.coalesce(clients[1], -1)
+
+	bench("write", clients, c, function(ids, msg)
+		local pack = string.pack(">s2", msg)
+		for _, id in ipairs(ids) do
+			socket.write(id, pack)
+		end
+	end)
+	bench("broadcast", clients, c, function(ids, msg)
+		socket.broadcast(ids, msg, 2)
+	end)
+	print("multicast ok")
+
+	for i = 1, N do
+		socket.close(c[i])
+		socket.close(clients[i])
+	end
+	socket.close(listen)
+	skynet.exit()
+end)
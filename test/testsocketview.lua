@@ -0,0 +1,84 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+local N = 200000
+
+local function test_view(server, client)
+	-- the data in one node is referenced, the data across nodes is copied
+	socket.write(client, "hello world\r\n")
+	skynet.sleep(1)
+	socket.write(client, "split")
+	skynet.sleep(1)
+	socket.write(client, " line\r")
+	skynet.sleep(1)
+	socket.write(client, "\nGET /index.html HTTP/1.1\r\n")
+	local v = socket.readlineview(server, "\r\n")
+	assert(tostring(v) == "hello world" and #v == 11)
+	assert(tostring(v:sub(1, 5)) == "hello" and tostring(v:sub(-5)) == "world")
+	assert(v:byte(1) == string.byte "h" and v:byte(-1) == string.byte "d" and v:byte(12) == nil)
+	assert(v:find("world") == 7 and v:find "xxx" == nil)
+	local v2 = socket.readlineview(server, "\r\n")
+	assert(tostring(v2) == "split line")
+	local line = socket.readlineview(server, "\r\n")
+	local a, b = line:find " "
+	assert(tostring(line:sub(1, a-1)) == "GET")
+	local c = line:find(" ", b + 1)
+	assert(tostring(line:sub(b+1, c-1)) == "/index.html")
+
+	-- C parsers can use the memory directly
+	local msg = skynet.packstring("view", 1, { 2, 3 })
+	socket.write(client, string.pack(">s2", msg))
+	local sz = socket.header(socket.read(server, 2))
+	local body = socket.readview(server, sz)
+	local name, n, t = skynet.unpack(body:ptr())
+	assert(name == "view" and n == 1 and t[2] == 3)
+
+	-- the sub view keeps the chunk alive after the buffer moves on
+	local keep = v:sub(7)
+	v, v2, line, body = nil
+	socket.write(client, string.rep("x", 4096))
+	assert(#socket.readview(server, 4096) == 4096)
+	collectgarbage()
+	assert(tostring(keep) == "world")
+	print("view ok")
+end
+
+local function bench(server, client, readline, name, size)
+	local n = N * 100 // size
+	local tmp = {}
+	local data = string.rep("x", size)
+	for i = 1, n do
+		tmp[#tmp+1] = data
+		if i % 1000 == 0 or i == n then
+			socket.write(client, table.concat(tmp, "\n", 1, #tmp) .. "\n")
+			tmp = {}
+		end
+	end
+	local start = skynet.now()
+	for i = 1, n do
+		assert(#readline(server) == size)
+	end
+	print(name, n, "lines", size, "bytes", (skynet.now() - start) * 10, "ms")
+end
+
+skynet.start(function()
+	local server
+	local listen, addr, port = socket.listen("127.0.0.1", 0)
+	socket.start(listen, function(id)
+		socket.start(id)
+		server = id
+	end)
+	local client = assert(socket.open(addr, port))
+	while not server do
+		skynet.sleep(1)
+	end
+	test_view(server, client)
+	for _, size in ipairs { 100, 16384 } do
+		bench(server, client, socket.readline, "readline", size)
+		bench(server, client, socket.readlineview, "readlineview", size)
+	end
+	socket.close(client)
+	socket.close(server)
+	socket.close(listen)
+	skynet.exit()
+end)
@@ -0,0 +1,47 @@
+local skynet = require "skynet"
+require "skynet.manager"
+local template = require "skynet.template"
+
+local mode = ...
+local N = 1000
+
+if mode == "agent" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function()
+		skynet.ret()
+	end)
+end)
+
+else
+
+local function spawn(n, warm)
+	local agents = {}
+	local start = skynet.hpc()
+	for i = 1, n do
+		if not warm then
+			-- every instance searches the files as the first one
+			template.clear()
+		end
+		agents[i] = skynet.newservice(SERVICE_NAME, "agent")
+	end
+	local ti = (skynet.hpc() - start) / 1e9
+	for i = 1, n do
+		skynet.call(agents[i], "lua")
+		skynet.kill(agents[i])
+	end
+	return ti
+end
+
+skynet.start(function()
+	local cold, warm = 0, 0
+	for i = 1, 3 do
+		cold = cold + spawn(N, false)
+		warm = warm + spawn(N, true)
+	end
+	print(string.format("spawn %d services : cold %.0f services/sec, warm template %.0f services/sec", N * 3, N * 3 / cold, N * 3 / warm))
+	print("template", template.get(SERVICE_NAME))
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,45 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+local driver = require "skynet.socketdriver"
+
+-- the datagrams read by one recvmmsg come in one message (SKYNET_SOCKET_TYPE_UDP_BATCH)
+local N = 64
+local PORT = 8766
+
+local function datagram(i)
+	return string.pack(">I2", i) .. string.rep(string.char(i % 256), i * 13 % 1000)
+end
+
+skynet.start(function()
+	local co = coroutine.running()
+	local recv = {}
+	local host = socket.udp(function(str, from)
+		recv[#recv+1] = str
+		assert(socket.udp_address(from) == "127.0.0.1")
+		if #recv == N then
+			skynet.wakeup(co)
+		end
+	end, "127.0.0.1", PORT)
+	-- the datagrams are queued in the kernel until the host reads again
+	driver.pause(host)
+
+	local c = socket.udp(function() end)
+	socket.udp_connect(c, "127.0.0.1", PORT)
+	for i = 1, N do
+		socket.write(c, datagram(i))
+	end
+	skynet.sleep(10)
+
+	local messages = skynet.stat "message"
+	driver.start(host)
+	skynet.wait(co)
+	messages = skynet.stat "message" - messages
+	for i = 1, N do
+		assert(recv[i] == datagram(i), i)
+	end
+	print(string.format("udp batch ok : %d datagrams in %d messages", N, messages))
+	assert(messages < N, "not batched")
+	socket.close(c)
+	socket.close(host)
+	skynet.exit()
+end)
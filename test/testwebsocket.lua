@@ -0,0 +1,132 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+local websocket = require "http.websocket"
+local wsframe = require "skynet.websocket"
+local crypt = require "skynet.crypt"
+local socketdriver = require "skynet.socketdriver"
+
+-- websocket frames are built/parsed in C, the socket thread splits and unmasks the frames of server
+local mode = ...
+local N = 20000
+
+if mode == "server" then
+
+local handle = {}
+
+function handle.message(id, msg, msg_type)
+	websocket.write(id, msg, msg_type)
+end
+
+skynet.start(function()
+	local id, addr, port = socket.listen("127.0.0.1", 0)
+	socket.start(id, function(fd, addr)
+		socketdriver.nodelay(fd)
+		skynet.fork(websocket.accept, fd, handle, "ws", addr)
+	end)
+	skynet.dispatch("lua", function()
+		skynet.ret(skynet.pack(port))
+	end)
+end)
+
+else
+
+-- the frame codec in lua before
+local function lua_pack(payload, key)
+	local len = #payload
+	local s
+	if len < 126 then
+		s = string.pack("I1I1", 0x82, 0x80 | len)
+	elseif len <= 0xffff then
+		s = string.pack("I1I1>I2", 0x82, 0x80 | 126, len)
+	else
+		s = string.pack("I1I1>I8", 0x82, 0x80 | 127, len)
+	end
+	local k = string.pack(">I4", key)
+	return s .. k .. crypt.xor_str(payload, k)
+end
+
+local function lua_unpack(s)
+	local v1, v2, pos = string.unpack("I1I1", s)
+	local len = v2 & 0x7f
+	if len == 126 then
+		len, pos = string.unpack(">I2", s, pos)
+	elseif len == 127 then
+		len, pos = string.unpack(">I8", s, pos)
+	end
+	local key = s:sub(pos, pos + 3)
+	return (v1 & 0x80) ~= 0, v1 & 0xf, crypt.xor_str(s:sub(pos + 4, pos + 3 + len), key)
+end
+
+local function codec(size)
+	local payload = string.rep("p", size)
+	local key = 0x12345678
+	local n = N * 5
+	local start = skynet.hpc()
+	for i = 1, n do
+		local _, _, p = lua_unpack(lua_pack(payload, key))
+		assert(#p == size)
+	end
+	local lua_ti = (skynet.hpc() - start) / 1e9
+	start = skynet.hpc()
+	for i = 1, n do
+		local _, _, p = wsframe.unpack(wsframe.pack(2, payload, true, key))
+		assert(#p == size)
+	end
+	local c_ti = (skynet.hpc() - start) / 1e9
+	print(string.format("codec %dB : lua %.0f frames/sec, c %.0f frames/sec", size, n / lua_ti, n / c_ti))
+end
+
+local function echo(ws, size)
+	local payload = string.rep("e", size)
+	local start = skynet.now()
+	for i = 1, N do
+		websocket.write(ws, payload, "binary", i)
+		if i % 100 == 0 then
+			for j = 1, 100 do
+				assert(websocket.read(ws) == payload)
+			end
+		end
+	end
+	local ti = math.max(skynet.now() - start, 1) / 100
+	print(string.format("echo %dB : %d frames %.2fs %.0f frames/sec", size, N, ti, N / ti))
+end
+
+skynet.start(function()
+	-- frame codec : mask offset, control frames and fragments
+	local key = "\1\2\3\4"
+	local data = "hello websocket"
+	local masked = wsframe.mask(data, key)
+	assert(crypt.xor_str(data, key) == masked)
+	assert(wsframe.mask(masked:sub(6), key, 5) == data:sub(6))
+	assert(wsframe.mask(string.rep("x", 1000), 0x01020304) == crypt.xor_str(string.rep("x", 1000), key))
+	local frames = wsframe.pack(1, "frag", false, key) .. wsframe.pack(9, "ping") .. wsframe.pack(0, "ment", true, key)
+	local fin, op, payload, pos = wsframe.unpack(frames)
+	assert(not fin and op == 1 and payload == "frag")
+	fin, op, payload, pos = wsframe.unpack(frames, pos)
+	assert(fin and op == 9 and payload == "ping")
+	fin, op, payload, pos = wsframe.unpack(frames, pos)
+	assert(fin and op == 0 and payload == "ment" and pos == #frames + 1)
+	assert(wsframe.unpack(frames:sub(1, 5)) == nil)
+	local big = string.rep("b", 70000)
+	assert(select(3, wsframe.unpack(wsframe.pack(2, big, true, key), 1, 1 << 20)) == big)
+	assert(not pcall(wsframe.unpack, wsframe.pack(2, big), 1, 65536))
+	print("codec ok")
+
+	codec(64)
+	codec(4096)
+
+	local server = skynet.newservice(SERVICE_NAME, "server")
+	local port = skynet.call(server, "lua")
+	local ws = websocket.connect("ws://127.0.0.1:" .. port .. "/bench")
+	socketdriver.nodelay(ws)
+	echo(ws, 64)
+	echo(ws, 4096)
+	websocket.ping(ws)
+	websocket.write(ws, big, "binary", 0x55aa55aa)
+	assert(websocket.read(ws) == big)
+	websocket.close(ws)
+	print("websocket ok")
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,93 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- the limits of the write buffers, the peer doesn't read (paused) so the rest of a direct write is buffered
+local LIMIT = 1024 * 1024
+local BIG = string.rep("x", 16 * 1024 * 1024)
+
+local addr, port
+local accepted
+
+local function pair()
+	local client = assert(socket.open(addr, port))
+	socket.pause(client)
+	while not accepted do
+		skynet.sleep(1)
+	end
+	local server = accepted
+	accepted = nil
+	return server, client
+end
+
+local function wait(f)
+	for i = 1, 200 do
+		if f() then
+			return true
+		end
+		skynet.sleep(1)
+	end
+end
+
+local function test_notify(global)
+	local server, client = pair()
+	if global then
+		socket.write_limit_global(LIMIT, "notify")
+	else
+		socket.write_limit(server, LIMIT, "notify")
+	end
+	local warned
+	socket.warning(server, function(id, size)
+		warned = warned or size
+	end)
+	socket.write(server, BIG)
+	assert(wait(function() return warned end), "no warning")
+	assert(warned * 1024 > LIMIT)
+	if global then
+		socket.write_limit_global(0)
+	end
+	socket.close(client)
+	socket.close(server)
+end
+
+local function test_drop()
+	local server, client = pair()
+	socket.write_limit(server, LIMIT, "drop")
+	local warned
+	socket.warning(server, function(id, size)
+		warned = warned or size
+	end)
+	socket.write(server, BIG)
+	assert(wait(function() return warned end), "no warning")
+	-- the low priority data is dropped, the buffer is still over the limit
+	socket.lwrite(server, "low")
+	skynet.sleep(1)
+	socket.close(server)
+	local data = socket.readall(client)
+	assert(#data == #BIG, #data)
+	socket.close(client)
+end
+
+local function test_close()
+	local server, client = pair()
+	socket.write_limit(server, LIMIT)
+	socket.write(server, BIG)
+	assert(socket.read(server) == false)
+	socket.close(server)
+	socket.close(client)
+end
+
+skynet.start(function()
+	local listen
+	listen, addr, port = socket.listen("127.0.0.1", 0)
+	socket.start(listen, function(id)
+		socket.start(id)
+		accepted = id
+	end)
+	test_notify()
+	test_notify(true)
+	test_drop()
+	test_close()
+	socket.close(listen)
+	print("write limit ok")
+	skynet.exit()
+end)
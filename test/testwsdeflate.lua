@@ -0,0 +1,105 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+local socketdriver = require "skynet.socketdriver"
+local websocket = require "http.websocket"
+local ldeflate = require "ldeflate"
+
+-- build with DEFLATE_MODULE=ldeflate (zlib)
+local mode = ...
+local N = 2000
+
+local dictionary = [[{"id":,"name":"player","level":,"hp":,"mp":,"pos":{"x":,"y":,"z":},"items":[],"buff":[]}]]
+
+local CONF = {
+	takeover = {},
+	no_takeover = { context_takeover = false },
+	dictionary = { context_takeover = false, dictionary = dictionary },
+	small_window = { window_bits = 10, peer_window_bits = 10, mem_level = 4 },
+}
+
+if mode == "server" then
+
+local handle = {}
+
+function handle.message(id, msg, msg_type)
+	websocket.write(id, msg, msg_type)
+end
+
+skynet.start(function()
+	local ports = {}
+	for name, conf in pairs(CONF) do
+		local id, addr, port = socket.listen("127.0.0.1", 0)
+		socket.start(id, function(fd, addr)
+			socketdriver.nodelay(fd)
+			skynet.fork(websocket.accept, fd, handle, "ws", addr, { deflate = conf })
+		end)
+		ports[name] = port
+	end
+	skynet.dispatch("lua", function()
+		skynet.ret(skynet.pack(ports))
+	end)
+end)
+
+else
+
+local function message(i)
+	return string.format([[{"id":%d,"name":"player%d","level":%d,"hp":%d,"mp":%d,"pos":{"x":%d,"y":%d,"z":0},"items":[],"buff":[]}]],
+		i, i % 100, i % 60, i * 7 % 1000, i * 3 % 500, i % 256, i % 128)
+end
+
+local function received(id)
+	for _, v in ipairs(socket.netstat()) do
+		if v.id == id then
+			return v.read
+		end
+	end
+end
+
+local function echo(port, name, conf)
+	local ws = websocket.connect("ws://127.0.0.1:" .. port .. "/deflate", nil, nil, conf and { deflate = conf })
+	socketdriver.nodelay(ws)
+	local raw = 0
+	local start = skynet.now()
+	for i = 1, N do
+		local msg = message(i)
+		raw = raw + #msg
+		websocket.write(ws, msg, "text", i)
+		assert(websocket.read(ws) == msg)
+	end
+	local ti = (skynet.now() - start) * 10
+	local bytes = received(ws)
+	-- a message larger than the chunk of the stream
+	local big = string.rep(message(0), 1000)
+	websocket.write(ws, big, "binary", 1)
+	assert(websocket.read(ws) == big)
+	print(string.format("%-12s : %d messages %d bytes, received %d bytes, %d ms", name, N, raw, bytes, ti))
+	websocket.close(ws)
+end
+
+skynet.start(function()
+	-- the stream
+	local d = ldeflate.new("deflate", 15, 6, 8, dictionary)
+	local i = ldeflate.new("inflate", 15, nil, nil, dictionary)
+	local msg = message(1)
+	local c = d:deflate(msg, true)
+	assert(#c < #msg and i:inflate(c, 1024, true) == msg)
+	assert(not pcall(i.inflate, i, d:deflate(string.rep(msg, 100), true), 1024, true))
+	assert(i:inflate(d:deflate("", true), 1024, true) == "")
+	print("stream ok")
+
+	local server = skynet.newservice(SERVICE_NAME, "server")
+	local ports = skynet.call(server, "lua")
+	-- the client doesn't offer permessage-deflate
+	echo(ports.takeover, "plain")
+	for _, name in ipairs { "takeover", "no_takeover", "dictionary", "small_window" } do
+		echo(ports[name], name, CONF[name])
+	end
+
+	local per_connection = ldeflate.memory("deflate", 15) + ldeflate.memory("inflate", 15)
+	print(string.format("memory per connection : takeover %d bytes, small_window %d bytes, no_takeover 0 (shared %d bytes)",
+		per_connection, ldeflate.memory("deflate", 10, 4) + ldeflate.memory("inflate", 10), per_connection))
+	print("websocket deflate ok")
+	skynet.exit()
+end)
+
+end